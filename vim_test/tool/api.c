@@ -904,7 +904,7 @@ static void shannon_write_usage(void)
 
 	printf("Option:\n");
 	printf("\t-e, --seed=SEED\n"
-		"\t\tset the seed of generate data, default use gettimeofday.tv_usec\n\n");
+		"\t\tset the seed of generate data, default use gettimeofday.tv_usec. Data is test pattern if --pattern of tool is given\n\n");
 	printf("\t-p, --print-option=[D/M]\n"
 		"\t\tprint the write data/metadata. default print no\n\n");
 	printf("\t-H, --head=HEAD\n"
@@ -1052,12 +1052,14 @@ int shannon_write(struct shannon_dev *dev, int argc, char **argv)
 			goto out;
 		}
 
-		if (!fromfile) {
-			pad_rand(chunk_head_req->data, dev->config->ndata);
-			pad_rand(chunk_head_req->metadata, dev->config->nmeta);
-		} else {
+		if (fromfile) {
 			fill_meta_data(dev, chunk_head_req, fp_meta);
 			fill_user_data(dev, chunk_head_req, fp_user);
+		} else if (NULL != dev->pattern) {
+			prng_fill_request(dev, dev->pattern, seed, chunk_head_req);
+		} else {
+			pad_rand(chunk_head_req->data, dev->config->ndata);
+			pad_rand(chunk_head_req->metadata, dev->config->nmeta);
 		}
 
 		/* other chunk request if have */
@@ -1068,12 +1070,14 @@ int shannon_write(struct shannon_dev *dev, int argc, char **argv)
 				goto free_req_out;
 			}
 
-			if (!fromfile) {
-				pad_rand(req->data, dev->config->ndata);
-				pad_rand(req->metadata, dev->config->nmeta);
-			} else {
+			if (fromfile) {
 				fill_meta_data(dev, req, fp_meta);
 				fill_user_data(dev, req, fp_user);
+			} else if (NULL != dev->pattern) {
+				prng_fill_request(dev, dev->pattern, seed, req);
+			} else {
+				pad_rand(req->data, dev->config->ndata);
+				pad_rand(req->metadata, dev->config->nmeta);
 			}
 
 			list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
@@ -16,16 +16,28 @@
 int erase_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 {
 	int rc = 0;
-	int head, lun, plane, blk, ppa;
-	struct shannon_request *chunk_head_req, *req, *tmp;
-	struct list_head req_head;
+	int i, n, lun, plane, blk, ppa;
+	struct shannon_request **reqs = NULL;
+	struct req_set set;
+	unsigned long hole_luns[MAX_LUN_NLONG];
 	int pre_cent, now_cent;
 
-	head = INDEP_HEAD;
-	if (dev->config->nplane > 1)
-		head |= (1 << SH_ERASE_PLANE_SHIFT);
+	/* single-plane erase requests of one super block, bound to each block below and merged by submit_batch() */
+	init_req_set(&set, dev);
+	for_dev_each_lun(dev, lun) {
+		for (plane = 0; plane < dev->config->nplane; plane++) {
+			if (NULL == req_set_add(&set, NULL, sh_erase_cmd, lun, plane * dev->flash->npage, INDEP_HEAD, 0, 0, REQ_DMA_COPY)) {
+				rc = ALLOCMEM_FAILED;
+				goto free_req_out;
+			}
+		}
+	}
 
-	INIT_LIST_HEAD(&req_head);
+	reqs = malloc(set.nreq * sizeof(*reqs));
+	if (NULL == reqs) {
+		rc = ALLOCMEM_FAILED;
+		goto free_req_out;
+	}
 
 	if (bbt->nblock == dev->flash->nblk) {
 		pre_cent = now_cent = 0;
@@ -36,49 +48,32 @@ int erase_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 	for (blk = 0; blk < bbt->nblock / dev->config->nplane; blk++) {
 		ppa = blk * dev->config->nplane * dev->flash->npage;
 
-		/* alloc erase request */
+		memset(hole_luns, 0x00, sizeof(hole_luns));
 		for_dev_each_lun(dev, lun) {
 			if (dev->targetlun[lun].blk_hole_count && blk*dev->config->nplane >= dev->targetlun[lun].blk_hole_begin) {
 				set_bit(lun, bbt->sb_bbt[blk]);
-				continue;
-			}
-
-			chunk_head_req = alloc_request(dev, sh_erase_cmd, lun, ppa, head, 0, 0);
-			if (NULL == chunk_head_req) {
-				rc = ALLOCMEM_FAILED;
-				goto free_req_out;
-			}
-			list_add_tail(&chunk_head_req->list, &req_head);
-
-			for (plane = 1; plane < dev->config->nplane; plane++) {
-				req = alloc_request(dev, sh_erase_cmd, lun, ppa + plane * dev->flash->npage, head, 0, 0);
-				if (NULL == req) {
-					rc = ALLOCMEM_FAILED;
-					goto free_req_out;
-				}
-				list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
+				set_bit(lun, hole_luns);
 			}
 		}
 
+		bind_req_set(&set, ppa);
+		n = array_req_set(&set, reqs, hole_luns);
+
 		/* summit all request and execute them */
-		list_for_each_entry(req, &req_head, list) {
-			if ((rc = dev->submit_request(req)))
-				goto free_req_out;
-			update_cmdqueue(dev, req->lun);
+		if (submit_batch(dev, reqs, n) != n) {
+			rc = NO_CMDQUEUE_ROOM;
+			goto free_req_out;
 		}
 
-		// for_dev_each_lun(dev, lun)
-		//	update_cmdqueue(dev, lun);
-
 		for_dev_each_lun(dev, lun) {
 			if ((rc = poll_cmdqueue(dev, lun)))
 				goto free_req_out;
 		}
 
 		/* check status */
-		list_for_each_entry(req, &req_head, list) {
-			if (check_req_status_silent(req))
-				set_bit(req->lun, bbt->sb_bbt[blk]);
+		for (i = 0; i < n; i++) {
+			if (check_req_status_silent(reqs[i]))
+				set_bit(reqs[i]->lun, bbt->sb_bbt[blk]);
 		}
 
 		/* print progress */
@@ -90,22 +85,14 @@ int erase_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 				pre_cent = now_cent;
 			}
 		}
-
-		/* free req */
-		list_for_each_entry_safe(req, tmp, &req_head, list) {
-			list_del(&req->list);
-			free_request(req);
-		}
 	}
 
 	if (bbt->nblock == dev->flash->nblk)
 		printf("\n");
 
 free_req_out:
-	list_for_each_entry_safe(req, tmp, &req_head, list) {
-		list_del(&req->list);
-		free_request(req);
-	}
+	free(reqs);
+	free_req_set(&set);
 	return rc;
 }
 
@@ -114,11 +101,12 @@ free_req_out:
  */
 int flagbyte_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 {
-	int i, rc = 0;
-	int bs, ns, bb, nrow, j;
+	int i, k, n, rc = 0;
+	int bs, ns, bb, nrow, j, nreq;
 	int lun, plane, blk, ppa, head;
-	struct shannon_request *chunk_head_req, *req, *tmp;
-	struct list_head req_head;
+	struct shannon_request *chunk_head_req, *req, **reqs = NULL;
+	struct req_set set[8];
+	unsigned long hole_luns[MAX_LUN_NLONG];
 	int pre_cent, now_cent;
 
 	/* round up flash entire-page-size */
@@ -145,51 +133,36 @@ int flagbyte_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 	for (i = 0; dev->flash->factory_ivb[i].row != -1; i++)
 		nrow++;
 
-	INIT_LIST_HEAD(&req_head);
+	/* one request set per flagbyte row, ppa is relative to super block */
+	for (i = 0; i < nrow; i++)
+		init_req_set(&set[i], dev);
 
-	if (bbt->nblock == dev->flash->nblk) {
-		pre_cent = now_cent = 0;
-		print("ALL blocks flagbyte scan...%%%02d", now_cent);
-	}
+	for (i = 0; i < nrow; i++) {
+		ppa = dev->flash->factory_ivb[i].row;
 
-	assert(bbt->nblock != 0);
-	for (blk = 0; blk < bbt->nblock / dev->config->nplane; blk++) {
-		for (i = 0; dev->flash->factory_ivb[i].row != -1; i++) {
-			ppa = blk * dev->flash->npage * dev->config->nplane + dev->flash->factory_ivb[i].row;
+		/* calculate location range of flagbyte */
+		bs = dev->flash->factory_ivb[i].lo_col / dev->config->full_sector_size;
+		ns = (dev->flash->factory_ivb[i].hi_col + dev->config->full_sector_size) / dev->config->full_sector_size - bs;
+		assert(ns <= 8);
+		// printf("%s(): page=%d bs=%d, ns=%d, cnt=%d\n", __func__, dev->flash->factory_ivb[i].row, bs, ns,
+		//	dev->flash->factory_ivb[i].hi_col - dev->flash->factory_ivb[i].lo_col + 1);
 
-			/* calculate location range of flagbyte */
-			bs = dev->flash->factory_ivb[i].lo_col / dev->config->full_sector_size;
-			ns = (dev->flash->factory_ivb[i].hi_col + dev->config->full_sector_size) / dev->config->full_sector_size - bs;
-			assert(ns <= 8);
-			bb = dev->flash->factory_ivb[i].lo_col % dev->config->full_sector_size;
-			// if (0 == blk)
-			//	printf("%s(): page=%d bs=%d, ns=%d, bb=%d, cnt=%d\n", __func__, dev->flash->factory_ivb[i].row, bs, ns, bb,
-			//		dev->flash->factory_ivb[i].hi_col - dev->flash->factory_ivb[i].lo_col + 1);
-
-			/* requests */
-			for_dev_each_lun(dev, lun) {
-				if (dev->targetlun[lun].blk_hole_count && blk*dev->config->nplane >= dev->targetlun[lun].blk_hole_begin) {
-					set_bit(lun, bbt->sb_bbt[blk]);
-					continue;
-				}
+		for_dev_each_lun(dev, lun) {
+			chunk_head_req = req_set_add(&set[i], NULL, sh_preread_cmd, lun, ppa, head, 0, 0, REQ_DMA_COPY);	// preread
+			if (NULL == chunk_head_req) {
+				rc = ALLOCMEM_FAILED;
+				goto free_req_out;
+			}
 
-				chunk_head_req = alloc_request(dev, sh_preread_cmd, lun, ppa, head, 0, 0);	// preread
-				if (NULL == chunk_head_req) {
+			for (plane = 1; plane < dev->config->nplane; plane++) {
+				if (NULL == req_set_add(&set[i], chunk_head_req, sh_preread_cmd, lun, ppa + plane * dev->flash->npage, head, 0, 0, REQ_DMA_COPY)) {
 					rc = ALLOCMEM_FAILED;
 					goto free_req_out;
 				}
-				list_add_tail(&chunk_head_req->list, &req_head);
-
-				for (plane = 1; plane < dev->config->nplane; plane++) {
-					req = alloc_request(dev, sh_preread_cmd, lun, ppa + plane * dev->flash->npage, head, 0, 0);
-					if (NULL == req) {
-						rc = ALLOCMEM_FAILED;
-						goto free_req_out;
-					}
-					list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
-				}
+			}
 
-				req = alloc_request(dev, sh_cacheread_cmd, lun, ppa, head, bs, 0);		// cacheread
+			for (plane = 0; plane < dev->config->nplane; plane++) {					// cacheread
+				req = req_set_add(&set[i], NULL, sh_cacheread_cmd, lun, ppa + plane * dev->flash->npage, head, bs, 0, REQ_DMA_COPY);
 				if (NULL == req) {
 					rc = ALLOCMEM_FAILED;
 					goto free_req_out;
@@ -201,42 +174,55 @@ int flagbyte_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 					rc = ALLOCMEM_FAILED;
 					goto free_req_out;
 				}
-				list_add_tail(&req->list, &req_head);
+			}
+		}
+	}
 
-				for (plane = 1; plane < dev->config->nplane; plane++) {
-					req = alloc_request(dev, sh_cacheread_cmd, lun, ppa + plane * dev->flash->npage, head, bs, 0);
-					if (NULL == req) {
-						rc = ALLOCMEM_FAILED;
-						goto free_req_out;
-					}
-					req->rw_entire_buffer = 1;
-					req->nsector = ns;
-					req->data = malloc(ns * dev->config->full_sector_size);
-					if (NULL == req->data) {
-						rc = ALLOCMEM_FAILED;
-						goto free_req_out;
-					}
-					list_add_tail(&req->list, &req_head);
-				}
+	nreq = 0;
+	for (i = 0; i < nrow; i++)
+		nreq = (set[i].nreq > nreq) ? set[i].nreq : nreq;
+	reqs = malloc(nreq * sizeof(*reqs));
+	if (NULL == reqs) {
+		rc = ALLOCMEM_FAILED;
+		goto free_req_out;
+	}
+
+	if (bbt->nblock == dev->flash->nblk) {
+		pre_cent = now_cent = 0;
+		print("ALL blocks flagbyte scan...%%%02d", now_cent);
+	}
+
+	assert(bbt->nblock != 0);
+	for (blk = 0; blk < bbt->nblock / dev->config->nplane; blk++) {
+		memset(hole_luns, 0x00, sizeof(hole_luns));
+		for_dev_each_lun(dev, lun) {
+			if (dev->targetlun[lun].blk_hole_count && blk*dev->config->nplane >= dev->targetlun[lun].blk_hole_begin) {
+				set_bit(lun, bbt->sb_bbt[blk]);
+				set_bit(lun, hole_luns);
 			}
+		}
+
+		for (i = 0; i < nrow; i++) {
+			bb = dev->flash->factory_ivb[i].lo_col % dev->config->full_sector_size;
+
+			/* requests */
+			bind_req_set(&set[i], blk * dev->flash->npage * dev->config->nplane);
+			n = array_req_set(&set[i], reqs, hole_luns);
 
 			/* summit all request and execute them */
-			list_for_each_entry(req, &req_head, list) {
-				if ((rc = dev->submit_request(req)))
-					goto free_req_out;
-				update_cmdqueue(dev, req->lun);
+			if (submit_batch(dev, reqs, n) != n) {
+				rc = NO_CMDQUEUE_ROOM;
+				goto free_req_out;
 			}
 
-			// for_dev_each_lun(dev, lun)
-			//	update_cmdqueue(dev, lun);
-
 			for_dev_each_lun(dev, lun) {
 				if ((rc = poll_cmdqueue(dev, lun)))
 					goto free_req_out;
 			}
 
 			/* check preread status and flagbyte */
-			list_for_each_entry(req, &req_head, list) {
+			for (k = 0; k < n; k++) {
+				req = reqs[k];
 				if (req->opcode == sh_preread_cmd) {		// check preread status
 					if (check_req_status_silent(req))
 						set_bit(req->lun, bbt->sb_bbt[blk]);
@@ -265,12 +251,6 @@ int flagbyte_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 					pre_cent = now_cent;
 				}
 			}
-
-			/* free req */
-			list_for_each_entry_safe(req, tmp, &req_head, list) {
-				list_del(&req->list);
-				free_request(req);
-			}
 		}
 	} /* end for_dev_each_block */
 
@@ -278,10 +258,9 @@ int flagbyte_scan(struct shannon_dev *dev, struct shannon_bbt *bbt)
 		printf("\n");
 
 free_req_out:
-	list_for_each_entry_safe(req, tmp, &req_head, list) {
-		list_del(&req->list);
-		free_request(req);
-	}
+	free(reqs);
+	for (i = 0; i < nrow; i++)
+		free_req_set(&set[i]);
 	dev->flash->oob_size = dev->flash_bakup->oob_size;
 	dev->flash->entire_page_size = dev->flash_bakup->entire_page_size;
 	return rc;
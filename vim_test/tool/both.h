@@ -16,6 +16,14 @@
 #define	SHANNONC_IOC_DI	_IO(SHANNONC_IOC_MAGIC, 7)	/* direct IO: start/poll/stop erase, write or read */
 #define	SHANNONC_IOC_GB	_IO(SHANNONC_IOC_MAGIC, 8)	/* get bar len */
 #define	SHANNONC_IOC_GD	_IO(SHANNONC_IOC_MAGIC, 9)	/* get device domains info */
+#define	SHANNONC_IOC_RMV	_IO(SHANNONC_IOC_MAGIC, 10)	/* read mem vector: user_addr is shannon_iovec array, size is count */
+#define	SHANNONC_IOC_WMV	_IO(SHANNONC_IOC_MAGIC, 11)	/* write mem vector */
+#define	SHANNONC_IOC_GR	_IO(SHANNONC_IOC_MAGIC, 12)	/* get dma region for mmap, freed by SHANNONC_IOC_FM */
+
+/* mmap() offsets of /dev/shannon_cdev */
+#define	SHANNONC_MMAP_BAR0	0x00000000UL	/* BAR0 registers, bar_dwlen[0] dwords */
+#define	SHANNONC_MMAP_THREADMEM	0x20000000UL	/* + phythread * 4 * PAGE_SIZE: thread mem got by SHANNONC_IOC_GF */
+#define	SHANNONC_MMAP_DMAREGION	0x40000000UL	/* dma region got by SHANNONC_IOC_GR */
 
 #define	DIRECT_IO_START	0x10
 #define	DIRECT_IO_POLL	0x11
@@ -240,6 +248,12 @@ struct shannon_ioctl {
 	void *user_addr;
 };
 
+struct shannon_iovec {
+	void *kernel_addr;
+	void *user_addr;
+	int size;
+};
+
 struct direct_io {
 	int type;		/* DIRECT_IO_START, DIRECT_IO_POLL or DIRECT_IO_STOP */
 	int opcode;
@@ -553,8 +553,9 @@ static int prepare_skip_empty_block(struct shannon_dev *dev)
 {
 	int i, j, active;
 	int head, page, ppa, plane, blk, lun, valid_blks;
-	struct shannon_request *chunk_head_req, *req, *tmp;
+	struct shannon_request *chunk_head_req, *req;
 	struct list_head req_head;
+	struct req_set set;
 	unsigned long cur_blk_bitmap[MAX_LUN_NLONG];
 	unsigned long saved_blk_bitmap[MAX_LUN_NLONG];
 	int flag;
@@ -575,7 +576,7 @@ static int prepare_skip_empty_block(struct shannon_dev *dev)
 	head = INDEP_HEAD;
 	if (dev->config->nplane > 1)
 		head |= (1 << SH_READ_PLANE_SHIFT);
-	INIT_LIST_HEAD(&req_head);
+	init_req_set(&set, dev);
 
 	print("%s()...", __func__);
 
@@ -616,6 +617,33 @@ static int prepare_skip_empty_block(struct shannon_dev *dev)
 }
 #endif
 
+	/* read requests of one page of super block, bound to page 0 and last page of each block below */
+	for_dev_each_lun(dev, lun) {
+		chunk_head_req = req_set_add(&set, NULL, sh_preread_cmd, lun, 0, head, 0, 0, REQ_DMA_COPY);
+		if (NULL == chunk_head_req)
+			goto free_set_out;
+
+		for (plane = 1; plane < dev->config->nplane; plane++) {
+			if (NULL == req_set_add(&set, chunk_head_req, sh_preread_cmd, lun, plane * dev->flash->npage, head, 0, 0, REQ_DMA_COPY))
+				goto free_set_out;
+		}
+
+		for (plane = 0; plane < dev->config->nplane; plane++) {
+			int ns, bs = 0;
+			int remain_ns = dev->config->page_nsector;
+
+			while (remain_ns) {
+				ns = (remain_ns >= 8) ? 8 : remain_ns;
+
+				if (NULL == req_set_add(&set, NULL, sh_cacheread_cmd, lun, plane * dev->flash->npage, head, bs, ns, REQ_DMA_COPY))
+					goto free_set_out;
+
+				bs += ns;
+				remain_ns -= ns;
+			}
+		}
+	}
+
 	/* skip empty blocks */
 	for_dev_each_block(dev, blk) {
 		if (is_bad_superblock(dev, blk))
@@ -628,44 +656,14 @@ static int prepare_skip_empty_block(struct shannon_dev *dev)
 last_page:
 		memset(cur_blk_bitmap, 0x00, sizeof(cur_blk_bitmap));
 
-		for_dev_each_lun(dev, lun) {
-			if (test_bit(lun, dev->sb[blk].sb_luninfo.sb_bbt))	// will skip empty block when read last page
-				continue;
-
-			chunk_head_req = alloc_request(dev, sh_preread_cmd, lun, ppa + page, head, 0, 0);
-			if (NULL == chunk_head_req)
-				return ERR;
-			list_add_tail(&chunk_head_req->list, &req_head);
-
-			for (plane = 1; plane < dev->config->nplane; plane++) {
-				req = alloc_request(dev, sh_preread_cmd, lun, ppa + page + plane * dev->flash->npage, head, 0, 0);
-				if (NULL == req)
-					return ERR;
-				list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
-			}
-
-			for (plane = 0; plane < dev->config->nplane; plane++) {
-				int ns, bs = 0;
-				int remain_ns = dev->config->page_nsector;
-
-				while (remain_ns) {
-					ns = (remain_ns >= 8) ? 8 : remain_ns;
-
-					req = alloc_request(dev, sh_cacheread_cmd, lun, ppa + page + plane * dev->flash->npage, head, bs, ns);
-					if (NULL == req)
-						return ERR;
-					list_add_tail(&req->list, &req_head);
-
-					bs += ns;
-					remain_ns -= ns;
-				}
-			}
-		}
+		INIT_LIST_HEAD(&req_head);
+		bind_req_set(&set, ppa + page);
+		list_req_set(&set, &req_head, dev->sb[blk].sb_luninfo.sb_bbt);	// will skip empty block when read last page
 
 		list_for_each_entry(req, &req_head, list) {
 			if (dev->submit_request(req)) {
 				printf("submit_request failed\n");
-				return ERR;
+				goto free_set_out;
 			}
 		}
 
@@ -675,11 +673,11 @@ last_page:
 		for_dev_each_lun(dev, lun) {
 			if (poll_cmdqueue(dev, lun)) {
 				printf("poll_cmdqueue failed\n");
-				return ERR;
+				goto free_set_out;
 			}
 		}
 
-		list_for_each_entry_safe(req, tmp, &req_head, list) {
+		list_for_each_entry(req, &req_head, list) {
 			if (sh_cacheread_cmd == req->opcode) {
 				for (i = 0; i < req->nsector; i++) {
 					if (0xFB == req->ecc[i]) {	// empty block
@@ -695,12 +693,10 @@ last_page:
 						}
 					} else if (req->ecc[i] > 0xFB) {
 						printf("INVALID ecc value block=%d ecc=0x%02X\n", req->chunk_block, req->ecc[i]);
-						return ERR;
+						goto free_set_out;
 					}
 				}
 			}
-			list_del(&req->list);
-			free_request(req);
 		}
 
 		/* check FTL driver fatal */
@@ -717,7 +713,7 @@ last_page:
 
 			if (test_bit(lun, cur_blk_bitmap) != flag) {
 				printf("FTL bug: find unsealed page lun=%d blk=%d page=%d\n", lun, blk, page);
-				return ERR;
+				goto free_set_out;
 			}
 		}
 
@@ -739,6 +735,8 @@ last_page:
 }
 #endif
 
+	free_req_set(&set);
+
 	if (active > 2) {
 		printf("ERR: detect more than 2 active block %d\n", active);
 		return ERR;
@@ -761,6 +759,10 @@ last_page:
 	}
 
 	return 0;
+
+free_set_out:
+	free_req_set(&set);
+	return ERR;
 }
 
 #define	get_data_buf()	(data + page * superpage_size +					\
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * execution engine: one worker per hw thread owns the cmdqueue of that thread. Scan logic in main thread passes
+ * requests to workers by sq, workers submit, ring doorbell, reap and pass retired requests back by cq, so done
+ * callbacks still run in main thread and need no lock.
+ *
+ * Only one producer and one consumer touch a ring: head is written by consumer, tail by producer.
+ */
+static int engine_ring_push(struct engine_ring *ring, struct shannon_request *req)
+{
+	unsigned int tail = ring->tail;
+
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ENGINE_RING_SIZE)
+		return 0;
+
+	ring->slot[tail & (ENGINE_RING_SIZE - 1)] = req;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static struct shannon_request *engine_ring_pop(struct engine_ring *ring)
+{
+	unsigned int head = ring->head;
+	struct shannon_request *req;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	req = ring->slot[head & (ENGINE_RING_SIZE - 1)];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return req;
+}
+
+static void engine_idle(int *nidle, long *stats)
+{
+	struct timespec ts = {0, ENGINE_IDLE_NS};
+
+	if (++(*nidle) < ENGINE_IDLE_SPIN) {
+		cpu_relax();
+		return;
+	}
+
+	nanosleep(&ts, NULL);
+	(*stats)++;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* worker side */
+static void *engine_worker_main(void *arg)
+{
+	int rc, lun, nreap, nidle = 0;
+	long long deadline = 0;
+	struct engine_worker *w = arg;
+	struct shannon_dev *dev = w->dev;
+	struct shannon_request *req, *sub, *tmp;
+
+	while (!__atomic_load_n(&dev->engine->stop, __ATOMIC_ACQUIRE)) {
+		lun = -1;
+		nreap = 0;
+
+		while (NULL != (req = engine_ring_pop(&w->sq)))
+			list_add_tail(&req->lun_list, &w->backlog_listhead);
+
+		/* requests of this thread are submitted in order, the first one not fit stops the rest */
+		list_for_each_entry_safe(req, tmp, &w->backlog_listhead, lun_list) {
+			list_del(&req->lun_list);
+
+			rc = dev->submit_request(req);
+			if (rc == NO_CMDQUEUE_ROOM) {
+				list_add(&req->lun_list, &w->backlog_listhead);
+				break;
+			} else if (rc != 0)
+				submit_failed_exit(req->lun);
+
+			w->inflight++;
+			list_for_each_entry(sub, &req->chunk_list, chunk_list)
+				w->inflight++;
+			w->nsubmit++;
+			lun = req->lun;
+		}
+
+		if (lun >= 0)
+			update_cmdqueue(dev, lun);
+
+		if (w->inflight) {
+			nreap = reap_cmdqueue(dev, &dev->thread[w->tr]);
+			w->inflight -= nreap;
+			w->nreap += nreap;
+		}
+
+		/* same deadline as poll_wait(), moved on by every submission or completion */
+		if (lun >= 0 || nreap) {
+			nidle = 0;
+			deadline = now_ns() + POLL_NS_TIMEOUT;
+		} else {
+			if (w->inflight && now_ns() > deadline) {
+				printf("\nHW Firmware BUG: thread %d command completion is not to return!\n", w->tr);
+				exit(EXIT_FAILURE);
+			}
+			engine_idle(&nidle, &w->nsleep);
+		}
+	}
+
+	return NULL;
+}
+
+/* called by retire_request() in worker */
+void engine_retired(struct shannon_request *req)
+{
+	int nidle = 0;
+	struct engine_worker *w = req->worker;
+
+	while (!engine_ring_push(&w->cq, req))
+		engine_idle(&nidle, &w->nsleep);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* main thread side */
+static int init_engine(struct shannon_dev *dev)
+{
+	int tr;
+	struct shannon_engine *engine;
+	struct engine_worker *w;
+
+	engine = zmalloc(sizeof(*engine));
+	if (NULL == engine)
+		return ALLOCMEM_FAILED;
+
+	engine->nworker = dev->hw_threads;
+	engine->worker = zmalloc(engine->nworker * sizeof(*engine->worker));
+	if (NULL == engine->worker) {
+		free(engine);
+		return ALLOCMEM_FAILED;
+	}
+	dev->engine = engine;
+
+	for (tr = 0; tr < engine->nworker; tr++) {
+		w = &engine->worker[tr];
+		w->dev = dev;
+		w->tr = tr;
+		INIT_LIST_HEAD(&w->backlog_listhead);
+
+		if (pthread_create(&w->tid, NULL, engine_worker_main, w)) {
+			printf("%s() create worker %d failed\n", __func__, tr);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return 0;
+}
+
+void free_engine(struct shannon_dev *dev)
+{
+	int tr;
+	struct shannon_engine *engine = dev->engine;
+
+	if (NULL == engine)
+		return;
+
+	__atomic_store_n(&engine->stop, 1, __ATOMIC_RELEASE);
+	for (tr = 0; tr < engine->nworker; tr++)
+		pthread_join(engine->worker[tr].tid, NULL);
+
+	free(engine->worker);
+	free(engine);
+	dev->engine = NULL;
+}
+
+/* pop retired requests of all workers and run their done callbacks, return number of them */
+static int engine_drain(struct shannon_dev *dev)
+{
+	int tr, n = 0;
+	struct shannon_request *req;
+	struct shannon_engine *engine = dev->engine;
+
+	for (tr = 0; tr < engine->nworker; tr++) {
+		while (NULL != (req = engine_ring_pop(&engine->worker[tr].cq))) {
+			req->worker = NULL;
+			if (NULL != req->done)
+				req->done(req, req->done_ctx);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/* drain once, or idle if nothing is retired. Exit if nothing is retired for POLL_NS_TIMEOUT as poll_wait() does */
+static int engine_drain_wait(struct shannon_dev *dev, long long *deadline, int *nidle)
+{
+	int n = engine_drain(dev);
+
+	if (n) {
+		*nidle = 0;
+		*deadline = now_ns() + POLL_NS_TIMEOUT;
+		return n;
+	}
+
+	if (now_ns() > *deadline) {
+		printf("\nHW Firmware BUG: engine command completion is not to return!\n");
+		exit(EXIT_FAILURE);
+	}
+	engine_idle(nidle, &dev->engine->nsleep);
+	return 0;
+}
+
+/*
+ * same as submit_polling_loop() but every thread is driven by its own worker, return when all req are retired
+ */
+int engine_run(struct shannon_dev *dev, struct list_head *req_head)
+{
+	int outstanding, nidle;
+	long long deadline;
+	struct shannon_request *req, *sub;
+	struct engine_worker *w;
+
+	if (NULL == dev->engine && init_engine(dev))
+		return ALLOCMEM_FAILED;
+	dev->engine->nrun++;
+
+	outstanding = nidle = 0;
+	deadline = now_ns() + POLL_NS_TIMEOUT;
+	list_for_each_entry(req, req_head, list) {
+		w = &dev->engine->worker[dev->lun[req->lun].thread->phythread_idx];
+
+		req->worker = w;
+		outstanding++;
+		list_for_each_entry(sub, &req->chunk_list, chunk_list) {
+			sub->worker = w;
+			outstanding++;
+		}
+
+		while (!engine_ring_push(&w->sq, req))
+			outstanding -= engine_drain_wait(dev, &deadline, &nidle);
+	}
+
+	while (outstanding)
+		outstanding -= engine_drain_wait(dev, &deadline, &nidle);
+
+	return 0;
+}
+
+void pr_engine_stats(struct shannon_dev *dev)
+{
+	int tr;
+	struct engine_worker *w;
+	struct shannon_engine *engine = dev->engine;
+
+	if (NULL == engine) {
+		printf("engine: disabled\n");
+		return;
+	}
+
+	printf("engine: nworker=%d run=%ld fallback=%ld sleep=%ld\n", engine->nworker, engine->nrun, engine->nfallback, engine->nsleep);
+	for (tr = 0; tr < engine->nworker; tr++) {
+		w = &engine->worker[tr];
+		printf("worker-%d: submit=%ld reap=%ld sleep=%ld\n", tr, w->nsubmit, w->nreap, w->nsleep);
+	}
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
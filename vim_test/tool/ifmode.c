@@ -80,20 +80,8 @@ static __u8 *get_steprd(struct shannon_dev *dev, struct shannon_request *rdhead,
 	return (!type) ? (__u8 *)tmp->data + reqoff : (__u8 *)tmp->metadata + reqoff;
 }
 
-static int byte_diff_number(__u8 x, __u8 y)
-{
-	int i, cnt;
-	__u8 mask = 1;
-
-	for (cnt = 0, i = 0; i < 8; i++) {
-		if ( (x & (mask << i)) != (y & (mask << i)) )
-			cnt++;
-	}
-
-	return cnt;
-}
-
-static void compare_noecc_rdwr_requests(struct shannon_dev *dev, struct shannon_request *wrhead, struct shannon_request *rdhead, long **lun_ecc_statistics)
+/* slow path of compare, print every different 16 bytes of data and 8 bytes of metadata */
+static void dump_noecc_rdwr_requests(struct shannon_dev *dev, struct shannon_request *wrhead, struct shannon_request *rdhead)
 {
 	int i, off, step, nl;
 	__u8 *stepwr, *steprd;
@@ -126,12 +114,10 @@ static void compare_noecc_rdwr_requests(struct shannon_dev *dev, struct shannon_
 			printf(" |  ");
 
 			for (i = 0; i < step; i++) {
-				if (steprd[i] == stepwr[i]) {
+				if (steprd[i] == stepwr[i])
 					printf("%02X ", steprd[i]);
-				} else {
-					lun_ecc_statistics[wrhead->lun][0] += byte_diff_number(stepwr[i], steprd[i]);
+				else
 					printf("\033[0;1;31m%02X\033[0m ", steprd[i]);
-				}
 			}
 			printf("\n");
 		}
@@ -165,82 +151,86 @@ static void compare_noecc_rdwr_requests(struct shannon_dev *dev, struct shannon_
 			printf(" |  ");
 
 			for (i = 0; i < step; i++) {
-				if (steprd[i] == stepwr[i]) {
+				if (steprd[i] == stepwr[i])
 					printf("%02X ", steprd[i]);
-				} else {
-					lun_ecc_statistics[wrhead->lun][0] += byte_diff_number(stepwr[i], steprd[i]);
+				else
 					printf("\033[0;1;31m%02X\033[0m ", steprd[i]);
-				}
 			}
 			printf("\n");
 		}
 	}
 }
 
-static int memcmp_hlbyte(__u8 *buf1, __u8 *buf2, unsigned int count, int HLBYTE)
+/*
+ * length of piece at off of chunk which is contiguous in both write and read requests: data of a plane is contiguous in
+ * write request and a cacheread request reads 8 sectors, so a piece is cut at end of codeword, or of sector for metadata
+ */
+static int get_steplen(struct shannon_dev *dev, int off, int type)
 {
-	int i = 0;
-	int status = 0;
-	int startPos = 0;
-
-	if (HLBYTE != LBYTE && HLBYTE != HBYTE)
-		return memcmp(buf1, buf2, count);
+	int cw, secoff;
 
-	startPos = (LBYTE == HLBYTE ? 0 : 1);
-
-	for (i = startPos; i < count; i+=2) {
-		if (buf1[i] != buf2[i]) {
-				status = (buf1[i] < buf2[i] ? -1 : 1);
-				break;
-			}
-	}
+	if (type)
+		return METADATA_SIZE - (off % dev->config->nmeta) % METADATA_SIZE;
 
-	return status;
+	secoff = (off % dev->config->ndata) % dev->config->sector_size;
+	for (cw = 0; codeword_data_end(dev, cw) <= secoff; cw++)
+		;
+	return codeword_data_end(dev, cw) - secoff;
 }
 
-static void compare_noecc_rdwr_requests_hlpage(struct shannon_dev *dev, struct shannon_request *wrhead, struct shannon_request *rdhead, long **lun_ecc_statistics, int HLBYTE)
+/* flipped bits and bytes of every byte lane of 16bit bus, even bytes of chunk are LBYTE and odd bytes HBYTE */
+struct lane_errors {
+	long nbit[BYTE_TOTLE];
+	long nbyte[BYTE_TOTLE];
+};
+
+/*
+ * flipped bits of data or metadata of chunk counted by byte lane, return bits of lane hlbyte or of both lanes if it is
+ * BYTE_TOTLE. The most in one codeword or metadata QW is kept in *max_cw_nbit. Pieces begin at even offset so lanes
+ * of xor_popcount_lanes() are lanes of bus
+ */
+static long count_noecc_errbits(struct shannon_dev *dev, struct shannon_request *wrhead, struct shannon_request *rdhead, int type, int hlbyte,
+	struct lane_errors *le, int *max_cw_nbit)
 {
-	int i, off, step;
-	__u8 *stepwr, *steprd;
-	int startPos;
-
-	/* check data */
-	step = 16;
-	startPos = 0;
-
-	if (HBYTE != HLBYTE && LBYTE != HLBYTE) {
-		printf("\n%s() %d BUG!!!\n", __func__, __LINE__);
-		exit(EXIT_FAILURE);
+	int off, len, nbit;
+	int size = type ? dev->config->chunk_nmeta : dev->config->chunk_ndata;
+	long lane_nbit[BYTE_TOTLE], lane_nbyte[BYTE_TOTLE];
+	long total = 0;
+
+	for (off = 0; off < size; off += len) {
+		len = get_steplen(dev, off, type);
+		assert(0 == (off & 0x01));
+
+		memset(lane_nbit, 0x00, sizeof(lane_nbit));
+		memset(lane_nbyte, 0x00, sizeof(lane_nbyte));
+		xor_popcount_lanes(get_stepwr(dev, wrhead, off, type), get_steprd(dev, rdhead, off, type), len, lane_nbit, lane_nbyte);
+
+		le->nbit[LBYTE] += lane_nbit[LBYTE];
+		le->nbit[HBYTE] += lane_nbit[HBYTE];
+		le->nbyte[LBYTE] += lane_nbyte[LBYTE];
+		le->nbyte[HBYTE] += lane_nbyte[HBYTE];
+
+		nbit = (BYTE_TOTLE == hlbyte) ? lane_nbit[LBYTE] + lane_nbit[HBYTE] : lane_nbit[hlbyte];
+		if (nbit > *max_cw_nbit)
+			*max_cw_nbit = nbit;
+		total += nbit;
 	}
 
-	startPos = ((LBYTE == HLBYTE) ? 0 : 1);
-
-	for (off = 0; off < dev->config->chunk_ndata; off += step) {
-		stepwr = get_stepwr(dev, wrhead, off, 0);
-		steprd = get_steprd(dev, rdhead, off, 0);
+	return total;
+}
 
-		if (memcmp_hlbyte(stepwr, steprd, step, HLBYTE)) {
-			for (i = startPos; i < step; i += 2) {
-				if (steprd[i] != stepwr[i])
-					lun_ecc_statistics[wrhead->lun][0] += byte_diff_number(stepwr[i], steprd[i]);
-			}
-		}
-	}
+static void compare_noecc_rdwr_requests(struct shannon_dev *dev, struct shannon_request *wrhead, struct shannon_request *rdhead, long **lun_ecc_statistics,
+	struct lane_errors *lun_lane_errors, int *lun_max_cw_nbit, int hlbyte, int hexdump)
+{
+	int lun = wrhead->lun;
+	long nbit;
 
-	/* check metadata */
-	step =8;
+	nbit = count_noecc_errbits(dev, wrhead, rdhead, 0, hlbyte, &lun_lane_errors[lun], &lun_max_cw_nbit[lun]);
+	nbit += count_noecc_errbits(dev, wrhead, rdhead, 1, hlbyte, &lun_lane_errors[lun], &lun_max_cw_nbit[lun]);
+	lun_ecc_statistics[lun][0] += nbit;
 
-	for (off = 0; off < dev->config->chunk_nmeta; off += step) {
-		stepwr = get_stepwr(dev, wrhead, off, 1);
-		steprd = get_steprd(dev, rdhead, off, 1);
-
-		if (memcmp_hlbyte(stepwr, steprd, step, HLBYTE)) {
-			for (i = startPos; i < step; i += 2) {
-				if (steprd[i] != stepwr[i])
-					lun_ecc_statistics[wrhead->lun][0] += byte_diff_number(stepwr[i], steprd[i]);
-			}
-		}
-	}
+	if (nbit && hexdump)
+		dump_noecc_rdwr_requests(dev, wrhead, rdhead);
 }
 
 /*-----------------------------------------------------------------------------------------------------------*/
@@ -267,16 +257,29 @@ static void shannon_ifmode_usage(void)
 		"\t\tPrint format like old tool\n\n");
 	printf("\t-N, --noprogress\n"
 		"\t\tDisable show progress\n\n");
+	printf("\t-P, --pattern=base[:XX][,modifier]...\n"
+		"\t\tWrite test pattern instead of random data, default is --pattern of tool or random. base is one of\n"
+		"\t\t  random           generator of --prng\n"
+		"\t\t  solid:XX         every byte is XX(hex)\n"
+		"\t\t  inc              bus word k is k, 16bit word on 16bit bus, restarts every sector\n"
+		"\t\t  inc-byte         byte k of page data is k, byte k of page metadata is k\n"
+		"\t\t  walk1, walk0     one bit of bus word set/clear, walking per bus word and per page\n"
+		"\t\t  checker          bus words of 0x55 and 0xAA alternate and swap on next page\n"
+		"\t\t  prbs7, prbs15, prbs31\n"
+		"\t\tmodifier is one or more of\n"
+		"\t\t  inverse          odd page is inverse of the page before\n"
+		"\t\t  hl-same, hl-not  high byte is same as or inverse of low byte\n"
+		"\t\t  clock-not        bus word at odd clock is inverse of the one at even clock\n\n");
 	printf("\t-b, --write-fixed-byte=BYTE(hex)\n"
-		"\t\tWrite fixed value BYTE instead of random data\n\n");
+		"\t\tSame as --pattern=solid:BYTE\n\n");
 	printf("\t-i, --write-inc-byte\n"
-		"\t\tWrite increased BYTE instead of random data\n\n");
+		"\t\tSame as --pattern=inc-byte\n\n");
 	printf("\t-s, --highbyte-same-lowbyte\n"
-		"\t\tHigh byte and low byte are same\n\n");
+		"\t\tAdd modifier hl-same, high byte and low byte are same\n\n");
 	printf("\t-n, --highbyte-not-lowbyte\n"
-		"\t\tHigh byte and low byte are reverse\n\n");
+		"\t\tAdd modifier hl-not, high byte and low byte are reverse\n\n");
 	printf("\t-k, --evenclock-not-oddclock\n"
-		"\t\tData at evenclock and data at oddclock on the flash IO pins are reverse\n\n");
+		"\t\tAdd modifier clock-not, data at evenclock and data at oddclock on the flash IO pins are reverse\n\n");
 	printf("\t-l, --lun-total-ecc-limit=N\n"
 		"\t\tUsed for product, if lun total ecc larger than this value, print 'ShouldBeFenced' for this lun\n\n");
 	printf("\t-m, --lun-max-ecc-limit=N\n"
@@ -287,6 +290,8 @@ static void shannon_ifmode_usage(void)
 		"\t\tDisplay the status of all the packages on the subcard. It must be used with global option dev-type\n\n");
 	printf("\t-y, --high-low-byte=N\n"
 		"\t\tchoose low/high byte with ecc closed: 0->low byte, 1->high byte, 2->high-low byte\n\n");
+	printf("\t-x, --hexdump\n"
+		"\t\tPrint written and read bytes which are different with ecc closed, it is slow if interface is marginal\n\n");
 	printf("\t-h, --help\n"
 		"\t\tDisplay this help and exit\n\n");
 
@@ -336,6 +341,7 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 		{"present-luns", required_argument, NULL, 'T'},
 		{"print-old-format", no_argument, NULL, 'o'},
 		{"noprogress", no_argument, NULL, 'N'},
+		{"pattern", required_argument, NULL, 'P'},
 		{"write-fixed-byte", required_argument, NULL, 'b'},
 		{"write-inc-byte", no_argument, NULL, 'i'},
 		{"highbyte-same-lowbyte", no_argument, NULL, 's'},
@@ -346,6 +352,7 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 		{"logfile", required_argument, NULL, 'g'},
 		{"draw-lun-map", no_argument, NULL, 'd'},
 		{"high-low-byte", required_argument, NULL, 'y'},
+		{"hexdump", no_argument, NULL, 'x'},
 		{"help", no_argument, NULL, 'h'},
 		{0, 0, 0, 0},
 	};
@@ -358,11 +365,15 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 	struct shannon_request *chunk_head_req, *req, *tmp;
 	struct list_head req_head;
 	long **lun_ecc_statistics;
+	int *lun_max_cw_nbit = NULL;
+	struct lane_errors *lun_lane_errors = NULL;
+	int hexdump = 0;
 	int noprogress, pre_cent, now_cent;		// used for show progress
 	struct shannon_request *wrhead = NULL, *rdhead = NULL;
-	int boundary, fixed;
-	int hi_same_lo = 0, hi_not_lo = 0, even_not_odd = 0;
-	int inc = 0;
+	int boundary;
+	char pattern_base[64] = "", pattern_spec[128];
+	int hl_same = 0, hl_not = 0, clock_not = 0;
+	struct pattern *pt = NULL;
 	long lun_total_ecc_limit = 0x7FFFFFFFFFFFFFFFl;
 	FILE *logfp = NULL;
 	int lun_max_ecc_limit = 0xFB-1;
@@ -398,9 +409,8 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 	wrifmode = rdifmode = dev->config->ifmode;
 	pr_old_format = 0;
 	noprogress = 0;
-	fixed = -1;
 
-	while ((opt = getopt_long(argc, argv, ":e:w:r:t:T:oNb:isnkl:m:g:dy:h", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, ":e:w:r:t:T:oNP:b:isnkl:m:g:dy:xh", longopts, NULL)) != -1) {
 		switch (opt) {
 		case 'e':
 			seed = strtoul(optarg, NULL, 10);
@@ -437,20 +447,23 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 		case 'N':
 			noprogress = 1;
 			break;
+		case 'P':
+			snprintf(pattern_base, sizeof(pattern_base), "%s", optarg);
+			break;
 		case 'b':
-			fixed = strtoul(optarg, NULL, 16);
+			snprintf(pattern_base, sizeof(pattern_base), "solid:%s", optarg);
 			break;
 		case 'i':
-			inc = 1;
+			strcpy(pattern_base, "inc-byte");
 			break;
 		case 's':
-			hi_same_lo = 1;
+			hl_same = 1;
 			break;
 		case 'n':
-			hi_not_lo = 1;
+			hl_not = 1;
 			break;
 		case 'k':
-			even_not_odd = 1;
+			clock_not = 1;
 			break;
 		case 'l':
 			lun_total_ecc_limit = atoi(optarg);
@@ -482,6 +495,12 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 			break;
 		case 'y':
 			hlbyte = atoi(optarg);
+			/* as older tools, anything but low or high byte is both */
+			if (LBYTE != hlbyte && HBYTE != hlbyte)
+				hlbyte = BYTE_TOTLE;
+			break;
+		case 'x':
+			hexdump = 1;
 			break;
 		case 'h':
 			shannon_ifmode_usage();
@@ -502,9 +521,17 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 		return ERR;
 	}
 
-	if (hi_same_lo && hi_not_lo) {
-		printf("option --highbyte-same-lowbyte and --highbyte-not-lowbyte are mutex!\n");
-		exit(EXIT_FAILURE);
+	/* -b -i -s -n -k are shorthands of pattern */
+	if (pattern_base[0] || hl_same || hl_not || clock_not) {
+		snprintf(pattern_spec, sizeof(pattern_spec), "%s%s%s%s", pattern_base[0] ? pattern_base : "random",
+			hl_same ? ",hl-same" : "", hl_not ? ",hl-not" : "", clock_not ? ",clock-not" : "");
+		pt = parse_pattern(dev, pattern_spec);
+		if (NULL == pt) {
+			printf("Invalid pattern %s, note --highbyte-same-lowbyte and --highbyte-not-lowbyte are mutex\n", pattern_spec);
+			return ERR;
+		}
+	} else {
+		pt = dev->pattern;
 	}
 
 	begin_chunkblock = strtoul(argv[optind], NULL, 10);
@@ -527,6 +554,12 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 			goto free_lun_ecc_statistics;
 		}
 	}
+	lun_max_cw_nbit = zmalloc(dev->config->luns * sizeof(*lun_max_cw_nbit));
+	lun_lane_errors = zmalloc(dev->config->luns * sizeof(*lun_lane_errors));
+	if (NULL == lun_max_cw_nbit || NULL == lun_lane_errors) {
+		rc = ALLOCMEM_FAILED;
+		goto free_lun_ecc_statistics;
+	}
 
 	head = INDEP_HEAD;
 	if (dev->config->nplane > 1)
@@ -538,7 +571,6 @@ int shannon_ifmode(struct shannon_dev *dev, int argc, char **argv)
 	}
 
 	INIT_LIST_HEAD(&req_head);
-	srand(seed);
 
 	for (blk = begin_chunkblock; blk < begin_chunkblock + count; blk++) {
 		ppa = blk * dev->flash->npage * dev->config->nplane;
@@ -558,39 +590,7 @@ next_block_page:
 				goto free_req_out;
 			}
 
-			if (inc) {
-				for (i = 0; i < dev->config->ndata; i++)
-					chunk_head_req->data[i] = i;
-				for (i = 0; i < dev->config->nmeta; i++)
-					((__u8 *)chunk_head_req->metadata)[i] = i;
-			} else if (-1 != fixed) {
-				memset(chunk_head_req->data, fixed, dev->config->ndata);
-				memset(chunk_head_req->metadata, fixed, dev->config->nmeta);
-			} else {
-				pad_rand(chunk_head_req->data, dev->config->ndata);
-				pad_rand(chunk_head_req->metadata, dev->config->nmeta);
-			}
-
-			if (hi_same_lo || hi_not_lo) {
-				for (i = 1; i < dev->config->ndata; i+=2)
-					chunk_head_req->data[i] = hi_same_lo ? chunk_head_req->data[i-1] : ~chunk_head_req->data[i-1];
-				for (i = 1; i < dev->config->nmeta; i+=2)
-					((__u8 *)chunk_head_req->metadata)[i] = hi_same_lo ? ((__u8 *)chunk_head_req->metadata)[i-1] : ~((__u8 *)chunk_head_req->metadata)[i-1];
-			}
-
-			if (even_not_odd) {
-				if (2 == dev->iowidth) {
-					for (i = 1; i < dev->config->ndata/2; i+=2)
-						((__u16 *)chunk_head_req->data)[i] = ~((__u16 *)chunk_head_req->data)[i-1];
-					for (i = 1; i < dev->config->nmeta/2; i+=2)
-						((__u16 *)chunk_head_req->metadata)[i] = ~((__u16 *)chunk_head_req->metadata)[i-1];
-				} else {
-					for (i = 1; i < dev->config->ndata; i+=2)
-						((__u8 *)chunk_head_req->data)[i] = ~((__u8 *)chunk_head_req->data)[i-1];
-					for (i = 1; i < dev->config->nmeta; i+=2)
-						((__u8 *)chunk_head_req->metadata)[i] = ~((__u8 *)chunk_head_req->metadata)[i-1];
-				}
-			}
+			prng_fill_request(dev, pt, seed, chunk_head_req);
 			list_add_tail(&chunk_head_req->list, &req_head);
 
 			for (plane = 1; plane < dev->config->nplane; plane++) {
@@ -601,39 +601,7 @@ next_block_page:
 					goto free_req_out;
 				}
 
-				if (inc) {
-					for (i = 0; i < dev->config->ndata; i++)
-						req->data[i] = i;
-					for (i = 0; i < dev->config->nmeta; i++)
-						((__u8 *)req->metadata)[i] = i;
-				} else if (-1 != fixed) {
-					memset(req->data, fixed, dev->config->ndata);
-					memset(req->metadata, fixed, dev->config->nmeta);
-				} else {
-					pad_rand(req->data, dev->config->ndata);
-					pad_rand(req->metadata, dev->config->nmeta);
-				}
-
-				if (hi_same_lo || hi_not_lo) {
-					for (i = 1; i < dev->config->ndata; i+=2)
-						req->data[i] = hi_same_lo ? req->data[i-1] : ~req->data[i-1];
-					for (i = 1; i < dev->config->nmeta; i+=2)
-						((__u8 *)req->metadata)[i] = hi_same_lo ? ((__u8 *)req->metadata)[i-1] : ~((__u8 *)req->metadata)[i-1];
-				}
-
-				if (even_not_odd) {
-					if (2 == dev->iowidth) {
-						for (i = 1; i < dev->config->ndata/2; i+=2)
-							((__u16 *)req->data)[i] = ~((__u16 *)req->data)[i-1];
-						for (i = 1; i < dev->config->nmeta/2; i+=2)
-							((__u16 *)req->metadata)[i] = ~((__u16 *)req->metadata)[i-1];
-					} else {
-						for (i = 1; i < dev->config->ndata; i+=2)
-							((__u8 *)req->data)[i] = ~((__u8 *)req->data)[i-1];
-						for (i = 1; i < dev->config->nmeta; i+=2)
-							((__u8 *)req->metadata)[i] = ~((__u8 *)req->metadata)[i-1];
-					}
-				}
+				prng_fill_request(dev, pt, seed, req);
 				list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
 			}
 
@@ -695,11 +663,8 @@ next_block_page:
 				if (boundary) {
 					boundary = 0;
 					rdhead = req;	// this is 1st request cacheread for one chunk
-					if (HBYTE == hlbyte || LBYTE == hlbyte) {
-						compare_noecc_rdwr_requests_hlpage(dev, wrhead, rdhead, lun_ecc_statistics, hlbyte);
-					} else {
-						compare_noecc_rdwr_requests(dev, wrhead, rdhead, lun_ecc_statistics);
-					}
+					compare_noecc_rdwr_requests(dev, wrhead, rdhead, lun_ecc_statistics, lun_lane_errors, lun_max_cw_nbit,
+						hlbyte, hexdump);
 				}
 			}
 		} else {
@@ -743,8 +708,12 @@ next_block_page:
 			if (0 == lun_ecc_statistics[lun][0])
 				continue;
 
-			printf("#lun-%03d phylun-%03d *hwchannel-%02d hwthread-%02d hwlun-%02d ERR BITS=%ld\n", lun, log2phy_lun(dev, lun),
-				get_phychannel(dev, lun), get_phythread(dev, lun), get_phylun(dev, lun), lun_ecc_statistics[lun][0]);
+			printf("#lun-%03d phylun-%03d *hwchannel-%02d hwthread-%02d hwlun-%02d ERR BITS=%ld MAX CODEWORD BITS=%d", lun, log2phy_lun(dev, lun),
+				get_phychannel(dev, lun), get_phythread(dev, lun), get_phylun(dev, lun), lun_ecc_statistics[lun][0], lun_max_cw_nbit[lun]);
+			if (2 == dev->iowidth)
+				printf(" LBYTE BITS=%ld(%ld bytes) HBYTE BITS=%ld(%ld bytes)", lun_lane_errors[lun].nbit[LBYTE],
+					lun_lane_errors[lun].nbyte[LBYTE], lun_lane_errors[lun].nbit[HBYTE], lun_lane_errors[lun].nbyte[HBYTE]);
+			printf("\n");
 			errbits += lun_ecc_statistics[lun][0];
 		}
 		printf("ERR BITS SUM: %ld\n", errbits);
@@ -815,6 +784,7 @@ next_block_page:
 		int pkg_lb_index = 0;
 		int pkg_hb_index = 0;
 		int pkg_index = 0;
+		int bad_lane = 0;
 
 		long lun_total = 0;
 		long total_bits = 0;
@@ -850,6 +820,16 @@ next_block_page:
 						logout("\nlun-%03d phylun-%03d partRef-%s\n", lun, log2phy_lun(dev, lun),
 							pkg_partRef_map[pkg_index]);
 
+					} else if (2 == dev->iowidth && (lun_lane_errors[lun].nbit[LBYTE] > lun_total_ecc_limit) !=
+						(lun_lane_errors[lun].nbit[HBYTE] > lun_total_ecc_limit)) {
+						/* only one byte lane is over limit, the package on the other lane is good */
+						bad_lane = (lun_lane_errors[lun].nbit[LBYTE] > lun_total_ecc_limit) ? LBYTE : HBYTE;
+						phy_lun_map_color[bad_lane][phylun] = RED;
+						phy_lun_map_color[!bad_lane][phylun] = GREEN;
+
+						pkg_index = get_pkg_index(phylun, dev_pkg_phylun_num, bad_lane);
+						logout("\nlun-%03d phylun-%03d partRef-%s\n", lun, log2phy_lun(dev, lun),
+							pkg_partRef_map[pkg_index]);
 					} else {
 						phy_lun_map_color[LBYTE][phylun] = RED;
 						phy_lun_map_color[HBYTE][phylun] = RED;
@@ -930,6 +910,8 @@ free_req_out:
 		free_request(req);
 	}
 free_lun_ecc_statistics:
+	free(lun_lane_errors);
+	free(lun_max_cw_nbit);
 	for_dev_each_lun(dev, lun) {
 		if (NULL == lun_ecc_statistics[lun])
 			break;
@@ -943,6 +925,8 @@ out:
 		fprintf(logfp, "[IFMODE LOG END %s] <-- %s", dev->name, ctime(&tt));
 		fclose(logfp);
 	}
+	if (pt != dev->pattern)
+		free(pt);
 
 	if (rc != FAILED_FLASH_STATUS && rc != 0)
 		printf("Ifmode encounter some error\n");
@@ -5,8 +5,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "tool.h"
 
@@ -124,10 +126,8 @@ static __u32 ioread_lunreg(struct shannon_dev *dev, int lun, enum HW_lunreg dwof
 
 	assert(0 != dev->fd);
 
-	if (lseek(dev->fd, (dev->lunreg_dwoff + (phylun / dev->hw_nlun) * dev->lunreg_dwsize + dwoff) * DW_SIZE, SEEK_SET) < 0)
-		perror_exit("%s() lseek failed", __func__);
-
-	if (read(dev->fd, &reg, DW_SIZE) != DW_SIZE)
+	/* pread keeps no shared file offset, engine workers access their own threads at the same time */
+	if (pread(dev->fd, &reg, DW_SIZE, (dev->lunreg_dwoff + (phylun / dev->hw_nlun) * dev->lunreg_dwsize + dwoff) * DW_SIZE) != DW_SIZE)
 		perror_exit("%s() read failed", __func__);
 
 	return le32_to_cpu(reg);
@@ -140,11 +140,8 @@ static void iowrite_lunreg(struct shannon_dev *dev, __u32 value, int lun, enum H
 
 	assert(0 != dev->fd);
 
-	if (lseek(dev->fd, (dev->lunreg_dwoff + (phylun / dev->hw_nlun) * dev->lunreg_dwsize + dwoff) * DW_SIZE, SEEK_SET) < 0)
-		perror_exit("%s() lseek failed", __func__);
-
-	if (write(dev->fd, &v, DW_SIZE) != DW_SIZE)
-		perror_exit("%s() read failed", __func__);
+	if (pwrite(dev->fd, &v, DW_SIZE, (dev->lunreg_dwoff + (phylun / dev->hw_nlun) * dev->lunreg_dwsize + dwoff) * DW_SIZE) != DW_SIZE)
+		perror_exit("%s() write failed", __func__);
 }
 
 static __u32 ioread_buflunreg(struct shannon_dev *dev, int head, enum HW_lunreg dwoff)
@@ -274,6 +271,49 @@ static void write_mem(struct shannon_dev *dev, void *kernel_addr, void *user_add
 		perror_exit("%s() failed", __func__);
 }
 
+/* one ioctl for the whole vector, per-element ioctl if driver is too old to support it */
+static void read_mem_v(struct shannon_dev *dev, struct shannon_iovec *iov, int niov)
+{
+	int i;
+	struct shannon_ioctl ioctl_data;
+
+	assert(0 != dev->fd);
+
+	if (niov > 1 && !dev->no_mem_v) {
+		ioctl_data.size = niov;
+		ioctl_data.user_addr = iov;
+		if (!ioctl(dev->fd, SHANNONC_IOC_RMV, &ioctl_data))
+			return;
+		if (ENOTTY != errno && EINVAL != errno)
+			perror_exit("%s() failed", __func__);
+		dev->no_mem_v = 1;
+	}
+
+	for (i = 0; i < niov; i++)
+		dev->read_mem(dev, iov[i].user_addr, iov[i].kernel_addr, iov[i].size);
+}
+
+static void write_mem_v(struct shannon_dev *dev, struct shannon_iovec *iov, int niov)
+{
+	int i;
+	struct shannon_ioctl ioctl_data;
+
+	assert(0 != dev->fd);
+
+	if (niov > 1 && !dev->no_mem_v) {
+		ioctl_data.size = niov;
+		ioctl_data.user_addr = iov;
+		if (!ioctl(dev->fd, SHANNONC_IOC_WMV, &ioctl_data))
+			return;
+		if (ENOTTY != errno && EINVAL != errno)
+			perror_exit("%s() failed", __func__);
+		dev->no_mem_v = 1;
+	}
+
+	for (i = 0; i < niov; i++)
+		dev->write_mem(dev, iov[i].kernel_addr, iov[i].user_addr, iov[i].size);
+}
+
 static void deliver_userdata(struct shannon_dev *dev)
 {
 	struct shannon_ioctl ioctl_data;
@@ -316,6 +356,136 @@ static void get_dev_domains(struct shannon_dev *dev)
 	if (ioctl(dev->fd, SHANNONC_IOC_GD, &ioctl_data))
 		perror_exit("%s() failed", __func__);
 }
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* mmio functions: BAR0 is mmaped, registers are accessed by load/store without syscall */
+static inline volatile __u32 *mmio_reg(struct shannon_dev *dev, int dwoff)
+{
+	assert(NULL != dev->bar && dwoff >= 0 && dwoff < dev->bar_dwlen[0]);
+	return dev->bar + dwoff;
+}
+
+static inline int lunreg_dwoff(struct shannon_dev *dev, int lun, enum HW_lunreg dwoff)
+{
+	return dev->lunreg_dwoff + (log2phy_lun(dev, lun) / dev->hw_nlun) * dev->lunreg_dwsize + dwoff;
+}
+
+static inline int buflunreg_dwoff(struct shannon_dev *dev, int head, enum HW_lunreg dwoff)
+{
+	assert(head < 2);
+	return dev->lunreg_dwoff + dev->hw_threads * dev->lunreg_dwsize + head * dev->lunreg_dwsize + dwoff;
+}
+
+static __u32 mmio_raw_readl(struct shannon_dev *dev, int dwoff)
+{
+	return *mmio_reg(dev, dwoff);
+}
+
+static __u32 mmio_ioread32(struct shannon_dev *dev, int dwoff)
+{
+	return le32_to_cpu(*mmio_reg(dev, dwoff));
+}
+
+static void mmio_raw_writel(struct shannon_dev *dev, __u32 value, int dwoff)
+{
+	*mmio_reg(dev, dwoff) = value;
+}
+
+static void mmio_iowrite32(struct shannon_dev *dev, __u32 value, int dwoff)
+{
+	*mmio_reg(dev, dwoff) = cpu_to_le32(value);
+}
+
+static void mmio_multi_raw_readl(struct shannon_dev *dev, __u32 *des, int dwoff, int dwlen)
+{
+	int i;
+
+	for (i = 0; i < dwlen; i++)
+		des[i] = *mmio_reg(dev, dwoff + i);
+}
+
+static void mmio_multi_ioread32(struct shannon_dev *dev, __u32 *des, int dwoff, int dwlen)
+{
+	int i;
+
+	for (i = 0; i < dwlen; i++)
+		des[i] = le32_to_cpu(*mmio_reg(dev, dwoff + i));
+}
+
+static void mmio_multi_raw_writel(struct shannon_dev *dev, __u32 *src, int dwoff, int dwlen)
+{
+	int i;
+
+	for (i = 0; i < dwlen; i++)
+		*mmio_reg(dev, dwoff + i) = src[i];
+}
+
+static void mmio_multi_iowrite32(struct shannon_dev *dev, __u32 *src, int dwoff, int dwlen)
+{
+	int i;
+
+	for (i = 0; i < dwlen; i++)
+		*mmio_reg(dev, dwoff + i) = cpu_to_le32(src[i]);
+}
+
+/*
+ * HW_cmpq_head is read before completions and zero-copy read data in dma memory, so loads after a register read
+ * must not see older contents of cmpqueue or data buffers
+ */
+static __u32 mmio_ioread_lunreg(struct shannon_dev *dev, int lun, enum HW_lunreg dwoff)
+{
+	__u32 value = le32_to_cpu(*mmio_reg(dev, lunreg_dwoff(dev, lun, dwoff)));
+
+	rmb();
+	return value;
+}
+
+static void mmio_iowrite_lunreg(struct shannon_dev *dev, __u32 value, int lun, enum HW_lunreg dwoff)
+{
+	wmb();	/* cmdqueue must be visible to HW before doorbell */
+	*mmio_reg(dev, lunreg_dwoff(dev, lun, dwoff)) = cpu_to_le32(value);
+}
+
+static __u32 mmio_ioread_buflunreg(struct shannon_dev *dev, int head, enum HW_lunreg dwoff)
+{
+	__u32 value = le32_to_cpu(*mmio_reg(dev, buflunreg_dwoff(dev, head, dwoff)));
+
+	rmb();
+	return value;
+}
+
+static void mmio_iowrite_buflunreg(struct shannon_dev *dev, __u32 value, int head, enum HW_lunreg dwoff)
+{
+	wmb();
+	*mmio_reg(dev, buflunreg_dwoff(dev, head, dwoff)) = cpu_to_le32(value);
+}
+
+static void mmio_ioread_config(struct shannon_dev *dev)
+{
+	assert(NULL != dev->hw_config);
+
+	mmio_multi_raw_readl(dev, (__u32 *)dev->hw_config, dev->cfgreg_dwoff, sizeof(*dev->hw_config) / DW_SIZE);
+
+	le16_to_cpus(&dev->hw_config->hw_full_sector_nbyte);
+	le16_to_cpus(&dev->hw_config->hw_full_page_nbyte);
+	le16_to_cpus(&dev->hw_config->hw_codeword_nbyte);
+	le32_to_cpus(&dev->hw_config->hw_dw6_srv);
+}
+
+static void mmio_iowrite_config(struct shannon_dev *dev)
+{
+	struct hw_config hwcfg;
+
+	assert(NULL != dev->hw_config);
+
+	memcpy(&hwcfg, dev->hw_config, sizeof(hwcfg));
+	cpu_to_le16s(&hwcfg.hw_full_sector_nbyte);
+	cpu_to_le16s(&hwcfg.hw_full_page_nbyte);
+	cpu_to_le16s(&hwcfg.hw_codeword_nbyte);
+	cpu_to_le32s(&hwcfg.hw_dw6_srv);
+
+	mmio_multi_raw_writel(dev, (__u32 *)&hwcfg, dev->cfgreg_dwoff, sizeof(hwcfg) / DW_SIZE);
+}
+
 /*----------------------------------------------------------------------------------------------------------------------------------*/
 /* misc functions */
 static void clear_queue(struct shannon_dev *dev)
@@ -405,6 +575,56 @@ static void restore_default_config(struct shannon_dev *dev)
 	dev->ioread_config(dev);
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+static void munmap_thread_rings(struct shannon_dev *dev)
+{
+	int phytr;
+
+	for (phytr = 0; phytr < dev->hw_threads; phytr++) {
+		if (NULL != dev->thread[phytr].cmdq)
+			munmap(dev->thread[phytr].cmdq, dev->ring_maplen);
+		dev->thread[phytr].cmdq = dev->thread[phytr].cmpq = NULL;
+	}
+
+	if (dev->bufhead) {
+		dev->bufhead[HEAD0].cmdq = dev->bufhead[HEAD0].cmpq = NULL;
+		dev->bufhead[HEAD1].cmdq = dev->bufhead[HEAD1].cmpq = NULL;
+	}
+	dev->ring_maplen = 0;
+}
+
+/*
+ * mmap thread mem so that commands are built and completions are parsed by memcpy instead of write_mem/read_mem
+ */
+static void mmap_thread_rings(struct shannon_dev *dev)
+{
+	int phytr, head;
+	void *addr;
+
+	dev->ring_maplen = (dev->hw_sysinfo->hw_wrbuf_support & 0x0F) ? 4 * PAGE_SIZE : 2 * PAGE_SIZE;
+
+	for (phytr = 0; phytr < dev->hw_threads; phytr++) {
+		addr = mmap(NULL, dev->ring_maplen, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
+				SHANNONC_MMAP_THREADMEM + phytr * 4 * PAGE_SIZE);
+		if (MAP_FAILED == addr) {
+			print("%s() mmap thread-%d mem failed, use write_mem/read_mem to access cmdqueue", __func__, phytr);
+			perror(" ");
+			munmap_thread_rings(dev);
+			return;
+		}
+
+		dev->thread[phytr].cmdq = addr;
+		dev->thread[phytr].cmpq = addr + PAGE_SIZE;
+	}
+
+	if (dev->bufhead) {
+		for (head = 0; head < 2; head++) {
+			dev->bufhead[head].cmdq = dev->thread[head].cmdq + 2 * PAGE_SIZE;
+			dev->bufhead[head].cmpq = dev->thread[head].cmdq + 3 * PAGE_SIZE;
+		}
+	}
+}
+
 /*----------------------------------------------------------------------------------------------------------------------------------*/
 static int mixed_flash_check(struct shannon_dev *dev, int lun, struct usr_flash *flash)
 {
@@ -527,6 +747,8 @@ struct shannon_dev *alloc_device(char *devname)
 		goto out;
 	dev->newlunmap = 1;
 	INIT_LIST_HEAD(&dev->mem_glisthead);
+	dev->dma_pool_depth = DMA_POOL_DEPTH;
+	init_poll_policy(dev, -1);
 
 	dev->sysreg_dwoff = 0;
 	dev->cfgreg_dwoff = 0xc0;
@@ -559,6 +781,8 @@ struct shannon_dev *alloc_device(char *devname)
 	dev->free_mem		= free_mem;
 	dev->read_mem		= read_mem;
 	dev->write_mem		= write_mem;
+	dev->read_mem_v		= read_mem_v;
+	dev->write_mem_v	= write_mem_v;
 
 	dev->deliver_userdata	= deliver_userdata;
 	dev->do_direct_io	= do_direct_io;
@@ -569,32 +793,34 @@ struct shannon_dev *alloc_device(char *devname)
 	dev->config_hardware	= config_hardware;
 	dev->submit_request	= submit_request;
 
-	/* open device handle */
-	strcpy(dev->name, devname);	// printf("device=%s\n", devname);
-	dev->fd = open(dev->name, O_RDWR, 0666);
-	if (dev->fd < 0) {
-		print("Open device %s error", dev->name);
-		perror(" ");
-		goto free_dev_out;
-	}
+	/* open device handle, or emulate one for sim:<geometry> */
+	snprintf(dev->name, sizeof(dev->name), "%s", devname);	// printf("device=%s\n", devname);
+	if (!strncmp(devname, "sim:", 4)) {
+		if (alloc_sim(dev, devname + 4))
+			goto free_dev_out;
+	} else {
+		dev->fd = open(dev->name, O_RDWR, 0666);
+		if (dev->fd < 0) {
+			print("Open device %s error", dev->name);
+			perror(" ");
+			goto free_dev_out;
+		}
 
-	/* get bar length */
-	for (bar = 0; bar < 2; bar++) {
-		ioctl_data.bar = bar;
-		if (ioctl(dev->fd, SHANNONC_IOC_GB, &ioctl_data))
-			perror_exit("%s() failed", __func__);
-		dev->bar_dwlen[bar] = ioctl_data.size / DW_SIZE;
-		// printf("BAR%d length: %d dw\n", bar, dev->bar_dwlen[bar]);
+		/* get bar length */
+		for (bar = 0; bar < 2; bar++) {
+			ioctl_data.bar = bar;
+			if (ioctl(dev->fd, SHANNONC_IOC_GB, &ioctl_data))
+				perror_exit("%s() failed", __func__);
+			dev->bar_dwlen[bar] = ioctl_data.size / DW_SIZE;
+			// printf("BAR%d length: %d dw\n", bar, dev->bar_dwlen[bar]);
+		}
 	}
 
 	/* alloc and read hw_sysinfo registers */
 	dev->hw_sysinfo = malloc(sizeof(*dev->hw_sysinfo));
 	if (NULL == dev->hw_sysinfo)
 		goto close_fd_out;
-	if (lseek(dev->fd, dev->sysreg_dwoff * DW_SIZE, SEEK_SET) < 0)
-		perror_exit("%s() read-hw_sysinfo lseek failed", __func__);
-	if (read(dev->fd, dev->hw_sysinfo, sizeof(*dev->hw_sysinfo)) != sizeof(*dev->hw_sysinfo))
-		perror_exit("%s() read-hw_sysinfo read failed", __func__);
+	dev->multi_raw_readl(dev, (__u32 *)dev->hw_sysinfo, dev->sysreg_dwoff, sizeof(*dev->hw_sysinfo) / DW_SIZE);
 	le32_to_cpus(&dev->hw_sysinfo->firmware_tag);
 	le32_to_cpus(&dev->hw_sysinfo->dw_rsv[0]);
 	le32_to_cpus(&dev->hw_sysinfo->dw_rsv[1]);
@@ -634,10 +860,14 @@ struct shannon_dev *alloc_device(char *devname)
 	dev->phythread_mem = malloc(sizeof(*dev->phythread_mem) * dev->hw_threads);
 	if (NULL == dev->phythread_mem)
 		goto free_sys_out;
-	ioctl_data.size = sizeof(*dev->phythread_mem) * dev->hw_threads;
-	ioctl_data.user_addr = dev->phythread_mem;
-	if (ioctl(dev->fd, SHANNONC_IOC_GF, &ioctl_data))
-		perror_exit("%s() failed", __func__);
+	if (NULL != dev->sim) {
+		get_sim_thread_mem(dev);
+	} else {
+		ioctl_data.size = sizeof(*dev->phythread_mem) * dev->hw_threads;
+		ioctl_data.user_addr = dev->phythread_mem;
+		if (ioctl(dev->fd, SHANNONC_IOC_GF, &ioctl_data))
+			perror_exit("%s() failed", __func__);
+	}
 
 	/* alloc hw_config registers */
 	dev->hw_config = malloc(sizeof(*dev->hw_config));
@@ -655,6 +885,7 @@ struct shannon_dev *alloc_device(char *devname)
 	dev->config = zmalloc(sizeof(*dev->config));
 	if (NULL == dev->config)
 		goto free_flash_out;
+	init_req_slab(dev);		/* objects without buffer until config is parsed */
 
 	/* alloc bakup for flash and flash */
 	dev->flash_bakup = zmalloc(sizeof(*dev->flash_bakup));
@@ -674,10 +905,15 @@ struct shannon_dev *alloc_device(char *devname)
 	if (NULL == dev->inherent_mbr)
 		goto free_mbr_out;
 
-	get_dev_domains(dev);
+	/* sim device has no driver domains and no nor flash */
+	if (NULL != dev->sim)
+		strcpy(dev->domains, "0000:sim");	/* users print the part behind first colon */
+	else
+		get_dev_domains(dev);
 
 	/* get serial number */
-	shannon_read_nor(dev, &dev->norinfo, NORFLASH_INFO_ADDR, sizeof(dev->norinfo));
+	if (NULL == dev->sim)
+		shannon_read_nor(dev, &dev->norinfo, NORFLASH_INFO_ADDR, sizeof(dev->norinfo));
 	if (dev->norinfo.magic_number != NORFLASH_INFO_MAGIC) {
 		sprintf(dev->norinfo.service_tag, "missing");
 		sprintf(dev->norinfo.model_id, "missing");
@@ -703,7 +939,10 @@ free_threadmem_out:
 free_sys_out:
 	free(dev->hw_sysinfo);
 close_fd_out:
-	close(dev->fd);
+	if (NULL != dev->sim)
+		free_sim(dev);
+	else
+		close(dev->fd);
 free_dev_out:
 	free(dev);
 out:
@@ -793,7 +1032,9 @@ int init_device(struct shannon_dev *dev)
 		thread->phythread_idx	= phytr;
 		thread->cmdhead		= 0;
 		thread->cmdempty	= PAGE_SIZE - 8;
+		thread->cmptail		= 0;
 		thread->req_count	= 0;
+		INIT_LIST_HEAD(&thread->req_listhead);
 
 		thread->cmdmem.kernel_addr	= dev->phythread_mem[phytr].kernel_addr;
 		thread->cmdmem.dma_addr		= dev->phythread_mem[phytr].dma_addr;
@@ -816,7 +1057,6 @@ int init_device(struct shannon_dev *dev)
 		dev->lun[lun].channel	= get_phychannel(dev, dev->lun[lun].loglun);
 		dev->lun[lun].phylun	= log2phy_lun(dev, dev->lun[lun].loglun);
 		dev->lun[lun].thread	= &dev->thread[dev->lun[lun].phylun / dev->hw_nlun];
-		dev->lun[lun].head	= dev->lun[lun].tail = -1;
 
 		dev->iowrite_lunreg(dev, U64_LOW_32(dev->lun[lun].thread->cmdmem.dma_addr), lun, HW_cmdq_pte_lo);
 		dev->iowrite_lunreg(dev, U64_HIGH_32(dev->lun[lun].thread->cmdmem.dma_addr), lun, HW_cmdq_pte_hi);
@@ -846,6 +1086,9 @@ int init_device(struct shannon_dev *dev)
 		}
 	}
 
+	if (dev->map_rings)
+		mmap_thread_rings(dev);
+
 	check_target_lun(dev);
 	memcpy(dev->config_bakup, dev->config, sizeof(*dev->config_bakup));
 
@@ -853,6 +1096,10 @@ int init_device(struct shannon_dev *dev)
 	dev->dummy_mem.size = 4096;
 	dev->get_mem(dev, &dev->dummy_mem);
 
+	if (init_dma_pool(dev) || init_dma_region(dev))
+		return ALLOCMEM_FAILED;
+	init_req_slab(dev);
+
 	/*config hardware*/
 	dev->ifmode = dev->config->ifmode = IFMODE_ASYNC;
 	dev->config_hardware(dev);
@@ -926,6 +1173,10 @@ int re_init_device(struct shannon_dev *dev)
 	for (i = 0; i < dev->config->chunk_nsector; i++)
 		memset(dev->padding_buffer + i * dev->config->sector_size, i, dev->config->sector_size);
 
+	if (init_dma_pool(dev) || init_dma_region(dev))
+		return ALLOCMEM_FAILED;
+	init_req_slab(dev);
+
 	dev->config_hardware(dev);
 	return 0;
 }
@@ -933,14 +1184,24 @@ int re_init_device(struct shannon_dev *dev)
 void free_device(struct shannon_dev *dev)
 {
 	/* alloc not in alloc_device*/
+	free_engine(dev);
+	free_sched(dev);
+	free_latency(dev);
+	free_trace(dev);
+	if (dev->pattern) free(dev->pattern);
+	if (dev->ring_maplen) munmap_thread_rings(dev);
 	if (dev->bufhead) free(dev->bufhead);
 	if (dev->lun) free(dev->lun);
 	if (dev->sb) free(dev->sb);
 	if (dev->thread) free(dev->thread);
 	if (dev->padding_buffer) free(dev->padding_buffer);
 	if (dev->targetlun) free(dev->targetlun);
-	if (dev->dummy_mem.size) free_mem(dev, &dev->dummy_mem);
+	if (dev->dummy_mem.size) dev->free_mem(dev, &dev->dummy_mem);
+	free_dma_pool(dev);
+	free_dma_region(dev);
+	free_req_slab(dev);
 	if (dev->exitlog) fclose(dev->exitlog);
+	if (dev->bar) munmap((void *)dev->bar, dev->bar_dwlen[0] * DW_SIZE);
 
 	/* alloc in alloc_device */
 	free(dev->inherent_mbr);
@@ -952,7 +1213,51 @@ void free_device(struct shannon_dev *dev)
 	free(dev->hw_config);
 	free(dev->phythread_mem);
 	free(dev->hw_sysinfo);
-	close(dev->fd);
+	if (NULL != dev->sim)
+		free_sim(dev);
+	else
+		close(dev->fd);
 	free(dev);
 }
 /*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * map BAR0 and switch register access to mmio functions, syscall functions are kept if mmap failed
+ */
+int mmap_device_bar(struct shannon_dev *dev)
+{
+	void *bar;
+
+	assert(0 != dev->fd && 0 != dev->bar_dwlen[0]);
+
+	bar = mmap(NULL, dev->bar_dwlen[0] * DW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, SHANNONC_MMAP_BAR0);
+	if (MAP_FAILED == bar) {
+		print("%s() mmap BAR0 failed, use syscall to access registers", __func__);
+		perror(" ");
+		return ERR;
+	}
+	dev->bar = bar;
+
+	dev->ioread32		= mmio_ioread32;
+	dev->iowrite32		= mmio_iowrite32;
+
+	dev->raw_readl		= mmio_raw_readl;
+	dev->raw_writel		= mmio_raw_writel;
+
+	dev->multi_ioread32	= mmio_multi_ioread32;
+	dev->multi_iowrite32	= mmio_multi_iowrite32;
+
+	dev->multi_raw_readl	= mmio_multi_raw_readl;
+	dev->multi_raw_writel	= mmio_multi_raw_writel;
+
+	dev->ioread_lunreg	= mmio_ioread_lunreg;
+	dev->iowrite_lunreg	= mmio_iowrite_lunreg;
+
+	dev->ioread_buflunreg	= mmio_ioread_buflunreg;
+	dev->iowrite_buflunreg	= mmio_iowrite_buflunreg;
+
+	dev->ioread_config	= mmio_ioread_config;
+	dev->iowrite_config	= mmio_iowrite_config;
+
+	return 0;
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * latency histograms keyed by (lun, opcode): time from submit_request() to retire, so it includes waiting in cmdqueue
+ * for the doorbell and the polling delay besides tR/tPROG/tBERS.
+ *
+ * Buckets are log-linear: 8 linear buckets per power of 2, error of a bucket is at most 1/8. A lun is retired by one
+ * thread only, main thread or its worker, so counting needs no lock.
+ */
+static const char *lat_op_name[LAT_NOP] = {
+	[LAT_ERASE]	= "erase",
+	[LAT_WRITE]	= "write",
+	[LAT_PREREAD]	= "preread",
+	[LAT_CACHEREAD]	= "cacheread",
+	[LAT_BUFWRITE]	= "bufwrite",
+	[LAT_RAID]	= "raid",
+	[LAT_OTHER]	= "other",
+};
+
+static int lat_op(int opcode)
+{
+	switch (opcode) {
+	case sh_erase_cmd:
+		return LAT_ERASE;
+	case sh_write_cmd:
+		return LAT_WRITE;
+	case sh_preread_cmd:
+		return LAT_PREREAD;
+	case sh_cacheread_cmd:
+		return LAT_CACHEREAD;
+	case sh_bufwrite_cmd:
+		return LAT_BUFWRITE;
+	case sh_raidinit_cmd:
+	case sh_raidwrite_cmd:
+		return LAT_RAID;
+	default:
+		return LAT_OTHER;
+	}
+}
+
+static int lat_bucket(long long ns)
+{
+	int shift;
+
+	if (ns < 0)
+		ns = 0;
+	if (ns > LAT_MAX_NS)
+		ns = LAT_MAX_NS;
+	if (ns < (1 << LAT_SUB_SHIFT))
+		return ns;
+
+	shift = 63 - __builtin_clzll(ns) - LAT_SUB_SHIFT;
+	return ((shift + 1) << LAT_SUB_SHIFT) + ((ns >> shift) & ((1 << LAT_SUB_SHIFT) - 1));
+}
+
+/* lowest ns of bucket */
+static long long lat_bucket_ns(int bucket)
+{
+	int shift = (bucket >> LAT_SUB_SHIFT) - 1;
+
+	if (shift < 0)
+		return bucket;
+	return (long long)((1 << LAT_SUB_SHIFT) | (bucket & ((1 << LAT_SUB_SHIFT) - 1))) << shift;
+}
+
+int init_latency(struct shannon_dev *dev, char *file)
+{
+	dev->latency = zmalloc(sizeof(*dev->latency));
+	if (NULL == dev->latency)
+		return ALLOCMEM_FAILED;
+
+	dev->latency->file = file;
+	return 0;
+}
+
+void free_latency(struct shannon_dev *dev)
+{
+	free(dev->latency);
+	dev->latency = NULL;
+}
+
+void latency_record(struct shannon_dev *dev, struct shannon_request *req, long long now)
+{
+	long long ns = now - req->submit_ns;
+	struct lat_hist *h = &dev->latency->hist[req->lun][lat_op(req->opcode)];
+
+	h->bucket[lat_bucket(ns)]++;
+	if (0 == h->count || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->sum += ns;
+	h->count++;
+}
+
+/* lowest ns of the bucket holding percent of samples */
+static long long lat_percentile(struct lat_hist *h, int percent)
+{
+	int i;
+	long long n = 0, want = (h->count * percent + 99) / 100;
+
+	for (i = 0; i < LAT_NBUCKET; i++) {
+		n += h->bucket[i];
+		if (n >= want)
+			return lat_bucket_ns(i);
+	}
+	return h->max;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(long long *)a, y = *(long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * print every (lun, opcode) which has samples, a lun whose p50 is over 1.5 times the median p50 of its opcode is marked
+ * slow
+ */
+static void pr_latency_table(struct shannon_dev *dev)
+{
+	int lun, op, n;
+	long long p50[MAX_LUN], median;
+	struct lat_hist *h;
+
+	print("LATENCY (us):\n");
+	for (op = 0; op < LAT_NOP; op++) {
+		n = 0;
+		for (lun = 0; lun < MAX_LUN; lun++) {
+			if (dev->latency->hist[lun][op].count)
+				p50[n++] = lat_percentile(&dev->latency->hist[lun][op], 50);
+		}
+		if (0 == n)
+			continue;
+
+		qsort(p50, n, sizeof(p50[0]), cmp_ll);
+		median = p50[n / 2];
+
+		printf("%s: luns=%d median-p50=%lld\n", lat_op_name[op], n, median / 1000);
+		for (lun = 0; lun < MAX_LUN; lun++) {
+			h = &dev->latency->hist[lun][op];
+			if (0 == h->count)
+				continue;
+
+			printf("  lun-%03d phylun-%03d count=%lld min=%lld avg=%lld p50=%lld p99=%lld max=%lld%s\n",
+				lun, log2phy_lun(dev, lun), h->count, h->min / 1000, h->sum / h->count / 1000,
+				lat_percentile(h, 50) / 1000, lat_percentile(h, 99) / 1000, h->max / 1000,
+				(lat_percentile(h, 50) * 2 > median * 3) ? " SLOW" : "");
+		}
+	}
+}
+
+/* one line per non-empty bucket: lun phylun opcode bucket-low-ns count */
+static void dump_latency(struct shannon_dev *dev)
+{
+	int lun, op, i;
+	FILE *fp;
+	struct lat_hist *h;
+
+	fp = fopen(dev->latency->file, "w");
+	if (NULL == fp) {
+		printf("Create latency file %s fail\n", dev->latency->file);
+		return;
+	}
+
+	fprintf(fp, "# lun phylun opcode bucket_ns count\n");
+	for (lun = 0; lun < MAX_LUN; lun++) {
+		for (op = 0; op < LAT_NOP; op++) {
+			h = &dev->latency->hist[lun][op];
+			for (i = 0; i < LAT_NBUCKET && h->count; i++) {
+				if (h->bucket[i])
+					fprintf(fp, "%d %d %s %lld %u\n", lun, log2phy_lun(dev, lun), lat_op_name[op], lat_bucket_ns(i), h->bucket[i]);
+			}
+		}
+	}
+
+	fclose(fp);
+}
+
+void pr_latency(struct shannon_dev *dev)
+{
+	if (NULL == dev->latency)
+		return;
+
+	pr_latency_table(dev);
+	if (NULL != dev->latency->file)
+		dump_latency(dev);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -85,24 +85,55 @@ static void pr_tool_usage(void)
 	printf("\tztool [OPTION] rmw-fake-ecc [argv]\n");
 	printf("\tztool [OPTION] ifmode [argv]\n\n");
 
-	printf("\tztool [OPTION] mpt [argv]\n\n");
+	printf("\tztool [OPTION] mpt [argv]\n");
+	printf("\tztool [OPTION] trace-decode [argv]\n\n");
 
 	printf("\tztool --help, display this help and exit\n");
 	printf("\n");
 
 	print("OPTION:\n");
 	printf("\t--dev=nod\n\t\tSpecify device name, default is /dev/shannon-dev.\n");
+	printf("\t--dev=sim:<geometry>\n\t\tRun on emulated controller and flash, geometry is comma separated: ch=n,th=n,lun=n,bus=8|16,"
+				"\n\t\tid=b0:..:b7,tR=us,tPROG=us,tBERS=us,bad=permille,ecc=n,seed=n. 'flash' and 'config' file are still used\n");
 	printf("\t--no-reinit\n\t\tUsing present hardware config instead of re-init by 'config' file. NOTE: after hardware"
 				"\n\t\tpower-on and before this command at leat one other command except 'utils' must been executed.\n");
-	printf("\t--power-budget=n\n\t\tSpecify power budget for this borad: 0->default, [3,127]\n");
+	printf("\t--power-budget=n\n\t\tSpecify power budget for this borad: 0->default, [3,127]. Batch scans like mpt sorting also keep at most\n"
+		"\t\tn/channels dies of a channel programming or erasing at once\n");
 	printf("\t--ifclock=n\n\t\tSpecify flash interface clock: 0->default, 4->250M, 5->200M, 6->166M, 7->145M\n");
 	printf("\t--silent-config=n\n\t\tUse default config value instead of reading from config file\n");
 	printf("\t--exitlog\n\t\tSave the reason of exit if has.\n");
 	printf("\t--per-byte-dis=n\n\t\tDisable low/high byte: 0->not disabled, 1->disable low byte, 2->disable high byte\n");
 	printf("\t--dev-type=n\n\t\tSelect device type: 0->K7F, 1->k7h_dual, 2->FIJI\n");
+	printf("\t--mmio\n\t\tAccess registers through mmaped BAR0 instead of read/write syscall, fall back to syscall if mmap failed\n");
+	printf("\t--dma-pool=n\n\t\tPreallocate n DMA buffers per lun-plane page and recycle them, 0->disable, default %d\n", DMA_POOL_DEPTH);
+	printf("\t--map-rings\n\t\tMmap command and completion queues of every thread, fall back to ioctl copy if mmap failed\n");
+	printf("\t--zero-copy\n\t\tMmap a DMA region and let super-write/super-read generate and check data in it without copy\n");
+	printf("\t--poll-spin=n\n\t\tBusy-spin n us before sleeping when polling completion, default depends on erase/program/read\n");
+	printf("\t--workers\n\t\tDrive every hw thread by its own worker thread in batch scans like mpt sorting\n");
+	printf("\t--stats\n\t\tPrint statistics of dma pool and others after subtool done\n");
+	printf("\t--latency\n\t\tRecord latency of every request by lun and opcode, print histogram summary after subtool done\n");
+	printf("\t--latency-file=file\n\t\tSame as --latency and dump histogram buckets to file\n");
+	printf("\t--prng=rand|ctr\n\t\tGenerator of super-write/super-read sector data, rand is compatible with data written by older tools and is default, ctr is faster\n");
+	printf("\t--pattern=base[:XX][,modifier]...\n\t\tTest pattern of super-write/super-read/write instead of --prng generator, base is random solid:XX"
+				"\n\t\tinc inc-byte walk1 walk0 checker prbs7 prbs15 prbs31, modifier is inverse hl-same hl-not clock-not, see ifmode -h\n");
+	printf("\t--trace=file\n\t\tLatest commands and completions are always traced in memory and written to file at exit, default is "
+				TRACE_FILE "\n\t\tin working directory, see trace-decode\n");
 #endif
 }
 
+static void pr_tool_stats(struct shannon_dev *dev)
+{
+	print("STATS:\n");
+	pr_dma_pool_stats(dev);
+	pr_dma_region_stats(dev);
+	pr_poll_stats(dev);
+	pr_req_slab_stats(dev);
+	pr_engine_stats(dev);
+	pr_sched_stats(dev);
+	if (NULL != dev->sim)
+		pr_sim_stats(dev);
+}
+
 static void atexit_free_kmem(void)
 {
 	struct memory *mem, *tmp;
@@ -123,6 +154,9 @@ static char *map_device_node(char *s)
 {
 	char dn[32];
 
+	if (!strncmp(s, "sim:", 4))
+		return strdup(s);
+
 	if (s[0] == 'a')
 		sprintf(dn, "%s", "/dev/shannon_cdev");
 	else if (s[0] >= 'b' && s[1] <= 'z')
@@ -151,6 +185,18 @@ int main(int argc, char **argv)
 		{"disable-ecc", no_argument, NULL, 'b'},
 		{"per-byte-dis", required_argument, NULL, 'P'},
 		{"dev-type", required_argument, NULL, 't'},
+		{"mmio", no_argument, NULL, 'm'},
+		{"dma-pool", required_argument, NULL, 'o'},
+		{"stats", no_argument, NULL, 'S'},
+		{"zero-copy", no_argument, NULL, 'z'},
+		{"map-rings", no_argument, NULL, 'R'},
+		{"poll-spin", required_argument, NULL, 'L'},
+		{"workers", no_argument, NULL, 'W'},
+		{"latency", no_argument, NULL, 'l'},
+		{"latency-file", required_argument, NULL, 'H'},
+		{"trace", required_argument, NULL, 'T'},
+		{"prng", required_argument, NULL, 'G'},
+		{"pattern", required_argument, NULL, 'Q'},
 		{"help", no_argument, NULL, 'h'},
 		{0, 0, 0, 0},
 	};
@@ -168,6 +214,18 @@ int main(int argc, char **argv)
 	int disable_ecc = 0;
 	int per_byte_disable = 0;
 	int dev_type = DEV_TOTAL;
+	int mmio = 0;
+	int dma_pool_depth = DMA_POOL_DEPTH;
+	int print_stats = 0;
+	int zero_copy = 0;
+	int map_rings = 0;
+	int poll_spin_us = -1;
+	int use_engine = 0;
+	int latency = 0;
+	char *latency_file = NULL;
+	char *trace_file = TRACE_FILE;
+	int prng_mode = PRNG_RAND;
+	char *pattern_spec = NULL;
 
 	int rc;
 	struct shannon_dev *dev;
@@ -231,6 +289,49 @@ int main(int argc, char **argv)
 		case 't':
 			dev_type = atoi(optarg);
 			break;
+		case 'm':
+			mmio = 1;
+			break;
+		case 'o':
+			dma_pool_depth = atoi(optarg);
+			assert(dma_pool_depth >= 0);
+			break;
+		case 'S':
+			print_stats = 1;
+			break;
+		case 'z':
+			zero_copy = 1;
+			break;
+		case 'R':
+			map_rings = 1;
+			break;
+		case 'L':
+			poll_spin_us = atoi(optarg);
+			assert(poll_spin_us >= 0);
+			break;
+		case 'W':
+			use_engine = 1;
+			break;
+		case 'l':
+			latency = 1;
+			break;
+		case 'H':
+			latency = 1;
+			latency_file = optarg;
+			break;
+		case 'T':
+			trace_file = optarg;
+			break;
+		case 'G':
+			prng_mode = parse_prng_mode(optarg);
+			if (prng_mode < 0) {
+				printf("Generator choices: rand ctr\n");
+				return ERR;
+			}
+			break;
+		case 'Q':
+			pattern_spec = optarg;
+			break;
 		case 'h':
 			pr_tool_usage();
 			return 0;
@@ -249,10 +350,16 @@ int main(int argc, char **argv)
 	subtool_argc = argc - nr + 1;
 	optind = 1;
 
+	/* offline subtools need no device, as help */
+	if (!strcmp("trace-decode", subtool_argv[0]))
+		return shannon_trace_decode(NULL, subtool_argc, subtool_argv);
+
 	/* alloc device struct and do some soft init but no hw init */
 	dev = alloc_device(devname);
 	if (NULL == dev)
 		return ERR;
+	if (mmio && NULL == dev->sim)		/* sim registers are memory already */
+		mmap_device_bar(dev);
 	dev->init_mode = no_reinit;
 	dev->fblocks = fblocks;
 	dev->unsafe_cfgable = unsafe_cfgable;
@@ -267,6 +374,25 @@ int main(int argc, char **argv)
 	dev->disable_ecc = disable_ecc;
 	dev->dev_type = dev_type;
 	config_dev_type(&sc_size, dev_type);
+	dev->dma_pool_depth = dma_pool_depth;
+	dev->print_stats = print_stats;
+	dev->zero_copy = (NULL == dev->sim) ? zero_copy : 0;
+	dev->map_rings = (NULL == dev->sim) ? map_rings : 0;
+	init_poll_policy(dev, poll_spin_us);
+	dev->use_engine = use_engine;
+	dev->prng_mode = prng_mode;
+	if (NULL != pattern_spec && NULL == (dev->pattern = parse_pattern(dev, pattern_spec))) {
+		printf("Invalid pattern %s\n", pattern_spec);
+		exit(EXIT_FAILURE);
+	}
+	if (latency && init_latency(dev, latency_file)) {
+		printf("Alloc latency histograms fail\n");
+		exit(EXIT_FAILURE);
+	}
+	if (init_trace(dev, trace_file)) {
+		printf("Alloc trace ring fail\n");
+		exit(EXIT_FAILURE);
+	}
 
 	dev->exitlog = NULL;
 	if (NULL != exitlog_filename) {
@@ -280,6 +406,7 @@ int main(int argc, char **argv)
 
 	thisdev = dev;
 	signal(SIGINT, do_signal_int);
+	signal(SIGTERM, do_signal_int);
 	register_atexit();
 
 	/* subtool branch, last argument: 1, call init_device() to init hw; 0, none */
@@ -317,6 +444,9 @@ int main(int argc, char **argv)
 	SUBTOOL("mpt", shannon_mpt, 1)
 	SUBTOOL_TAIL()
 
+	if (dev->print_stats)
+		pr_tool_stats(dev);
+	pr_latency(dev);
 	free_device(dev);
 	return rc;
 }
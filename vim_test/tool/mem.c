@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * DMA buffer pool: sector buffers are borrowed by requests and returned on completion,
+ * so get_mem/free_mem ioctl are only called when pool grows or shrinks.
+ */
+static struct memory *alloc_dma_mem(struct shannon_dev *dev, int size, int pooled)
+{
+	struct memory *mem;
+
+	mem = zmalloc(sizeof(*mem));
+	if (NULL == mem)
+		return NULL;
+
+	mem->size = size;
+	mem->pooled = pooled;
+	dev->get_mem(dev, mem);
+
+	return mem;
+}
+
+static void release_dma_mem(struct shannon_dev *dev, struct memory *mem)
+{
+	dev->free_mem(dev, mem);
+	free(mem);
+}
+
+static void drain_dma_pool(struct shannon_dev *dev)
+{
+	struct memory *mem, *tmp;
+	struct dma_pool *pool = &dev->dma_pool;
+
+	list_for_each_entry_safe(mem, tmp, &pool->free_listhead, list) {
+		list_del(&mem->list);
+		release_dma_mem(dev, mem);
+		pool->total--;
+	}
+}
+
+/*
+ * pool is sized as page_nsector * nplane * luns * depth buffers, buffer size is the biggest sector_size ever used.
+ * Buffers are allocated by get_dma_mem() when they are first borrowed, subtools doing no io never call get_mem.
+ * called by init_device() and re_init_device()
+ */
+int init_dma_pool(struct shannon_dev *dev)
+{
+	int size;
+	struct dma_pool *pool = &dev->dma_pool;
+
+	if (!pool->size) {
+		INIT_LIST_HEAD(&pool->free_listhead);
+		pthread_mutex_init(&pool->lock, NULL);
+	}
+
+	if (!dev->dma_pool_depth)
+		return 0;
+
+	size = dev->config->sector_size;
+	if (size > pool->size) {
+		drain_dma_pool(dev);	/* buffers in use are released when they are returned */
+		pool->size = size;
+	}
+
+	pool->target = dev->config->page_nsector * dev->config->nplane * dev->config->luns * dev->dma_pool_depth;
+	return 0;
+}
+
+void free_dma_pool(struct shannon_dev *dev)
+{
+	if (dev->dma_pool.size)
+		drain_dma_pool(dev);
+}
+
+struct memory *get_dma_mem(struct shannon_dev *dev, int size)
+{
+	struct memory *mem;
+	struct dma_pool *pool = &dev->dma_pool;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!dev->dma_pool_depth || size > pool->size) {
+		mem = alloc_dma_mem(dev, size, 0);
+		goto out;
+	}
+
+	pool->borrow++;
+	if (list_empty(&pool->free_listhead)) {
+		if (pool->total >= pool->target)
+			pool->miss++;
+		mem = alloc_dma_mem(dev, pool->size, 1);
+		if (NULL == mem)
+			goto out;
+		pool->total++;
+	} else {
+		mem = list_first_entry(&pool->free_listhead, struct memory, list);
+		list_del(&mem->list);
+	}
+
+	if (++pool->inuse > pool->high_water)
+		pool->high_water = pool->inuse;
+
+	INIT_LIST_HEAD(&mem->list);
+out:
+	pthread_mutex_unlock(&pool->lock);
+	return mem;
+}
+
+void put_dma_mem(struct shannon_dev *dev, struct memory *mem)
+{
+	struct dma_pool *pool = &dev->dma_pool;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!mem->pooled) {
+		release_dma_mem(dev, mem);
+		goto out;
+	}
+
+	pool->inuse--;
+	if (mem->size < pool->size) {		/* left from smaller sector_size */
+		release_dma_mem(dev, mem);
+		pool->total--;
+		goto out;
+	}
+	list_add(&mem->list, &pool->free_listhead);
+out:
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pr_dma_pool_stats(struct shannon_dev *dev)
+{
+	struct dma_pool *pool = &dev->dma_pool;
+
+	if (!dev->dma_pool_depth) {
+		printf("dma pool: disabled\n");
+		return;
+	}
+
+	printf("dma pool: bufsize=%d total=%d inuse=%d high_water=%d borrow=%ld miss=%ld\n",
+		pool->size, pool->total, pool->inuse, pool->high_water, pool->borrow, pool->miss);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * zero-copy dma region: one dma memory mmaped to user space and carved into slots of page_nsector sectors.
+ * data of REQ_DMA_MAPPED request points to a slot, hw reads and writes it without write_mem/read_mem.
+ */
+/* region is kept if some slot is still used by a request, hw may still write it */
+static int release_dma_region(struct shannon_dev *dev)
+{
+	struct shannon_ioctl ioctl_data;
+	struct dma_region *region = &dev->dma_region;
+
+	if (region->nfree != region->nslot) {
+		printf("%s(): %d slots of dma region are leaked, region is not freed\n", __func__, region->nslot - region->nfree);
+		return ERR;
+	}
+
+	munmap(region->user_addr, region->size);
+
+	ioctl_data.size = region->size;
+	ioctl_data.kernel_addr = region->kernel_addr;
+	ioctl_data.dma_addr = region->dma_addr;
+	if (ioctl(dev->fd, SHANNONC_IOC_FM, &ioctl_data))
+		perror_exit("%s() failed", __func__);
+
+	free(region->free_slot);
+	memset(region, 0x00, sizeof(*region));
+	return 0;
+}
+
+/* called by init_device() and re_init_device(), zero-copy is disabled if driver can`t map dma region */
+int init_dma_region(struct shannon_dev *dev)
+{
+	int i, size, slot_size, nslot, depth;
+	void *addr;
+	struct shannon_ioctl ioctl_data;
+	struct dma_region *region = &dev->dma_region;
+
+	if (!dev->zero_copy)
+		return 0;
+
+	slot_size = (dev->config->page_nsector * dev->config->sector_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	depth = dev->dma_pool_depth ? dev->dma_pool_depth : DMA_POOL_DEPTH;
+	nslot = dev->config->luns * dev->config->nplane * depth;	// a slot per lun-plane page, as dma pool, cacheread of part of page takes a whole slot
+
+	if (region->size) {
+		if (region->slot_size >= slot_size && region->nslot >= nslot)
+			return 0;
+		if (release_dma_region(dev))
+			return ERR;
+	}
+
+	size = slot_size * nslot;
+	ioctl_data.size = size;
+	if (ioctl(dev->fd, SHANNONC_IOC_GR, &ioctl_data)) {
+		print("%s() get dma region failed, disable zero-copy", __func__);
+		perror(" ");
+		goto disable_out;
+	}
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, SHANNONC_MMAP_DMAREGION);
+	if (MAP_FAILED == addr) {
+		print("%s() mmap dma region failed, disable zero-copy", __func__);
+		perror(" ");
+		if (ioctl(dev->fd, SHANNONC_IOC_FM, &ioctl_data))
+			perror_exit("%s() free dma region failed", __func__);
+		goto disable_out;
+	}
+
+	region->free_slot = malloc(nslot * sizeof(*region->free_slot));
+	if (NULL == region->free_slot) {
+		munmap(addr, size);
+		if (ioctl(dev->fd, SHANNONC_IOC_FM, &ioctl_data))
+			perror_exit("%s() free dma region failed", __func__);
+		return ALLOCMEM_FAILED;
+	}
+
+	region->size = size;
+	region->kernel_addr = ioctl_data.kernel_addr;
+	region->dma_addr = ioctl_data.dma_addr;
+	region->user_addr = addr;
+	region->slot_size = slot_size;
+	region->nslot = nslot;
+	for (i = 0; i < nslot; i++)
+		region->free_slot[i] = nslot - 1 - i;
+	region->nfree = nslot;
+
+	return 0;
+
+disable_out:
+	dev->zero_copy = 0;
+	return 0;
+}
+
+/* a leaked region is reported by release_dma_region() and left to process exit */
+void free_dma_region(struct shannon_dev *dev)
+{
+	if (dev->dma_region.size)
+		release_dma_region(dev);
+}
+
+/* return slot index, -1 if none left */
+int get_dma_slot(struct shannon_dev *dev)
+{
+	struct dma_region *region = &dev->dma_region;
+
+	if (!region->size)
+		return -1;
+
+	if (!region->nfree) {
+		region->miss++;
+		return -1;
+	}
+
+	if (region->nslot - region->nfree + 1 > region->high_water)
+		region->high_water = region->nslot - region->nfree + 1;
+
+	return region->free_slot[--region->nfree];
+}
+
+void put_dma_slot(struct shannon_dev *dev, int slot)
+{
+	struct dma_region *region = &dev->dma_region;
+
+	assert(slot >= 0 && slot < region->nslot && region->nfree < region->nslot);
+	region->free_slot[region->nfree++] = slot;
+}
+
+void pr_dma_region_stats(struct shannon_dev *dev)
+{
+	struct dma_region *region = &dev->dma_region;
+
+	if (!dev->zero_copy) {
+		printf("dma region: disabled\n");
+		return;
+	}
+
+	printf("dma region: slot_size=%d nslot=%d inuse=%d high_water=%d miss=%ld\n",
+		region->slot_size, region->nslot, region->nslot - region->nfree, region->high_water, region->miss);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * request slab: objects are never returned to libc until free_device(), buffers of old sector config are freed
+ * when they come back.
+ */
+static int grow_req_slab(struct req_slab *slab)
+{
+	int i;
+	struct req_slab_chunk *chunk;
+	struct shannon_request *req;
+
+	chunk = zmalloc(sizeof(*chunk));
+	if (NULL == chunk)
+		return ALLOCMEM_FAILED;
+
+	if (posix_memalign(&chunk->addr, REQ_SLAB_ALIGN, REQ_SLAB_CHUNK_NOBJ * slab->objsize)) {
+		free(chunk);
+		return ALLOCMEM_FAILED;
+	}
+
+	for (i = 0; i < REQ_SLAB_CHUNK_NOBJ; i++) {
+		req = chunk->addr + i * slab->objsize;
+		list_add_tail(&req->list, &slab->free_listhead);
+	}
+
+	list_add_tail(&chunk->list, &slab->chunk_listhead);
+	slab->nchunk++;
+	slab->total += REQ_SLAB_CHUNK_NOBJ;
+	return 0;
+}
+
+static void drain_slab_buf(struct req_slab *slab)
+{
+	struct list_head *buf, *tmp;
+
+	list_for_each_safe(buf, tmp, &slab->buf_listhead) {
+		list_del(buf);
+		free(buf);
+		slab->nbuf--;
+	}
+}
+
+/*
+ * size buffers for present config, called by alloc_device() with no config yet, init_device() and re_init_device()
+ */
+void init_req_slab(struct shannon_dev *dev)
+{
+	int bufsize;
+	struct req_slab *slab = &dev->req_slab;
+
+	if (!slab->objsize) {
+		INIT_LIST_HEAD(&slab->free_listhead);
+		INIT_LIST_HEAD(&slab->buf_listhead);
+		INIT_LIST_HEAD(&slab->chunk_listhead);
+		slab->objsize = (sizeof(struct shannon_request) + REQ_SLAB_ALIGN - 1) & ~(REQ_SLAB_ALIGN - 1);
+	}
+
+	bufsize = (dev->config->page_nsector * (dev->config->sector_size + METADATA_SIZE) + REQ_SLAB_ALIGN - 1) & ~(REQ_SLAB_ALIGN - 1);
+	if (bufsize != slab->bufsize) {
+		drain_slab_buf(slab);	/* buffers inuse are freed when they are put back */
+		slab->bufsize = bufsize;
+	}
+}
+
+void free_req_slab(struct shannon_dev *dev)
+{
+	struct req_slab_chunk *chunk, *tmp;
+	struct req_slab *slab = &dev->req_slab;
+
+	if (!slab->objsize)
+		return;
+
+	drain_slab_buf(slab);
+	list_for_each_entry_safe(chunk, tmp, &slab->chunk_listhead, list) {
+		list_del(&chunk->list);
+		free(chunk->addr);
+		free(chunk);
+	}
+	INIT_LIST_HEAD(&slab->free_listhead);
+	slab->nchunk = slab->total = 0;
+}
+
+/* return zeroed request */
+struct shannon_request *get_slab_request(struct shannon_dev *dev)
+{
+	struct shannon_request *req;
+	struct req_slab *slab = &dev->req_slab;
+
+	slab->borrow++;
+	if (list_empty(&slab->free_listhead)) {
+		slab->grow++;
+		if (grow_req_slab(slab))
+			return NULL;
+	}
+
+	req = list_first_entry(&slab->free_listhead, struct shannon_request, list);
+	list_del(&req->list);
+	if (++slab->inuse > slab->high_water)
+		slab->high_water = slab->inuse;
+
+	memset(req, 0x00, sizeof(*req));
+	return req;
+}
+
+/* borrow a bufsize buffer for req, NULL if config has no sector yet or malloc failed */
+__u8 *get_slab_buf(struct shannon_dev *dev, struct shannon_request *req)
+{
+	void *buf;
+	struct req_slab *slab = &dev->req_slab;
+
+	assert(NULL == req->slab_buf);
+
+	if (!slab->bufsize)
+		return NULL;
+
+	if (list_empty(&slab->buf_listhead)) {
+		if (posix_memalign(&buf, REQ_SLAB_ALIGN, slab->bufsize))
+			return NULL;
+		slab->nbuf++;
+	} else {
+		buf = slab->buf_listhead.next;
+		list_del(buf);
+	}
+	slab->buf_inuse++;
+
+	req->slab_buf = buf;
+	req->slab_bufsize = slab->bufsize;
+	return buf;
+}
+
+void put_slab_request(struct shannon_dev *dev, struct shannon_request *req)
+{
+	struct req_slab *slab = &dev->req_slab;
+
+	if (NULL != req->slab_buf) {
+		slab->buf_inuse--;
+		if (req->slab_bufsize == slab->bufsize) {
+			list_add((struct list_head *)req->slab_buf, &slab->buf_listhead);
+		} else {
+			free(req->slab_buf);
+			slab->nbuf--;
+		}
+	}
+
+	slab->inuse--;
+	list_add(&req->list, &slab->free_listhead);
+}
+
+void pr_req_slab_stats(struct shannon_dev *dev)
+{
+	struct req_slab *slab = &dev->req_slab;
+
+	printf("request slab: objsize=%d nchunk=%d total=%d inuse=%d high_water=%d borrow=%ld grow=%ld\n",
+		slab->objsize, slab->nchunk, slab->total, slab->inuse, slab->high_water, slab->borrow, slab->grow);
+	printf("request slab buffer: bufsize=%d total=%d inuse=%d fallback=%ld\n",
+		slab->bufsize, slab->nbuf, slab->buf_inuse, slab->fallback);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -217,17 +217,143 @@ static void timespan(time_t b, time_t e, char *stt)
 	sprintf(stt + n, "%ds", s);
 }
 
+#undef ADVANCED_READ_INFO
+// #define	ADVANCED_READ_INFO	1
+
+/*
+ * results of sorting are checked as each req retires, instead of walking the whole list after the last one
+ */
+struct sort_ctx {
+	struct shannon_dev *dev;
+	struct shannon_bbt *bbt;
+	int blk;
+	int head;
+	struct list_head *req_head_ar;	/* advance read is queued here when normal read ecc is high */
+};
+
+/* advance read and erase */
+static void sort_ar_done(struct shannon_request *req, void *ctx)
+{
+	int i;
+	struct sort_ctx *sc = ctx;
+	struct shannon_dev *dev = sc->dev;
+
+	if (sh_cacheread_cmd == req->opcode) {
+#ifdef ADVANCED_READ_INFO
+		print("Sorting%s loops %d/%d: lun %d blk %d page %d advanced read ecc are:",
+		      dev->sorting_print_string, dev->loops, dev->scan_loops, req->lun, sc->blk, req->ppa % dev->flash->npage);
+		for (i = 0; i < req->nsector; i++)
+			print(" %d", req->ecc[i]);
+		printf("\n");
+#endif
+		for (i = 0; i < req->nsector; i++) {
+			if (req->ecc[i] <= dev->tmode)
+				ecc_histogram[req->ecc[i]]++;
+
+			if ((req->ecc[i] > dev->sorting_ecc_limit) && !test_bit(req->lun, sc->bbt->sb_bbt[sc->blk])) {
+				dev->bad_blocks++;
+				dev->bb_count[req->lun]++;
+				set_bit(req->lun, sc->bbt->sb_bbt[sc->blk]);
+				print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d advanced read ecc is %d\n",
+					dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], sc->blk, req->ecc[i]);
+				if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
+					dev->valid_luns--;
+					set_bit(req->lun, dev->lun_bitmap);
+					print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
+				}
+			}
+		}
+	} else if (sh_erase_cmd == req->opcode) {
+		if (check_req_status_silent(req) && !test_bit(req->lun, sc->bbt->sb_bbt[sc->blk])) {
+			dev->bad_blocks++;
+			dev->bb_count[req->lun]++;
+			set_bit(req->lun, sc->bbt->sb_bbt[sc->blk]);
+			print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d erase failed\n",
+			      dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], sc->blk);
+			if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
+				dev->valid_luns--;
+				set_bit(req->lun, dev->lun_bitmap);
+				print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
+			}
+		}
+	} else
+		exitlog("Unkonwn command %x\n", req->opcode);
+}
+
+/* write, pre-read and normal read */
+static void sort_rw_done(struct shannon_request *req, void *ctx)
+{
+	int i, bs, ns, remain_ns;
+	struct shannon_request *tmp;
+	struct sort_ctx *sc = ctx;
+	struct shannon_dev *dev = sc->dev;
+
+	if (sh_write_cmd == req->opcode || sh_preread_cmd == req->opcode) {
+		if (check_req_status_silent(req) && !test_bit(req->lun, sc->bbt->sb_bbt[sc->blk])) {
+			dev->bad_blocks++;
+			dev->bb_count[req->lun]++;
+			set_bit(req->lun, sc->bbt->sb_bbt[sc->blk]);
+			print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d %s failed\n",
+				dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], sc->blk,
+				(sh_write_cmd == req->opcode) ? "write" : "pre-read");
+			if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
+				dev->valid_luns--;
+				set_bit(req->lun, dev->lun_bitmap);
+				print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
+			}
+		}
+	} else if (sh_cacheread_cmd == req->opcode) {
+		for (i = 0; i < req->nsector; i++) {
+			if ((req->ecc[i] >= 0xFB) && !test_bit(req->lun, sc->bbt->sb_bbt[sc->blk])) {
+				dev->bad_blocks++;
+				dev->bb_count[req->lun]++;
+				set_bit(req->lun, sc->bbt->sb_bbt[sc->blk]);
+				print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d page %d normal read ecc is %d\n",
+				      dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], sc->blk, req->page, req->ecc[i]);
+				if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
+					dev->valid_luns--;
+					set_bit(req->lun, dev->lun_bitmap);
+					print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
+				}
+			} else if ((req->ecc[i] > dev->sorting_ecc_limit) && !test_bit(req->lun, sc->bbt->sb_bbt[sc->blk])) {
+#ifdef ADVANCED_READ_INFO
+				print("Enter Advance Read! Sorting%s loops %d/%d: lun %d blk %d page %d high ecc is %d\n",
+					dev->sorting_print_string, dev->loops, dev->scan_loops, req->lun, sc->blk, req->ppa % dev->flash->npage, req->ecc[i]);
+#endif
+				bs = 0;
+				remain_ns = dev->config->page_nsector;
+				while (remain_ns) {
+					ns = (remain_ns >= 8) ? 8 : remain_ns;
+					tmp = alloc_request_no_dma(dev, sh_cacheread_cmd, req->lun, req->ppa, sc->head, bs, ns, REQ_NO_DMA);
+					if (NULL == tmp)
+						malloc_failed_exit();
+					tmp->advance_read = 1;
+					tmp->done = sort_ar_done;
+					tmp->done_ctx = sc;
+					list_add_tail(&tmp->list, sc->req_head_ar);
+					bs += ns;
+					remain_ns -= ns;
+				}
+
+				break;	/* skip checking othen sector ECC in this page */
+			 } else
+				ecc_histogram[req->ecc[i]]++;
+		}
+	} else
+		exitlog("Unkonwn command %x\n", req->opcode);
+}
+
 /*
  * Write then read and compare to scan MBR blocks
  */
-#undef ADVANCED_READ_INFO
-// #define	ADVANCED_READ_INFO	1
 static void mpt_scan_bbt_advance(struct shannon_dev *dev, struct shannon_bbt *bbt)
 {
 	int lun, blk, ppa, head;
 	struct shannon_request *req, *tmp;
 	struct list_head req_head, req_head_ar;
-	int i, remain_ns, ns, bs;
+	struct req_set rw_set, erase_set;
+	struct sort_ctx sc;
+	int remain_ns, ns, bs;
 	float pre_cent = 0, now_cent = 0;
 	int nblock = bbt->nblock;
 	float flash_temp, ctrl_temp, board_temp;
@@ -250,6 +376,54 @@ static void mpt_scan_bbt_advance(struct shannon_dev *dev, struct shannon_bbt *bb
 	INIT_LIST_HEAD(&req_head);
 	INIT_LIST_HEAD(&req_head_ar);
 
+	sc.dev = dev;
+	sc.bbt = bbt;
+	sc.head = head;
+	sc.req_head_ar = &req_head_ar;
+
+	/* write then normal read of all pages, erase is a set of its own since it runs after advance read */
+	init_req_set(&rw_set, dev);
+	init_req_set(&erase_set, dev);
+
+	for (ppa = 0; ppa < dev->flash->npage; ppa++) {
+		for_dev_each_lun(dev, lun) {
+			if (NULL == (req = req_set_add(&rw_set, NULL, sh_write_cmd, lun, ppa, head, 0, dev->config->page_nsector, 1)))
+				malloc_failed_exit();
+			req->done = sort_rw_done;
+			req->done_ctx = &sc;
+		}
+	}
+
+	for (ppa = 0; ppa < dev->flash->npage; ppa++) {
+		for_dev_each_lun(dev, lun) {
+			if (NULL == (req = req_set_add(&rw_set, NULL, sh_preread_cmd, lun, ppa, head, 0, 0, 0)))
+				malloc_failed_exit();
+			req->done = sort_rw_done;
+			req->done_ctx = &sc;
+
+			bs = 0;
+			remain_ns = dev->config->page_nsector;
+			while (remain_ns) {
+				ns = (remain_ns >= 8) ? 8 : remain_ns;
+
+				if (NULL == (req = req_set_add(&rw_set, NULL, sh_cacheread_cmd, lun, ppa, head, bs, ns, 1)))
+					malloc_failed_exit();
+				req->done = sort_rw_done;
+				req->done_ctx = &sc;
+
+				bs += ns;
+				remain_ns -= ns;
+			}
+		}
+	}
+
+	for_dev_each_lun(dev, lun) {
+		if (NULL == (req = req_set_add(&erase_set, NULL, sh_erase_cmd, lun, 0, head, 0, 0, 0)))
+			malloc_failed_exit();
+		req->done = sort_ar_done;
+		req->done_ctx = &sc;
+	}
+
 	srand(getseed(0));
 
 	print("block with ecc larger than %d will be marked bad:\n", dev->sorting_ecc_limit);
@@ -260,167 +434,31 @@ static void mpt_scan_bbt_advance(struct shannon_dev *dev, struct shannon_bbt *bb
 		dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, ctrl_temp, flash_temp, board_temp);
 
 	for (blk = 0; blk < nblock; blk++) {
-		/* write then do normal read */
-		set_max_ecc(dev, 240);
-
-		for (ppa = blk * dev->flash->npage; ppa < (blk + 1) * dev->flash->npage; ppa++) {
-			for_dev_each_lun(dev, lun) {
-				if (test_bit(lun, bbt->sb_bbt[blk]))
-					continue;
-				req = alloc_request_no_dma(dev, sh_write_cmd, lun, ppa, head, 0, dev->config->page_nsector, 1);
-				if (NULL == req)
-					malloc_failed_exit();
-				list_add_tail(&req->list, &req_head);
-			}
-		}
-
-		for (ppa = blk * dev->flash->npage; ppa < (blk + 1) * dev->flash->npage; ppa++) {
-			for_dev_each_lun(dev, lun) {
-				if (test_bit(lun, bbt->sb_bbt[blk]))
-					continue;
-				req = alloc_request(dev, sh_preread_cmd, lun, ppa, head, 0, 0);
-				if (NULL == req)
-					malloc_failed_exit();
-				list_add_tail(&req->list, &req_head);
-
-				bs = 0;
-				remain_ns = dev->config->page_nsector;
-				while (remain_ns) {
-					ns = (remain_ns >= 8) ? 8 : remain_ns;
+		sc.blk = blk;
 
-					req = alloc_request_no_dma(dev, sh_cacheread_cmd, lun, ppa, head, bs, ns, 1);
-					if (NULL == req)
-						malloc_failed_exit();
-					list_add_tail(&req->list, &req_head);
+		/* write then do normal read, advance read is queued by sort_rw_done() */
+		set_max_ecc(dev, 240);
 
-					bs += ns;
-					remain_ns -= ns;
-				}
-			}
-		}
+		bind_req_set(&rw_set, blk * dev->flash->npage);
+		list_req_set(&rw_set, &req_head, bbt->sb_bbt[blk]);
 
 		submit_polling_loop(dev, &req_head);
 
-		list_for_each_entry(req, &req_head, list) {
-			if (sh_write_cmd == req->opcode || sh_preread_cmd == req->opcode) {
-				if (check_req_status_silent(req) && !test_bit(req->lun, bbt->sb_bbt[blk])) {
-					dev->bad_blocks++;
-					dev->bb_count[req->lun]++;
-					set_bit(req->lun, bbt->sb_bbt[blk]);
-					print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d %s failed\n",
-						dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], blk,
-						(sh_write_cmd == req->opcode) ? "write" : "pre-read");
-					if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
-						dev->valid_luns--;
-						set_bit(req->lun, dev->lun_bitmap);
-						print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
-					}
-				}
-			} else if (sh_cacheread_cmd == req->opcode) {
-				for (i = 0; i < req->nsector; i++) {
-					if ((req->ecc[i] >= 0xFB) && !test_bit(req->lun, bbt->sb_bbt[blk])) {
-						dev->bad_blocks++;
-						dev->bb_count[req->lun]++;
-						set_bit(req->lun, bbt->sb_bbt[blk]);
-						print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d page %d normal read ecc is %d\n",
-						      dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], blk, req->page, req->ecc[i]);
-						if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
-							dev->valid_luns--;
-							set_bit(req->lun, dev->lun_bitmap);
-							print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
-						}
-					} else if ((req->ecc[i] > dev->sorting_ecc_limit) && !test_bit(req->lun, bbt->sb_bbt[blk])) {
-#ifdef ADVANCED_READ_INFO
-						print("Enter Advance Read! Sorting%s loops %d/%d: lun %d blk %d page %d high ecc is %d\n",
-							dev->sorting_print_string, dev->loops, dev->scan_loops, req->lun, blk, req->ppa % dev->flash->npage, req->ecc[i]);
-#endif
-						bs = 0;
-						remain_ns = dev->config->page_nsector;
-						while (remain_ns) {
-							ns = (remain_ns >= 8) ? 8 : remain_ns;
-							tmp = alloc_request_no_dma(dev, sh_cacheread_cmd, req->lun, req->ppa, head, bs, ns, 1);
-							if (NULL == tmp)
-								malloc_failed_exit();
-							tmp->advance_read = 1;
-							list_add_tail(&tmp->list, &req_head_ar);
-							bs += ns;
-							remain_ns -= ns;
-						}
-
-						break;	/* skip checking othen sector ECC in this page */
-					 } else
-						ecc_histogram[req->ecc[i]]++;
-				}
-			} else
-				exitlog("Unkonwn command %x\n", req->opcode);
-		}
-
-		list_for_each_entry_safe(req, tmp, &req_head, list) {
-			list_del(&req->list);
-			free_request(req);
-		}
+		INIT_LIST_HEAD(&req_head);
 
 		/* do advance read if have then do erase */
 		set_max_ecc(dev, dev->sorting_ecc_limit);
 
-		ppa = blk * dev->flash->npage;
-		for_dev_each_lun(dev, lun) {
-			if (test_bit(lun, bbt->sb_bbt[blk]))
-				continue;
-			req = alloc_request(dev, sh_erase_cmd, lun, ppa, head, 0, 0);
-			if (NULL == req)
-				malloc_failed_exit();
-			list_add_tail(&req->list, &req_head_ar);
-		}
+		bind_req_set(&erase_set, blk * dev->flash->npage);
+		list_req_set(&erase_set, &req_head_ar, bbt->sb_bbt[blk]);
 
 		submit_polling_loop(dev, &req_head_ar);
 
-		list_for_each_entry(req, &req_head_ar, list) {
-			if (sh_cacheread_cmd == req->opcode) {
-#ifdef ADVANCED_READ_INFO
-				print("Sorting%s loops %d/%d: lun %d blk %d page %d advanced read ecc are:",
-				      dev->sorting_print_string, dev->loops, dev->scan_loops, req->lun, blk, req->ppa % dev->flash->npage);
-				for (i = 0; i < req->nsector; i++)
-					print(" %d", req->ecc[i]);
-				printf("\n");
-#endif
-				for (i = 0; i < req->nsector; i++) {
-					if (req->ecc[i] <= dev->tmode)
-						ecc_histogram[req->ecc[i]]++;
-
-					if ((req->ecc[i] > dev->sorting_ecc_limit) && !test_bit(req->lun, bbt->sb_bbt[blk])) {
-						dev->bad_blocks++;
-						dev->bb_count[req->lun]++;
-						set_bit(req->lun, bbt->sb_bbt[blk]);
-						print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d advanced read ecc is %d\n",
-							dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], blk, req->ecc[i]);
-						if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
-							dev->valid_luns--;
-							set_bit(req->lun, dev->lun_bitmap);
-							print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
-						}
-					}
-				}
-			} else if (sh_erase_cmd == req->opcode) {
-				if (check_req_status_silent(req) && !test_bit(req->lun, bbt->sb_bbt[blk])) {
-					dev->bad_blocks++;
-					dev->bb_count[req->lun]++;
-					set_bit(req->lun, bbt->sb_bbt[blk]);
-					print("Sorting%s loops %d/%d, bad blocks %d: lun %d(%d) blk %d erase failed\n",
-					      dev->sorting_print_string, dev->loops, dev->scan_loops, dev->bad_blocks, req->lun, dev->bb_count[req->lun], blk);
-					if ((dev->bb_count[req->lun] > MAX_BAD_BLOCK_IN_A_LUN) && !test_bit(req->lun, dev->lun_bitmap)) {
-						dev->valid_luns--;
-						set_bit(req->lun, dev->lun_bitmap);
-						print("lun %d has too many bad blocks, marked as invalid\n", req->lun);
-					}
-				}
-			} else
-				exitlog("Unkonwn command %x\n", req->opcode);
-		}
-
+		/* only advance read requests don`t belong to a set */
 		list_for_each_entry_safe(req, tmp, &req_head_ar, list) {
 			list_del(&req->list);
-			free_request(req);
+			if (list_empty(&req->set_list))
+				free_request(req);
 		}
 
 		/* check MBR blocks */
@@ -440,6 +478,9 @@ static void mpt_scan_bbt_advance(struct shannon_dev *dev, struct shannon_bbt *bb
 		}
 	}
 
+	free_req_set(&rw_set);
+	free_req_set(&erase_set);
+
 	if (bbt->nblock == dev->flash->nblk)
 		check_all_bbt(dev, bbt, "INIT LOOP check bad luns");
 
@@ -1030,7 +1071,6 @@ static void mpt_write_bbt(struct shannon_dev *dev, struct shannon_bbt *bbt)
 				req = alloc_request(dev, sh_write_cmd, lun, ppa, head, 0, dev->config_bakup->page_nsector);
 				if (NULL == req)
 					malloc_failed_exit();
-				req->bfree = 0;
 				if (dev->bm_bbt) {
 					memset(req->data, 0x00, dev->config_bakup->ndata);
 					*((unsigned long *)req->data) = BITMAP_BBT_MAGIC;
@@ -1076,7 +1116,7 @@ static void mpt_write_bbt(struct shannon_dev *dev, struct shannon_bbt *bbt)
 				lun_head_req = req;
 				list_add_tail(&lun_head_req->list, &req_head);
 			} else {
-			/* other backup mbr block */
+			/* other backup mbr block, bbt memory is owned and freed by lun_head_req */
 				req = alloc_request(dev, sh_write_cmd, lun, ppa, head, 0, 0);
 				if (NULL == req)
 					malloc_failed_exit();
@@ -1090,8 +1130,6 @@ static void mpt_write_bbt(struct shannon_dev *dev, struct shannon_bbt *bbt)
 
 		if (dev->private_int)
 			printf("\n");
-
-		req->bfree = 1;		// last backup mbr block free bbt memory
 	}
 
 	/* submit requests and run them */
@@ -1702,11 +1740,7 @@ static void record_live_context(struct live_context *context)
 	int lun;
 	struct shannon_dev *dev = context->dev;
 
-	if (lseek(dev->fd, 0, SEEK_SET) < 0)
-		perror_exit("%s() lseek failed", __func__);
-
-	if (read(dev->fd, context->reg, HW_REG_SIZE) != HW_REG_SIZE)
-		perror_exit("%s() read failed", __func__);
+	dev->multi_raw_readl(dev, (__u32 *)context->reg, 0, HW_REG_SIZE / DW_SIZE);
 
 	for_dev_each_lun(dev, lun) {
 		dev->read_mem(dev, context->cmdq[lun], dev->lun[lun].thread->cmdmem.kernel_addr, PAGE_SIZE);
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * test pattern library. A pattern is a base stream plus modifiers:
+ *
+ *	random		generator of --prng, filled by prng.c itself
+ *	solid:XX	every byte is XX
+ *	inc		bus word k is k
+ *	inc-byte	byte k of page data is k, byte k of page metadata is k, as ifmode -i of older tools
+ *	walk1, walk0	one bit of bus word set/clear, walking one bit per word and per page
+ *	checker		bus words of 0x55 and 0xAA alternate, and swap on next page
+ *	prbs7/15/31	PRBS bit stream of x^7+x^6+1, x^15+x^14+1, x^31+x^28+1, msb first
+ *
+ *	inverse		odd page is inverse of the page before it
+ *	hl-same		high byte of bus word is same as low byte
+ *	hl-not		high byte of bus word is inverse of low byte
+ *	clock-not	bus word of odd clock is inverse of the one of even clock before it
+ *
+ * Kernels are instantiated per pattern and bus width and picked from tables when the pattern is parsed, so fill loops
+ * don`t branch on pattern. Streams begin at a sector, so buffers passed in are aligned to bus word of two clocks.
+ */
+enum pattern_lane_op {
+	PATTERN_LANE_NONE,
+	PATTERN_HL_SAME,
+	PATTERN_HL_NOT,
+	PATTERN_CLOCK_NOT,
+	PATTERN_NLANE_OP,
+};
+
+static const char *pattern_base_name[PATTERN_NBASE] = {
+	[PATTERN_RANDOM] = "random",
+	[PATTERN_SOLID] = "solid",
+	[PATTERN_INC] = "inc",
+	[PATTERN_INC_BYTE] = "inc-byte",
+	[PATTERN_WALK1] = "walk1",
+	[PATTERN_WALK0] = "walk0",
+	[PATTERN_CHECKER] = "checker",
+	[PATTERN_PRBS7] = "prbs7",
+	[PATTERN_PRBS15] = "prbs15",
+	[PATTERN_PRBS31] = "prbs31",
+};
+
+static const char *pattern_lane_name[PATTERN_NLANE_OP] = {
+	[PATTERN_HL_SAME] = "hl-same",
+	[PATTERN_HL_NOT] = "hl-not",
+	[PATTERN_CLOCK_NOT] = "clock-not",
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* base kernels of bus word patterns, width is constant in every instance so division is a shift */
+#define	DEFINE_WORD_KERNEL(name, width, expr)						\
+static void name(struct pattern_stream *ps, __u8 *buf, int count)			\
+{											\
+	int i;										\
+	__u32 k, v;									\
+											\
+	for (i = 0; i < count; i++) {							\
+		k = (ps->pos + i) / (width);						\
+		v = (expr);								\
+		buf[i] = v >> (8 * ((ps->pos + i) % (width)));				\
+	}										\
+	ps->pos += count;								\
+}
+
+DEFINE_WORD_KERNEL(fill_inc8, 1, k)
+DEFINE_WORD_KERNEL(fill_inc16, 2, k)
+DEFINE_WORD_KERNEL(fill_walk1_8, 1, 1U << ((k + ps->page) % 8))
+DEFINE_WORD_KERNEL(fill_walk1_16, 2, 1U << ((k + ps->page) % 16))
+DEFINE_WORD_KERNEL(fill_walk0_8, 1, ~(1U << ((k + ps->page) % 8)))
+DEFINE_WORD_KERNEL(fill_walk0_16, 2, ~(1U << ((k + ps->page) % 16)))
+DEFINE_WORD_KERNEL(fill_checker8, 1, ((k + ps->page) & 0x01) ? 0xAA : 0x55)
+DEFINE_WORD_KERNEL(fill_checker16, 2, ((k + ps->page) & 0x01) ? 0xAAAA : 0x5555)
+
+/* sector_size is multiple of 256, so byte index of data in page is the one in sector */
+static void fill_inc_byte(struct pattern_stream *ps, __u8 *buf, int count)
+{
+	int i;
+	__u32 pos;
+
+	for (i = 0; i < count; i++) {
+		pos = ps->pos + i;
+		buf[i] = (pos < ps->sector_size) ? pos : ps->sector * METADATA_SIZE + pos - ps->sector_size;
+	}
+	ps->pos += count;
+}
+
+static void fill_solid(struct pattern_stream *ps, __u8 *buf, int count)
+{
+	memset(buf, ps->pt->solid, count);
+	ps->pos += count;
+}
+
+/*
+ * PRBS of s[n] = s[n-a] ^ s[n-b]: the b bits after history are known at once, hist keeps the latest bits with the
+ * newest at bit 0 and acc the bits not output yet
+ */
+static inline void prbs_fill(struct pattern_stream *ps, __u8 *buf, int count, const int a, const int b)
+{
+	int i;
+	__u64 bits;
+
+	for (i = 0; i < count; i++) {
+		while (ps->nacc < 8) {
+			bits = ((ps->hist >> (a - b)) ^ ps->hist) & ((1ULL << b) - 1);
+			ps->hist = (ps->hist << b) | bits;
+			ps->acc = (ps->acc << b) | bits;
+			ps->nacc += b;
+		}
+		ps->nacc -= 8;
+		buf[i] = ps->acc >> ps->nacc;
+	}
+	ps->pos += count;
+}
+
+#define	DEFINE_PRBS_KERNEL(n, a, b)							\
+static void fill_prbs##n(struct pattern_stream *ps, __u8 *buf, int count)		\
+{											\
+	prbs_fill(ps, buf, count, a, b);						\
+}
+
+DEFINE_PRBS_KERNEL(7, 7, 6)
+DEFINE_PRBS_KERNEL(15, 15, 14)
+DEFINE_PRBS_KERNEL(31, 31, 28)
+
+/* [base][bus width - 1], PRBS is a serial stream so it doesn`t depend on width */
+static const pattern_fill_fn pattern_kernel[PATTERN_NBASE][2] = {
+	[PATTERN_SOLID] = {fill_solid, fill_solid},
+	[PATTERN_INC] = {fill_inc8, fill_inc16},
+	[PATTERN_INC_BYTE] = {fill_inc_byte, fill_inc_byte},
+	[PATTERN_WALK1] = {fill_walk1_8, fill_walk1_16},
+	[PATTERN_WALK0] = {fill_walk0_8, fill_walk0_16},
+	[PATTERN_CHECKER] = {fill_checker8, fill_checker16},
+	[PATTERN_PRBS7] = {fill_prbs7, fill_prbs7},
+	[PATTERN_PRBS15] = {fill_prbs15, fill_prbs15},
+	[PATTERN_PRBS31] = {fill_prbs31, fill_prbs31},
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* lane kernels rewrite odd byte or odd bus word from the one before it */
+static void lane_hl_same(__u8 *buf, int count)
+{
+	int i;
+
+	for (i = 1; i < count; i += 2)
+		buf[i] = buf[i - 1];
+}
+
+static void lane_hl_not(__u8 *buf, int count)
+{
+	int i;
+
+	for (i = 1; i < count; i += 2)
+		buf[i] = ~buf[i - 1];
+}
+
+static void lane_clock_not16(__u8 *buf, int count)
+{
+	int i;
+
+	for (i = 2; i + 1 < count; i += 4) {
+		buf[i] = ~buf[i - 2];
+		buf[i + 1] = ~buf[i - 1];
+	}
+}
+
+/* on 8bit bus a clock is one byte, so clock-not is hl-not. hl modifiers run before clock-not */
+static const pattern_lane_fn pattern_lane_kernel[PATTERN_NLANE_OP][2] = {
+	[PATTERN_HL_SAME] = {lane_hl_same, lane_hl_same},
+	[PATTERN_HL_NOT] = {lane_hl_not, lane_hl_not},
+	[PATTERN_CLOCK_NOT] = {lane_hl_not, lane_clock_not16},
+};
+
+static void invert_buf(__u8 *buf, int count)
+{
+	int i;
+	__u64 x;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		memcpy(&x, buf + i, 8);
+		x = ~x;
+		memcpy(buf + i, &x, 8);
+	}
+	for (; i < count; i++)
+		buf[i] = ~buf[i];
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+static int find_name(const char **names, int n, char *s)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (NULL != names[i] && !strcmp(names[i], s))
+			return i;
+	}
+	return -1;
+}
+
+/* spec is base[:XX][,modifier]..., kernels are picked for bus width of dev. Return NULL if spec is invalid */
+struct pattern *parse_pattern(struct shannon_dev *dev, const char *spec)
+{
+	int width = dev->iowidth - dev->valid_8bit;
+	char buf[128], *s, *arg, *save;
+	struct pattern *pt;
+	int op, slot;
+
+	assert(1 == width || 2 == width);
+
+	if (strlen(spec) >= sizeof(buf))
+		return NULL;
+	strcpy(buf, spec);
+
+	pt = zmalloc(sizeof(*pt));
+	if (NULL == pt)
+		return NULL;
+
+	s = strtok_r(buf, ",", &save);
+	if (NULL == s)
+		goto free_out;
+	if (NULL != (arg = strchr(s, ':')))
+		*arg++ = '\0';
+
+	pt->base = find_name(pattern_base_name, PATTERN_NBASE, s);
+	if (pt->base < 0 || (NULL != arg) != (PATTERN_SOLID == pt->base))
+		goto free_out;
+	if (NULL != arg)
+		pt->solid = strtoul(arg, NULL, 16);
+
+	while (NULL != (s = strtok_r(NULL, ",", &save))) {
+		if (!strcmp(s, "inverse")) {
+			pt->inverse = 1;
+			continue;
+		}
+		op = find_name(pattern_lane_name, PATTERN_NLANE_OP, s);
+		if (op < 0)
+			goto free_out;
+		slot = (PATTERN_CLOCK_NOT == op) ? 1 : 0;
+		if (NULL != pt->lane[slot] && pattern_lane_kernel[op][width - 1] != pt->lane[slot])
+			goto free_out;
+		pt->lane[slot] = pattern_lane_kernel[op][width - 1];
+	}
+
+	pt->fill = pattern_kernel[pt->base][width - 1];
+	return pt;
+
+free_out:
+	free(pt);
+	return NULL;
+}
+
+/* key seeds PRBS, page moves walking and checker patterns */
+void pattern_stream_init(struct pattern_stream *ps, const struct pattern *pt, __u32 key, int page, int sector, int sector_size)
+{
+	memset(ps, 0x00, sizeof(*ps));
+	ps->pt = pt;
+	ps->page = page;
+	ps->sector = sector;
+	ps->sector_size = sector_size;
+	ps->hist = key | 0x01;	/* PRBS state must not be 0 */
+}
+
+void pattern_stream_fill(struct pattern_stream *ps, void *buf, int count)
+{
+	ps->pt->fill(ps, buf, count);
+}
+
+/* modifiers, run on the base stream of any generator */
+void pattern_modify(const struct pattern *pt, void *buf, int count, int invert)
+{
+	if (NULL != pt->lane[0])
+		pt->lane[0](buf, count);
+	if (NULL != pt->lane[1])
+		pt->lane[1](buf, count);
+	if (invert)
+		invert_buf(buf, count);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * tR is tens of us, tPROG is hundreds of us and tBERS is ms, so each class spins and sleeps in its own range.
+ */
+static const struct poll_policy default_poll_policy[POLL_NCLASS] = {
+	[POLL_READ]	= { 30000,	2000,	16000 },
+	[POLL_PROGRAM]	= { 20000,	20000,	160000 },
+	[POLL_ERASE]	= { 0,		200000,	1000000 },
+};
+
+/* spin_us < 0 keeps default spin window of every class */
+void init_poll_policy(struct shannon_dev *dev, int spin_us)
+{
+	int class;
+
+	memcpy(dev->poll_policy, default_poll_policy, sizeof(default_poll_policy));
+
+	if (spin_us >= 0) {
+		for (class = 0; class < POLL_NCLASS; class++)
+			dev->poll_policy[class].spin_ns = spin_us * 1000L;
+	}
+}
+
+static int opcode_poll_class(int opcode)
+{
+	switch (opcode) {
+	case sh_erase_cmd:
+		return POLL_ERASE;
+	case sh_write_cmd:
+	case sh_bufwrite_cmd:
+	case sh_writereg_cmd:
+	case sh_raidwrite_cmd:
+		return POLL_PROGRAM;
+	default:
+		return POLL_READ;
+	}
+}
+
+int poll_class_lun(struct shannon_dev *dev, int lun)
+{
+	int class = POLL_READ;
+	struct shannon_request *req;
+
+	list_for_each_entry(req, &dev->lun[lun].req_listhead, lun_list) {
+		if (opcode_poll_class(req->opcode) > class)
+			class = opcode_poll_class(req->opcode);
+	}
+
+	return class;
+}
+
+int poll_class_bufhead(struct shannon_dev *dev, int head)
+{
+	int class = POLL_READ;
+	struct shannon_request *req;
+
+	list_for_each_entry(req, &dev->bufhead[head].req_listhead, bufhead_list) {
+		if (opcode_poll_class(req->opcode) > class)
+			class = opcode_poll_class(req->opcode);
+	}
+
+	return class;
+}
+
+void poll_start(struct shannon_dev *dev, struct poll_state *ps, int class, struct poll_stats *stats)
+{
+	ps->policy = &dev->poll_policy[class];
+	ps->stats = stats;
+	ps->start_ns = now_ns();
+	ps->deadline_ns = ps->start_ns + POLL_NS_TIMEOUT;
+	ps->sleep_ns = 0;
+	ps->slept_ns = 0;
+	ps->nsleep = 0;
+}
+
+/*
+ * called each time hw is found not done yet, return ERR if nothing is completed for POLL_NS_TIMEOUT
+ */
+int poll_wait(struct poll_state *ps)
+{
+	long long now, end;
+	struct timespec ts;
+
+	now = now_ns();
+	if (now > ps->deadline_ns)
+		return ERR;
+
+	if (!ps->sleep_ns) {
+		if (now - ps->start_ns < ps->policy->spin_ns) {
+			cpu_relax();
+			return 0;
+		}
+		ps->sleep_ns = ps->policy->min_sleep_ns;
+	}
+
+	ts.tv_sec = ps->sleep_ns / 1000000000L;
+	ts.tv_nsec = ps->sleep_ns % 1000000000L;
+	nanosleep(&ts, NULL);
+	end = now_ns();
+
+	ps->slept_ns += end - now;
+	ps->nsleep++;
+	ps->sleep_ns = (2 * ps->sleep_ns < ps->policy->max_sleep_ns) ? 2 * ps->sleep_ns : ps->policy->max_sleep_ns;
+
+	return 0;
+}
+
+/* called when some request is completed while waiting, so a long batch going on isn`t taken as hung */
+void poll_progress(struct poll_state *ps)
+{
+	ps->deadline_ns = now_ns() + POLL_NS_TIMEOUT;
+}
+
+void poll_end(struct poll_state *ps)
+{
+	ps->stats->npoll++;
+	ps->stats->nsleep += ps->nsleep;
+	ps->stats->sleep_ns += ps->slept_ns;
+	ps->stats->spin_ns += now_ns() - ps->start_ns - ps->slept_ns;
+}
+
+static void pr_one_poll_stats(char *name, int id, struct poll_stats *stats)
+{
+	printf("%s-%d: poll=%ld spin=%ldus sleep=%ldus nsleep=%ld\n", name, id, stats->npoll,
+		stats->spin_ns / 1000, stats->sleep_ns / 1000, stats->nsleep);
+}
+
+void pr_poll_stats(struct shannon_dev *dev)
+{
+	int lun, head;
+	struct poll_stats total;
+
+	memset(&total, 0x00, sizeof(total));
+
+	for (lun = 0; dev->lun != NULL && lun < dev->config->luns; lun++) {
+		if (!dev->lun[lun].poll_stats.npoll)
+			continue;
+		pr_one_poll_stats("lun", lun, &dev->lun[lun].poll_stats);
+		total.npoll += dev->lun[lun].poll_stats.npoll;
+		total.nsleep += dev->lun[lun].poll_stats.nsleep;
+		total.spin_ns += dev->lun[lun].poll_stats.spin_ns;
+		total.sleep_ns += dev->lun[lun].poll_stats.sleep_ns;
+	}
+
+	for (head = 0; dev->bufhead != NULL && head < 2; head++) {
+		if (dev->bufhead[head].poll_stats.npoll)
+			pr_one_poll_stats("bufhead", head, &dev->bufhead[head].poll_stats);
+	}
+
+	printf("lun total: poll=%ld spin=%ldus sleep=%ldus nsleep=%ld\n", total.npoll,
+		total.spin_ns / 1000, total.sleep_ns / 1000, total.nsleep);
+
+	if (dev->full_poll_stats.npoll)
+		printf("full thread: poll=%ld spin=%ldus sleep=%ldus nsleep=%ld deferred=%ld\n", dev->full_poll_stats.npoll,
+			dev->full_poll_stats.spin_ns / 1000, dev->full_poll_stats.sleep_ns / 1000, dev->full_poll_stats.nsleep, dev->ndefer);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "tool.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && !BE_ARCH
+#include <arm_neon.h>
+#endif
+
+#define	PRNG_VERIFY_BLOCK	512	/* sector is regenerated and compared by this, so memory doesn`t grow with sector */
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * sector pattern of super-write/super-read, addressed by (seed, lun, ppa, sector) so any sector can be generated alone.
+ *
+ * PRNG_RAND: the byte stream of srand(sector_seed) then rand() per byte, which is what data on flash written by older
+ *	tools holds. glibc random_r() is replayed on a private state, so it takes no lock and no call per byte.
+ * PRNG_CTR: counter based, word j of a sector is a 32bit hash of (sector key + j), lanes are independent so it is
+ *	filled 32 bytes per step by AVX2 or NEON. Words are stored little endian, so a pattern does not depend on host.
+ *
+ * With a test pattern of pattern.c the sector is filled by its kernel instead, unless it is PATTERN_RANDOM, and then
+ * its modifiers are run. For inverse, odd page is generated as the page before it and inverted.
+ */
+struct rand_compat {
+	int state[31];
+	int f;
+	int r;
+};
+
+struct prng_stream {
+	int mode;
+	struct rand_compat rc;	/* PRNG_RAND */
+	__u32 key;		/* PRNG_CTR, and counter of next word */
+	__u32 j;
+	const struct pattern *pt;
+	struct pattern_stream pat;
+	int invert;
+};
+
+static inline __u32 rand_compat_next(struct rand_compat *rc)
+{
+	__u32 val = rc->state[rc->f] += (__u32)rc->state[rc->r];
+
+	if (++rc->f >= 31)
+		rc->f = 0;
+	if (++rc->r >= 31)
+		rc->r = 0;
+	return val >> 1;
+}
+
+/* same as srandom_r() of glibc with TYPE_3 state */
+static void rand_compat_seed(struct rand_compat *rc, unsigned int seed)
+{
+	int i, word, hi, lo;
+
+	if (0 == seed)
+		seed = 1;
+	rc->state[0] = word = seed;
+	for (i = 1; i < 31; i++) {
+		hi = word / 127773;
+		lo = word % 127773;
+		word = 16807 * lo - 2836 * hi;
+		if (word < 0)
+			word += 2147483647;
+		rc->state[i] = word;
+	}
+
+	rc->f = 3;
+	rc->r = 0;
+	for (i = 0; i < 310; i++)
+		rand_compat_next(rc);
+}
+
+static void rand_compat_fill(struct rand_compat *rc, __u8 *buf, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		buf[i] = rand_compat_next(rc);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+#define	CTR_GOLDEN	0x9E3779B9U
+#define	CTR_MUL1	0x7FEB352DU
+#define	CTR_MUL2	0x846CA68BU
+
+static inline __u32 ctr_mix(__u32 x)
+{
+	x ^= x >> 16;
+	x *= CTR_MUL1;
+	x ^= x >> 15;
+	x *= CTR_MUL2;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline __u32 ctr_sector_key(int seed, int lun, __u32 sector_index)
+{
+	return ctr_mix(ctr_mix(ctr_mix(seed) ^ (lun * CTR_GOLDEN)) ^ sector_index);
+}
+
+/* fill nword words from counter j, return words filled */
+static int ctr_fill_scalar(__u32 *buf, int nword, __u32 key, __u32 j)
+{
+	int i;
+
+	for (i = 0; i < nword; i++)
+		buf[i] = cpu_to_le32(ctr_mix(key + (j + i) * CTR_GOLDEN));
+	return nword;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline __m256i ctr_mix_avx2(__m256i x)
+{
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(CTR_MUL1));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(CTR_MUL2));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	return x;
+}
+
+__attribute__((target("avx2")))
+static int ctr_fill_avx2(__u32 *buf, int nword, __u32 key, __u32 j)
+{
+	int i;
+	__m256i ctr, step = _mm256_set1_epi32(8 * CTR_GOLDEN);
+
+	ctr = _mm256_mullo_epi32(_mm256_setr_epi32(j, j + 1, j + 2, j + 3, j + 4, j + 5, j + 6, j + 7), _mm256_set1_epi32(CTR_GOLDEN));
+	ctr = _mm256_add_epi32(ctr, _mm256_set1_epi32(key));
+
+	for (i = 0; i + 8 <= nword; i += 8) {
+		_mm256_storeu_si256((__m256i *)(buf + i), ctr_mix_avx2(ctr));
+		ctr = _mm256_add_epi32(ctr, step);
+	}
+	return i;
+}
+
+static int ctr_fill_vector(__u32 *buf, int nword, __u32 key, __u32 j)
+{
+	return cpu_has_avx2() ? ctr_fill_avx2(buf, nword, key, j) : 0;
+}
+#elif defined(__aarch64__) && !BE_ARCH
+static inline uint32x4_t ctr_mix_neon(uint32x4_t x)
+{
+	x = veorq_u32(x, vshrq_n_u32(x, 16));
+	x = vmulq_n_u32(x, CTR_MUL1);
+	x = veorq_u32(x, vshrq_n_u32(x, 15));
+	x = vmulq_n_u32(x, CTR_MUL2);
+	x = veorq_u32(x, vshrq_n_u32(x, 16));
+	return x;
+}
+
+static int ctr_fill_vector(__u32 *buf, int nword, __u32 key, __u32 j)
+{
+	int i;
+	__u32 init[4] = {j, j + 1, j + 2, j + 3};
+	uint32x4_t c0, c1, step = vdupq_n_u32(8 * CTR_GOLDEN);
+
+	c0 = vaddq_u32(vmulq_n_u32(vld1q_u32(init), CTR_GOLDEN), vdupq_n_u32(key));
+	c1 = vaddq_u32(c0, vdupq_n_u32(4 * CTR_GOLDEN));
+
+	for (i = 0; i + 8 <= nword; i += 8) {
+		vst1q_u32(buf + i, ctr_mix_neon(c0));
+		vst1q_u32(buf + i + 4, ctr_mix_neon(c1));
+		c0 = vaddq_u32(c0, step);
+		c1 = vaddq_u32(c1, step);
+	}
+	return i;
+}
+#else
+static int ctr_fill_vector(__u32 *buf, int nword, __u32 key, __u32 j)
+{
+	return 0;
+}
+#endif
+
+/* count is multiple of 4, which sector size and METADATA_SIZE are */
+static void ctr_fill(void *buf, int count, __u32 key, __u32 j)
+{
+	int n;
+
+	assert(0 == (count & 0x03));
+	n = ctr_fill_vector(buf, count / 4, key, j);
+	ctr_fill_scalar((__u32 *)buf + n, count / 4 - n, key, j + n);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+int parse_prng_mode(char *s)
+{
+	if (!strcmp(s, "rand"))
+		return PRNG_RAND;
+	if (!strcmp(s, "ctr"))
+		return PRNG_CTR;
+	return -1;
+}
+
+/* stream of sector (seed, lun, ppa, sector), data bytes then metadata bytes */
+static void prng_stream_init(struct shannon_dev *dev, struct prng_stream *ps, const struct pattern *pt, int seed, int lun, int ppa, int sector)
+{
+	int page = ppa % dev->flash->npage;
+	int sector_index;
+
+	ps->pt = pt;
+	ps->invert = 0;
+	if (NULL != pt && pt->inverse && (page & 0x01)) {
+		ps->invert = 1;
+		ppa--;
+		page--;
+	}
+	sector_index = ppa * dev->config->page_nsector + sector;
+
+	ps->mode = dev->prng_mode;
+	if (NULL != pt && NULL != pt->fill) {
+		pattern_stream_init(&ps->pat, pt, ctr_sector_key(seed, lun, sector_index), page, sector, dev->config->sector_size);
+	} else if (PRNG_CTR == ps->mode) {
+		ps->key = ctr_sector_key(seed, lun, sector_index);
+		ps->j = 0;
+	} else {
+		rand_compat_seed(&ps->rc, sector_index + ((lun + seed)<<24));
+	}
+}
+
+/* count is multiple of 4 except the last piece of stream */
+static void prng_stream_fill(struct prng_stream *ps, void *buf, int count)
+{
+	if (NULL != ps->pt && NULL != ps->pt->fill) {
+		pattern_stream_fill(&ps->pat, buf, count);
+	} else if (PRNG_CTR == ps->mode) {
+		ctr_fill(buf, count, ps->key, ps->j);
+		ps->j += count / 4;
+	} else {
+		rand_compat_fill(&ps->rc, buf, count);
+	}
+
+	if (NULL != ps->pt)
+		pattern_modify(ps->pt, buf, count, ps->invert);
+}
+
+/*
+ * fill one sector of data then its metadata QW, metadata continues the stream of data. In PRNG_RAND mode it is the same
+ * as srand(sector_seed) followed by pad_rand() of both.
+ */
+void prng_fill_sector(struct shannon_dev *dev, int seed, int lun, int ppa, int sector, void *data, void *metadata)
+{
+	struct prng_stream ps;
+
+	prng_stream_init(dev, &ps, dev->pattern, seed, lun, ppa, sector);
+	prng_stream_fill(&ps, data, dev->config->sector_size);
+	prng_stream_fill(&ps, metadata, METADATA_SIZE);
+}
+
+/* fill every sector of a write request, pt is NULL for generator of --prng */
+void prng_fill_request(struct shannon_dev *dev, const struct pattern *pt, int seed, struct shannon_request *req)
+{
+	int i;
+	struct prng_stream ps;
+
+	for (i = 0; i < req->nsector; i++) {
+		prng_stream_init(dev, &ps, pt, seed, req->lun, req->ppa, req->bsector + i);
+		prng_stream_fill(&ps, req->data + i * dev->config->sector_size, dev->config->sector_size);
+		prng_stream_fill(&ps, req->metadata + i, METADATA_SIZE);
+	}
+}
+
+/* compare with regenerated pattern by PRNG_VERIFY_BLOCK, first different byte is looked for only once */
+static int prng_verify_piece(struct prng_stream *ps, __u8 *buf, int count, int off, struct sector_verify *sv)
+{
+	int n, i, nbit, total = 0;
+	__u8 expect[PRNG_VERIFY_BLOCK];
+
+	for (; count > 0; buf += n, off += n, count -= n) {
+		n = (count < PRNG_VERIFY_BLOCK) ? count : PRNG_VERIFY_BLOCK;
+		prng_stream_fill(ps, expect, n);
+
+		nbit = xor_popcount(expect, buf, n);
+		if (nbit && sv->first_off < 0) {
+			for (i = 0; expect[i] == buf[i]; i++)
+				;
+			sv->first_off = off + i;
+			sv->first_expect = expect[i];
+			sv->first_read = buf[i];
+		}
+		total += nbit;
+	}
+	return total;
+}
+
+/*
+ * check a sector read back against (seed, lun, ppa, sector), flipped bits of every codeword go to sv->cw_nbit, of
+ * metadata to sv->meta_nbit. Return flipped bits of the sector
+ */
+int prng_verify_sector(struct shannon_dev *dev, int seed, int lun, int ppa, int sector, void *data, void *metadata,
+	struct sector_verify *sv)
+{
+	int cw, begin, end;
+	struct prng_stream ps;
+
+	assert(dev->config->sector_ncodeword <= MAX_SECTOR_NCODEWORD);
+
+	memset(sv, 0x00, sizeof(*sv));
+	sv->first_off = -1;
+	prng_stream_init(dev, &ps, dev->pattern, seed, lun, ppa, sector);
+
+	for (cw = begin = 0; cw < dev->config->sector_ncodeword; cw++, begin = end) {
+		end = codeword_data_end(dev, cw);
+		sv->cw_nbit[cw] = prng_verify_piece(&ps, (__u8 *)data + begin, end - begin, begin, sv);
+		sv->nbit += sv->cw_nbit[cw];
+		if (sv->cw_nbit[cw] > sv->max_cw_nbit)
+			sv->max_cw_nbit = sv->cw_nbit[cw];
+	}
+
+	sv->meta_nbit = prng_verify_piece(&ps, metadata, METADATA_SIZE, dev->config->sector_size, sv);
+	sv->nbit += sv->meta_nbit;
+	return sv->nbit;
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
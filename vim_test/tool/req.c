@@ -14,9 +14,10 @@
 struct shannon_request *alloc_request_no_dma(struct shannon_dev *dev, enum shannon_cmd opcode,
 					     int lun, int ppa, int head, int bsector, int nsector, int no_dma)
 {
+	int inline_buf;
 	struct shannon_request *req;
 
-	req = zmalloc(sizeof(*req));
+	req = get_slab_request(dev);
 	if (NULL == req)
 		goto out;
 	req->opcode = opcode;
@@ -28,14 +29,16 @@ struct shannon_request *alloc_request_no_dma(struct shannon_dev *dev, enum shann
 	req->dev = dev;
 	req->bfree = 1;
 	req->rw_entire_buffer = 0;
-	req->no_dma = no_dma;
+	req->no_dma = (REQ_NO_DMA == no_dma);
 	req->data = NULL;
 	req->metadata = NULL;
+	req->dma_slot = -1;
 	INIT_LIST_HEAD(&req->list);
 	INIT_LIST_HEAD(&req->run_list);
 	INIT_LIST_HEAD(&req->chunk_list);
 	INIT_LIST_HEAD(&req->lun_list);
 	INIT_LIST_HEAD(&req->mem_listhead);
+	INIT_LIST_HEAD(&req->set_list);
 
 	req->block = req->ppa / dev->flash->npage;
 	req->page = req->ppa % dev->flash->npage;
@@ -50,12 +53,30 @@ struct shannon_request *alloc_request_no_dma(struct shannon_dev *dev, enum shann
 	if (sh_write_cmd == opcode || sh_cacheread_cmd == opcode
 			|| sh_bufwrite_cmd == opcode || sh_bufread_cmd == opcode) {
 
-		if (nsector && !no_dma) {
-			req->data = malloc(req->nsector * dev->config->sector_size);
+		if (nsector && !req->no_dma) {
+			inline_buf = (nsector * (dev->config->sector_size + METADATA_SIZE) <= dev->req_slab.bufsize);
+			if (!inline_buf)
+				dev->req_slab.fallback++;
+
+			if (REQ_DMA_MAPPED == no_dma && (sh_write_cmd == opcode || sh_cacheread_cmd == opcode))
+				req->dma_slot = get_dma_slot(dev);	/* fall back to REQ_DMA_COPY if no slot */
+
+			if (inline_buf && NULL == get_slab_buf(dev, req))
+				goto free_req_out;
+
+			if (req->dma_slot >= 0)
+				req->data = dma_slot_user_addr(dev, req->dma_slot);
+			else if (inline_buf)
+				req->data = req->slab_buf;
+			else
+				req->data = malloc(req->nsector * dev->config->sector_size);
 			if (NULL == req->data)
 				goto free_req_out;
 
-			req->metadata = malloc(req->nsector * METADATA_SIZE);
+			if (inline_buf)
+				req->metadata = (__u64 *)(req->slab_buf + nsector * dev->config->sector_size);
+			else
+				req->metadata = malloc(req->nsector * METADATA_SIZE);
 			if (NULL == req->metadata)
 				goto free_data_out;
 		}
@@ -73,9 +94,12 @@ struct shannon_request *alloc_request_no_dma(struct shannon_dev *dev, enum shann
 	return req;
 
 free_data_out:
-	free(req->data);
+	if (req->dma_slot >= 0)
+		put_dma_slot(dev, req->dma_slot);
+	else
+		free(req->data);
 free_req_out:
-	free(req);
+	put_slab_request(dev, req);
 out:
 	return NULL;
 }
@@ -83,7 +107,7 @@ out:
 struct shannon_request *alloc_request(struct shannon_dev *dev, enum shannon_cmd opcode,
 				      int lun, int ppa, int head, int bsector, int nsector)
 {
-	return alloc_request_no_dma(dev, opcode, lun, ppa, head, bsector, nsector, 0);
+	return alloc_request_no_dma(dev, opcode, lun, ppa, head, bsector, nsector, REQ_DMA_COPY);
 }
 
 static void raw_free_request(struct shannon_request *req)
@@ -92,13 +116,19 @@ static void raw_free_request(struct shannon_request *req)
 
 	list_for_each_entry_safe(mem, tmp, &req->mem_listhead, list) {
 		list_del(&mem->list);
-		req->dev->free_mem(req->dev, mem);
-		free(mem);
+		put_dma_mem(req->dev, mem);
+	}
+
+	if (req->dma_slot >= 0) {
+		if (req->data == dma_slot_user_addr(req->dev, req->dma_slot))
+			req->data = NULL;
+		put_dma_slot(req->dev, req->dma_slot);
 	}
 
-	if (req->metadata && req->bfree) free(req->metadata);
-	if (req->data && req->bfree) free(req->data);
-	free(req);
+	/* slab buffer goes back with the object */
+	if (req->metadata && req->bfree && !req_slab_owns(req, req->metadata)) free(req->metadata);
+	if (req->data && req->bfree && !req_slab_owns(req, req->data)) free(req->data);
+	put_slab_request(req->dev, req);
 }
 
 void free_request(struct shannon_request *req)
@@ -112,536 +142,756 @@ void free_request(struct shannon_request *req)
 	raw_free_request(req);
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------*/
 /*
- * Generate commands and pad them to cmdqueue according to req.
+ * request set: a per-block scan adds requests of one block with ppa relative to the block once, then every block
+ * only costs bind_req_set() and list_req_set() instead of alloc and free the whole graph.
  */
-static void pad_cmdqueue(struct shannon_dev *dev, struct shannon_request *req, void *cmddata, int ncmddata)
+void init_req_set(struct req_set *set, struct shannon_dev *dev)
 {
-	int i;
+	set->dev = dev;
+	set->nreq = 0;
+	INIT_LIST_HEAD(&set->req_listhead);
+}
 
-	if (req->bufcmd) {
-		for (i = 0; i < ncmddata; i += QW_SIZE) {
-			dev->write_mem(dev, dev->bufhead[req->head].cmdmem.kernel_addr + dev->bufhead[req->head].cmdhead, cmddata + i, QW_SIZE);
-			dev->bufhead[req->head].cmdhead = (dev->bufhead[req->head].cmdhead + QW_SIZE) % PAGE_SIZE;
-			dev->bufhead[req->head].cmdempty -= QW_SIZE;
-		}
+/*
+ * chunk_head_req != NULL adds a multi-plane sibling to its chunk_list, siblings are submitted with their chunk head
+ */
+struct shannon_request *req_set_add(struct req_set *set, struct shannon_request *chunk_head_req, enum shannon_cmd opcode,
+				    int lun, int ppa_off, int head, int bsector, int nsector, int no_dma)
+{
+	struct shannon_request *req;
+
+	req = alloc_request_no_dma(set->dev, opcode, lun, ppa_off, head, bsector, nsector, no_dma);
+	if (NULL == req)
+		return NULL;
+	req->set_ppa = ppa_off;
+
+	if (NULL != chunk_head_req)
+		list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
+	else
+		list_add_tail(&req->set_list, &set->req_listhead);
+	set->nreq++;
+
+	return req;
+}
+
+static void rebind_request(struct shannon_dev *dev, struct shannon_request *req, int ppa)
+{
+	assert(list_empty(&req->mem_listhead));	/* dma memory is put back on completion */
+
+	req->ppa = ppa + req->set_ppa;
+	req->block = req->ppa / dev->flash->npage;
+	req->page = req->ppa % dev->flash->npage;
+	if (dev->config->nplane > 1) {
+		req->chunk_block = req->block / dev->config->nplane;
+		req->chunk_plane = req->block % dev->config->nplane;
 	} else {
-		for (i = 0; i < ncmddata; i += QW_SIZE) {
-			dev->write_mem(dev, dev->lun[req->lun].thread->cmdmem.kernel_addr + dev->lun[req->lun].thread->cmdhead, cmddata + i, QW_SIZE);
-			dev->lun[req->lun].thread->cmdhead = (dev->lun[req->lun].thread->cmdhead + QW_SIZE) % PAGE_SIZE;
-			dev->lun[req->lun].thread->cmdempty -= QW_SIZE;
-		}
-		if (-1 == dev->lun[req->lun].head)
-			dev->lun[req->lun].head = req->cmdhead;
-		dev->lun[req->lun].tail = (req->cmdhead + ncmddata) % PAGE_SIZE;
-		dev->lun[req->lun].thread->req_count += (ncmddata / req->cmdlen);
+		req->chunk_block = req->block;
+		req->chunk_plane = 0;
 	}
+
+	/* completion and bookkeeping of last run, done callback is kept as set by the caller */
+	memset(req->ecc, 0x00, sizeof(req->ecc));
+	req->status = 0;
+	req->cmdhead = req->cmdlen = 0;
+	req->worker = NULL;
+	req->plane_merged = 0;
+	req->pe_counted = 0;
+	req->pe_chunk = NULL;
+	req->submit_ns = 0;
 }
 
-#if 0
-static void back_pad_cmdqueue(struct shannon_dev *dev, struct shannon_request *req)
+/* rebind every request to ppa and clear completion left by last run */
+void bind_req_set(struct req_set *set, int ppa)
 {
-	int i;
-	__u64 data = 0x00;
+	struct shannon_request *req, *sub;
 
-	if (req->bufcmd) {
-		for (i = 0; i < req->cmdlen; i += QW_SIZE)
-			dev->write_mem(dev, dev->bufhead[req->head].cmdmem.kernel_addr + (req->cmdhead + i)%PAGE_SIZE, &data, QW_SIZE);
-	} else {
-		for (i = 0; i < req->cmdlen; i += QW_SIZE)
-			dev->write_mem(dev, dev->lun[req->lun].cmdmem.kernel_addr + (req->cmdhead + i)%PAGE_SIZE, &data, QW_SIZE);
+	list_for_each_entry(req, &set->req_listhead, set_list) {
+		rebind_request(set->dev, req, ppa);
+		list_for_each_entry(sub, &req->chunk_list, chunk_list)
+			rebind_request(set->dev, sub, ppa);
 	}
 }
-#else
-static void back_pad_cmdqueue(struct shannon_dev *dev, struct shannon_request *req) {}
-#endif
 
-int submit_request(struct shannon_request *req)
+/* link requests to req_head by req->list in order of adding, luns set in skip_luns are left out if it isn`t NULL */
+void list_req_set(struct req_set *set, struct list_head *req_head, unsigned long *skip_luns)
 {
-	int i, cmdlen, plane, nplane, rc;
-	void *cmddata;
-	int ncmddata;
-	struct list_head tmp_chunk_head;
-	struct shannon_request *tmp;
-	struct memory *mem;
-	struct shannon_dev *dev = req->dev;
+	struct shannon_request *req;
 
-	struct sh_reset *sh_reset;
-	struct sh_readid *sh_readid;
-	struct sh_writereg *sh_writereg;
-	struct sh_erase *sh_erase;
-	struct sh_preread *sh_preread;
-	struct sh_cacheread *sh_cacheread;
-	struct sh_write *sh_write;
-	struct sh_raidinit *sh_raidinit;
-	struct sh_raidwrite *sh_raidwrite;
-	struct sh_bufwrite *sh_bufwrite;
+	list_for_each_entry(req, &set->req_listhead, set_list) {
+		if (NULL != skip_luns && test_bit(req->lun, skip_luns))
+			continue;
+		list_add_tail(&req->list, req_head);
+	}
+}
 
-	rc = 0;
-	plane = 0;
-	nplane = list_empty(&req->chunk_list) ? 1 : dev->config->nplane;
-	assert(nplane == 1 || nplane == 2 || nplane == 4 || nplane == 8);
+/* same as list_req_set() but fill reqs[] which has room for nreq of set, return number of them */
+int array_req_set(struct req_set *set, struct shannon_request **reqs, unsigned long *skip_luns)
+{
+	int n = 0;
+	struct shannon_request *req;
 
-	INIT_LIST_HEAD(&tmp_chunk_head);
+	list_for_each_entry(req, &set->req_listhead, set_list) {
+		if (NULL != skip_luns && test_bit(req->lun, skip_luns))
+			continue;
+		reqs[n++] = req;
+	}
+	return n;
+}
 
-	switch (req->opcode) {
-	case sh_reset_cmd:
-		cmdlen = sizeof(*sh_reset);
-		if (cmdlen > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+void free_req_set(struct req_set *set)
+{
+	struct shannon_request *req, *tmp;
 
-		sh_reset = zmalloc(cmdlen);
-		if (NULL == sh_reset) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_reset;
-		ncmddata = cmdlen;
+	list_for_each_entry_safe(req, tmp, &set->req_listhead, set_list) {
+		list_del(&req->set_list);
+		free_request(req);
+	}
+	set->nreq = 0;
+}
 
-		sh_reset->opcode = sh_reset_cmd;
-		sh_reset->lun = dev->lun[req->lun].phylun;
+/*
+ * Copy ncmddata bytes to cmdqueue at cmdhead, commands run over the end of page are split into two spans.
+ * mmaped cmdqueue is filled by memcpy, otherwise both spans go to kernel by one write_mem_v.
+ */
+static void copy_to_cmdqueue(struct shannon_dev *dev, void *cmdq, void *cmdq_kernel, int cmdhead, void *cmddata, int ncmddata)
+{
+	int len, niov;
+	struct shannon_iovec iov[2];
 
-		req->cmdlen = cmdlen;
-		req->cmdhead = dev->lun[req->lun].thread->cmdhead;
-		break;
-
-	case sh_readid_cmd:
-		cmdlen = sizeof(*sh_readid);
-		if (cmdlen > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+	len = (ncmddata < PAGE_SIZE - cmdhead) ? ncmddata : PAGE_SIZE - cmdhead;
 
-		sh_readid = zmalloc(cmdlen);
-		if (NULL == sh_readid) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_readid;
-		ncmddata = cmdlen;
+	if (NULL != cmdq) {
+		memcpy(cmdq + cmdhead, cmddata, len);
+		if (ncmddata > len)
+			memcpy(cmdq, cmddata + len, ncmddata - len);
+		return;
+	}
+
+	niov = 0;
+	set_iovec(&iov[niov++], cmdq_kernel + cmdhead, cmddata, len);
+	if (ncmddata > len)
+		set_iovec(&iov[niov++], cmdq_kernel, cmddata + len, ncmddata - len);
+	dev->write_mem_v(dev, iov, niov);
+}
+
+/*
+ * Per-opcode encoders, each fills one command at cmd which is zeroed already. cmd is the ring slot itself if the ring is
+ * mmaped and commands don`t wrap, otherwise it is cmdbuf of the ring. req is the chunk head, sub is the plane encoded.
+ */
+typedef int (*cmd_encoder_t)(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			     void *cmd, struct shannon_iovec *iov, int *niov);
+
+static int encode_reset(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct sh_reset *sh_reset = cmd;
 
-		sh_readid->opcode = sh_readid_cmd;
-		sh_readid->lun = dev->lun[req->lun].phylun;
+	sh_reset->opcode = sh_reset_cmd;
+	sh_reset->lun = dev->lun[req->lun].phylun;
+	return 0;
+}
+
+static int encode_readid(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			 void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct sh_readid *sh_readid = cmd;
+
+	sh_readid->opcode = sh_readid_cmd;
+	sh_readid->lun = dev->lun[req->lun].phylun;
 #if 1
-		sh_readid->addr = 0x00;		// read id
-		sh_readid->cmd = 0x90;
-		sh_readid->nbyte = 8;
+	sh_readid->addr = 0x00;		// read id
+	sh_readid->cmd = 0x90;
+	sh_readid->nbyte = 8;
 #else
-		sh_readid->addr = 0x10;		// read feature
-		sh_readid->cmd = 0xEE;
-		sh_readid->nbyte = 4;
+	sh_readid->addr = 0x10;		// read feature
+	sh_readid->cmd = 0xEE;
+	sh_readid->nbyte = 4;
 #endif
+	return 0;
+}
 
-		req->cmdlen = cmdlen;
-		req->cmdhead = dev->lun[req->lun].thread->cmdhead;
-		break;
-
-	case sh_writereg_cmd:
-		cmdlen = sizeof(*sh_writereg) + ((req->wr_flash_reg_nbyte > 1) ? 8 : 0);
-		if (cmdlen > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+static int encode_writereg(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			   void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	memcpy(cmd, req->direct_cmdqueue, req->cmdlen);
+	return 0;
+}
 
-		sh_writereg = zmalloc(cmdlen);
-		if (NULL == sh_writereg) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_writereg;
-		ncmddata = cmdlen;
+static int encode_erase(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct sh_erase *sh_erase = cmd;
 
-		memcpy(sh_writereg, req->direct_cmdqueue, cmdlen);
+	sh_erase->opcode = sh_erase_cmd;
+	sh_erase->head = sub->head;
+	sh_erase->ppa = cpu_to_le32(sub->ppa | (dev->lun[req->lun].phylun << 24));
+	return 0;
+}
 
-		req->cmdlen = cmdlen;
-		req->cmdhead = dev->lun[req->lun].thread->cmdhead;
-		break;
-
-	case sh_erase_cmd:
-		cmdlen = sizeof(*sh_erase);
-		if (cmdlen * nplane > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+static int encode_preread(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			  void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct sh_preread *sh_preread = cmd;
 
-		sh_erase = zmalloc(cmdlen * nplane);
-		if (NULL == sh_erase) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
+	sh_preread->opcode = sh_preread_cmd;
+	sh_preread->head = sub->head;
+	sh_preread->ppa = cpu_to_le32(sub->ppa | (dev->lun[req->lun].phylun << 24));
+	return 0;
+}
+
+static int encode_cacheread(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			    void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	int i;
+	struct memory *mem;
+	struct sh_cacheread *sh_cacheread = cmd;
+
+	sh_cacheread->opcode = req->last_cacheread ? sh_last_cacheread_cmd : sh_cacheread_cmd;
+	sh_cacheread->bsector = req->bsector;
+	sh_cacheread->nsector = req->nsector - 1;
+	sh_cacheread->head = req->no_dma ? (0x20 | req->head) : req->head;
+	sh_cacheread->ppa = cpu_to_le32(req->ppa | (dev->lun[req->lun].phylun << 24));
+	if (dev->has_advance_read && (dev->advance_read || req->advance_read)) {
+		sh_cacheread->opcode = sh_cacheread_adv_cmd;
+		sh_cacheread->head = 0;
+	}
+
+	if (req_dma_mapped(req)) {
+		for (i = 0; i < req->nsector; i++) {
+			sh_cacheread->pte[i] = dma_slot_dma_addr(dev, req->dma_slot) + i * dev->config->sector_size;
+			cpu_to_le64s(&sh_cacheread->pte[i]);
+		}
+	} else if (!req->no_dma) {
+		for (i = 0; i < req->nsector; i++) {
+			mem = get_dma_mem(dev, dev->config->sector_size);
+			assert(NULL != mem);		// FIXME: please use error process instead of assert
+			sh_cacheread->pte[i] = mem->dma_addr;
+			cpu_to_le64s(&sh_cacheread->pte[i]);
+			list_add_tail(&mem->list, &req->mem_listhead);
 		}
-		cmddata = sh_erase;
-		ncmddata = nplane * cmdlen;
+	}
+	return 0;
+}
 
-		list_add_tail(&tmp_chunk_head, &req->chunk_list);
-		list_for_each_entry(tmp, &tmp_chunk_head, chunk_list) {
-			sh_erase->opcode = sh_erase_cmd;
-			sh_erase->head = tmp->head;
-			sh_erase->ppa = cpu_to_le32(tmp->ppa | (dev->lun[req->lun].phylun << 24));
+/* data of planes are added to iov and copied by one write_mem_v after all planes are encoded */
+static int encode_write(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	int i;
+	struct memory *mem;
+	struct sh_write *sh_write = cmd;
 
-			tmp->cmdlen = cmdlen;
-			tmp->cmdhead = (dev->lun[tmp->lun].thread->cmdhead + plane * cmdlen) % PAGE_SIZE;
+	sh_write->opcode = sh_write_cmd;
+	sh_write->head = sub->head;
+	sh_write->ppa = cpu_to_le32(sub->ppa | (dev->lun[req->lun].phylun << 24));
 
-			plane++;
-			sh_erase++;
+	if (!req->no_dma && req_dma_mapped(sub)) {
+		/* hw reads slot directly, slot has room for padding sectors */
+		for (i = 0; i < dev->config->page_nsector; i++) {
+			if (i < sub->nsector) {
+				sh_write->sector[i].metadata = sub->metadata[i];
+			} else {
+				memcpy(sub->data + i * dev->config->sector_size, dev->padding_buffer + i * dev->config->sector_size, dev->config->sector_size);
+				sh_write->sector[i].metadata = 0xA5A5A5A5;
+			}
+			sh_write->sector[i].pte = dma_slot_dma_addr(dev, sub->dma_slot) + i * dev->config->sector_size;
+			cpu_to_le64s(&sh_write->sector[i].pte);
+			cpu_to_le64s(&sh_write->sector[i].metadata);
 		}
-		list_del(&tmp_chunk_head);
-		break;
-
-	case sh_preread_cmd:
-		cmdlen = sizeof(*sh_preread);
-		if (cmdlen * nplane > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
+	} else if (!req->no_dma) {
+		for (i = 0; i < dev->config->page_nsector; i++) {
+			mem = get_dma_mem(dev, dev->config->sector_size);
+			assert(NULL != mem);		// FIXME: please use error process instead of assert
+
+			if (i < sub->nsector) {
+				if (req->rw_entire_buffer) {
+					set_iovec(&iov[(*niov)++], mem->kernel_addr, sub->data + i * (dev->config->sector_size + METADATA_SIZE), dev->config->sector_size);
+					sh_write->sector[i].metadata = *((__u64 *)(sub->data + i * (dev->config->sector_size + METADATA_SIZE) + dev->config->sector_size));
+				} else {
+					set_iovec(&iov[(*niov)++], mem->kernel_addr, sub->data + i * dev->config->sector_size, dev->config->sector_size);
+					sh_write->sector[i].metadata = sub->metadata[i];
+				}
+				sh_write->sector[i].pte = mem->dma_addr;
+			} else {
+				set_iovec(&iov[(*niov)++], mem->kernel_addr, dev->padding_buffer + i * dev->config->sector_size, dev->config->sector_size);
+				sh_write->sector[i].pte = mem->dma_addr;
+				sh_write->sector[i].metadata = 0xA5A5A5A5;
+			}
+			cpu_to_le64s(&sh_write->sector[i].pte);
+			cpu_to_le64s(&sh_write->sector[i].metadata);
+			list_add_tail(&mem->list, &sub->mem_listhead);
 		}
-
-		sh_preread = zmalloc(cmdlen * nplane);
-		if (NULL == sh_preread) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
+	} else {
+		// the hw backdoor of no dma at all. DMA reading from NULL is ok on X86
+		for (i = 0; i < dev->config->page_nsector; i++) {
+			sh_write->sector[i].pte = cpu_to_le64(0x1);
+			// sh_write->sector[i].pte = cpu_to_le64(dev->dummy_mem.dma_addr);
+			sh_write->sector[i].metadata = cpu_to_le64(0xA5A5A5A5);
 		}
-		cmddata = sh_preread;
-		ncmddata = cmdlen * nplane;
-
-		list_add_tail(&tmp_chunk_head, &req->chunk_list);
-		list_for_each_entry(tmp, &tmp_chunk_head, chunk_list) {
-			sh_preread->opcode = sh_preread_cmd;
-			sh_preread->head = tmp->head;
-			sh_preread->ppa = cpu_to_le32(tmp->ppa | (dev->lun[req->lun].phylun << 24));
+	}
+	return 0;
+}
 
-			tmp->cmdlen = cmdlen;
-			tmp->cmdhead = (dev->lun[tmp->lun].thread->cmdhead + plane * cmdlen) % PAGE_SIZE;
+static int encode_raidinit(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			   void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct sh_raidinit *sh_raidinit = cmd;
 
-			plane++;
-			sh_preread++;
-		}
-		list_del(&tmp_chunk_head);
-		break;
+	sh_raidinit->opcode = sh_raidinit_cmd;
+	sh_raidinit->ndatalun = req->nsector;	/* ns used for ndatalun */
+	sh_raidinit->head = req->head;
+	sh_raidinit->ppa = cpu_to_le32(req->ppa | (dev->lun[req->lun].phylun << 24));
+	return 0;
+}
 
-	case sh_cacheread_cmd:
-		cmdlen = sizeof(*sh_cacheread) + req->nsector * METADATA_SIZE;
-		if (cmdlen > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+static int encode_raidwrite(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			    void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct sh_raidwrite *sh_raidwrite = cmd;
 
-		sh_cacheread = zmalloc(cmdlen);
-		if (NULL == sh_cacheread) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_cacheread;
-		ncmddata = cmdlen;
-
-		sh_cacheread->opcode = req->last_cacheread ? sh_last_cacheread_cmd : sh_cacheread_cmd;
-		sh_cacheread->bsector = req->bsector;
-		sh_cacheread->nsector = req->nsector - 1;
-		sh_cacheread->head = req->no_dma ? (0x20 | req->head) : req->head;
-		sh_cacheread->ppa = cpu_to_le32(req->ppa | (dev->lun[req->lun].phylun << 24));
-		if (dev->has_advance_read && (dev->advance_read || req->advance_read)){
-                        sh_cacheread->opcode = sh_cacheread_adv_cmd;
-                        sh_cacheread->head = 0;
-		}
+	sh_raidwrite->opcode = sh_raidwrite_cmd;
+	sh_raidwrite->head = sub->head;
+	sh_raidwrite->ppa = cpu_to_le32(sub->ppa | (dev->lun[req->lun].phylun << 24));
+	return 0;
+}
 
-		if (!req->no_dma) {
-			for (i = 0; i < req->nsector; i++) {
-				mem = zmalloc(sizeof(*mem));
-				assert(NULL != mem);		// FIXME: please use error process instead of assert
-				mem->size = dev->config->sector_size;
-				dev->get_mem(dev, mem);
-				sh_cacheread->pte[i] = mem->dma_addr;
-				cpu_to_le64s(&sh_cacheread->pte[i]);
-				list_add_tail(&mem->list, &req->mem_listhead);
-			}
-		}
+static int encode_bufwrite(struct shannon_dev *dev, struct shannon_request *req, struct shannon_request *sub,
+			   void *cmd, struct shannon_iovec *iov, int *niov)
+{
+	struct memory *mem;
+	struct sh_bufwrite *sh_bufwrite = cmd;
+
+	mem = get_dma_mem(dev, dev->config->sector_size);
+	if (NULL == mem)
+		return ALLOCMEM_FAILED;
+
+	sh_bufwrite->opcode = sh_bufwrite_cmd;
+	sh_bufwrite->lun = log2phy_lun(dev, req->lun);
+	sh_bufwrite->bsector = req->bsector;
+	sh_bufwrite->head = req->head;
+	sh_bufwrite->ppa = cpu_to_le32(req->ppa);
+	dev->write_mem(dev, mem->kernel_addr, req->data, dev->config->sector_size);
+	sh_bufwrite->pte = mem->dma_addr;
+	sh_bufwrite->metadata = req->metadata[0];
+	cpu_to_le64s(&sh_bufwrite->pte);
+	cpu_to_le64s(&sh_bufwrite->metadata);
+	list_add_tail(&mem->list, &req->mem_listhead);
+	return 0;
+}
 
-		req->cmdlen = cmdlen;
-		req->cmdhead = dev->lun[req->lun].thread->cmdhead;
-		break;
-
-	case sh_write_cmd:
-		cmdlen = sizeof(struct sh_write) + dev->config->page_nsector * sizeof(struct sh_write_sector);
-		if (cmdlen * nplane > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+/*
+ * Command layouts mirror sh_* of both.h: fixed part plus a tail of units, commands of a multi-plane opcode are one per
+ * plane request of the chunk. Opcodes without encoder are not hardware commands.
+ */
+enum cmd_tail {
+	CMD_TAIL_NONE,
+	CMD_TAIL_REQ_NSECTOR,		/* a unit per sector of req */
+	CMD_TAIL_PAGE_NSECTOR,		/* a unit per sector of page */
+	CMD_TAIL_REG_DATA,		/* a unit if more than one byte of register is written */
+};
+
+static const struct cmd_layout {
+	int size;
+	enum cmd_tail tail;
+	int tail_size;
+	int per_plane;
+	cmd_encoder_t encode;
+} cmd_layout[256] = {
+	[sh_reset_cmd]		= { sizeof(struct sh_reset),	 CMD_TAIL_NONE,		0,				0, encode_reset },
+	[sh_readid_cmd]		= { sizeof(struct sh_readid),	 CMD_TAIL_NONE,		0,				0, encode_readid },
+	[sh_writereg_cmd]	= { sizeof(struct sh_writereg),	 CMD_TAIL_REG_DATA,	QW_SIZE,			0, encode_writereg },
+	[sh_erase_cmd]		= { sizeof(struct sh_erase),	 CMD_TAIL_NONE,		0,				1, encode_erase },
+	[sh_preread_cmd]	= { sizeof(struct sh_preread),	 CMD_TAIL_NONE,		0,				1, encode_preread },
+	[sh_cacheread_cmd]	= { sizeof(struct sh_cacheread), CMD_TAIL_REQ_NSECTOR,	sizeof(__u64),			0, encode_cacheread },
+	[sh_write_cmd]		= { sizeof(struct sh_write),	 CMD_TAIL_PAGE_NSECTOR,	sizeof(struct sh_write_sector),	1, encode_write },
+	[sh_raidinit_cmd]	= { sizeof(struct sh_raidinit),	 CMD_TAIL_NONE,		0,				0, encode_raidinit },
+	[sh_raidwrite_cmd]	= { sizeof(struct sh_raidwrite), CMD_TAIL_NONE,		0,				1, encode_raidwrite },
+	[sh_bufwrite_cmd]	= { sizeof(struct sh_bufwrite),	 CMD_TAIL_NONE,		0,				0, encode_bufwrite },
+};
+
+static inline int cmd_len(struct shannon_dev *dev, struct shannon_request *req, const struct cmd_layout *layout)
+{
+	switch (layout->tail) {
+	case CMD_TAIL_REQ_NSECTOR:
+		return layout->size + req->nsector * layout->tail_size;
+	case CMD_TAIL_PAGE_NSECTOR:
+		return layout->size + dev->config->page_nsector * layout->tail_size;
+	case CMD_TAIL_REG_DATA:
+		return layout->size + ((req->wr_flash_reg_nbyte > 1) ? layout->tail_size : 0);
+	default:
+		return layout->size;
+	}
+}
 
-		sh_write = zmalloc(cmdlen * nplane);
-		if (NULL == sh_write) {
-			rc =ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_write;
-		ncmddata = cmdlen * nplane;
+#if 0
+static void back_pad_cmdqueue(struct shannon_dev *dev, struct shannon_request *req)
+{
+	int i;
+	__u64 data = 0x00;
 
-		list_add_tail(&tmp_chunk_head, &req->chunk_list);
-		list_for_each_entry(tmp, &tmp_chunk_head, chunk_list) {
-			sh_write->opcode = sh_write_cmd;
-			sh_write->head = tmp->head;
-			sh_write->ppa = cpu_to_le32(tmp->ppa | (dev->lun[req->lun].phylun << 24));
-			tmp->cmdlen = cmdlen;
-			tmp->cmdhead = (dev->lun[tmp->lun].thread->cmdhead + plane * cmdlen) % PAGE_SIZE;
-
-			if (!req->no_dma) {
-				for (i = 0; i < dev->config->page_nsector; i++) {
-					mem = zmalloc(sizeof(*mem));
-					assert(NULL != mem);		// FIXME: please use error process instead of assert
-
-					mem->size = dev->config->sector_size;
-					dev->get_mem(dev, mem);
-					if (i < tmp->nsector) {
-						if (req->rw_entire_buffer) {
-							dev->write_mem(dev, mem->kernel_addr, tmp->data + i * (dev->config->sector_size + METADATA_SIZE), dev->config->sector_size);
-							sh_write->sector[i].metadata = *((__u64 *)(tmp->data + i * (dev->config->sector_size + METADATA_SIZE) + dev->config->sector_size));
-						} else {
-							dev->write_mem(dev, mem->kernel_addr, tmp->data + i * dev->config->sector_size, dev->config->sector_size);
-							sh_write->sector[i].metadata = tmp->metadata[i];
-						}
-						sh_write->sector[i].pte = mem->dma_addr;
-					} else {
-						dev->write_mem(dev, mem->kernel_addr, dev->padding_buffer + i * dev->config->sector_size, dev->config->sector_size);
-						sh_write->sector[i].pte = mem->dma_addr;
-						sh_write->sector[i].metadata = 0xA5A5A5A5;
-					}
-					cpu_to_le64s(&sh_write->sector[i].pte);
-					cpu_to_le64s(&sh_write->sector[i].metadata);
-					list_add_tail(&mem->list, &tmp->mem_listhead);
-				}
-			} else {
-				// the hw backdoor of no dma at all. DMA reading from NULL is ok on X86
-				for (i = 0; i < dev->config->page_nsector; i++) {
-					sh_write->sector[i].pte = cpu_to_le64(0x1);
-					// sh_write->sector[i].pte = cpu_to_le64(dev->dummy_mem.dma_addr);
-					sh_write->sector[i].metadata = cpu_to_le64(0xA5A5A5A5);
-				}
-			}
+	if (req->bufcmd) {
+		for (i = 0; i < req->cmdlen; i += QW_SIZE)
+			dev->write_mem(dev, dev->bufhead[req->head].cmdmem.kernel_addr + (req->cmdhead + i)%PAGE_SIZE, &data, QW_SIZE);
+	} else {
+		for (i = 0; i < req->cmdlen; i += QW_SIZE)
+			dev->write_mem(dev, dev->lun[req->lun].cmdmem.kernel_addr + (req->cmdhead + i)%PAGE_SIZE, &data, QW_SIZE);
+	}
+}
+#else
+static void back_pad_cmdqueue(struct shannon_dev *dev, struct shannon_request *req) {}
+#endif
 
-			plane++;
-			sh_write = (struct sh_write *)((__u64)sh_write + cmdlen);
-		}
-		list_del(&tmp_chunk_head);
-		break;
+int submit_request(struct shannon_request *req)
+{
+	int rc, plane, nplane, cmdlen, ncmddata, cmdhead, cmdempty;
+	void *cmdq, *cmdq_kernel, *cmdbuf, *cmddata;
+	struct list_head tmp_chunk_head;
+	struct shannon_request *tmp;
+	struct shannon_thread *thread = NULL;
+	struct shannon_bufhead *bufhead = NULL;
+	struct shannon_dev *dev = req->dev;
+	const struct cmd_layout *layout = &cmd_layout[req->opcode];
+	struct shannon_iovec iov[dev->config->nplane * dev->config->page_nsector];
+	int niov = 0;
 
-	case sh_raidinit_cmd:
-		cmdlen = sizeof(*sh_raidinit);
-		if (cmdlen > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+	if (NULL == layout->encode) {
+		printf("%s(): No such command\n", __func__);
+		return ERR;
+	}
 
-		sh_raidinit = zmalloc(cmdlen);
-		if (NULL == sh_raidinit) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_raidinit;
-		ncmddata = cmdlen;
+	nplane = list_empty(&req->chunk_list) ? 1 : dev->config->nplane;
+	assert(nplane == 1 || nplane == 2 || nplane == 4 || nplane == 8);
+	if (!layout->per_plane)
+		nplane = 1;
 
-		sh_raidinit->opcode = sh_raidinit_cmd;
-		sh_raidinit->ndatalun = req->nsector;	/* ns used for ndatalun */
-		sh_raidinit->head = req->head;
-		sh_raidinit->ppa = cpu_to_le32(req->ppa | (dev->lun[req->lun].phylun << 24));
+	if (req->bufcmd) {
+		assert(req->head < INDEP_HEAD);
+		bufhead = &dev->bufhead[req->head];
+		cmdq = bufhead->cmdq;
+		cmdq_kernel = bufhead->cmdmem.kernel_addr;
+		cmdbuf = bufhead->cmdbuf;
+		cmdhead = bufhead->cmdhead;
+		cmdempty = bufhead->cmdempty;
+	} else {
+		thread = dev->lun[req->lun].thread;
+		cmdq = thread->cmdq;
+		cmdq_kernel = thread->cmdmem.kernel_addr;
+		cmdbuf = thread->cmdbuf;
+		cmdhead = thread->cmdhead;
+		cmdempty = thread->cmdempty;
+	}
 
-		req->cmdlen = cmdlen;
-		req->cmdhead = dev->lun[req->lun].thread->cmdhead;
-		break;
-
-	case sh_raidwrite_cmd:
-		cmdlen = sizeof(*sh_raidwrite);
-		if (cmdlen * nplane > dev->lun[req->lun].thread->cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
+	cmdlen = cmd_len(dev, req, layout);
+	ncmddata = cmdlen * nplane;
+	if (ncmddata > cmdempty)
+		return NO_CMDQUEUE_ROOM;
 
-		sh_raidwrite = zmalloc(cmdlen * nplane);
-		if (NULL == sh_raidwrite) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_raidwrite;
-		ncmddata = cmdlen * nplane;
+	cmddata = (NULL != cmdq && cmdhead + ncmddata <= PAGE_SIZE) ? cmdq + cmdhead : cmdbuf;
+	memset(cmddata, 0x00, ncmddata);
 
+	rc = 0;
+	if (layout->per_plane) {
+		plane = 0;
 		list_add_tail(&tmp_chunk_head, &req->chunk_list);
 		list_for_each_entry(tmp, &tmp_chunk_head, chunk_list) {
-			sh_raidwrite->opcode = sh_raidwrite_cmd;
-			sh_raidwrite->head = tmp->head;
-			sh_raidwrite->ppa = cpu_to_le32(tmp->ppa | (dev->lun[req->lun].phylun << 24));
-
 			tmp->cmdlen = cmdlen;
-			tmp->cmdhead = (dev->lun[tmp->lun].thread->cmdhead + cmdlen * plane) % PAGE_SIZE;
-
+			tmp->cmdhead = (cmdhead + plane * cmdlen) % PAGE_SIZE;
+			if ((rc = layout->encode(dev, req, tmp, cmddata + plane * cmdlen, iov, &niov)))
+				break;
 			plane++;
-			sh_raidwrite++;
 		}
 		list_del(&tmp_chunk_head);
-		break;
-
-	case sh_bufwrite_cmd:
-		cmdlen = sizeof(*sh_bufwrite);
-		if (cmdlen > dev->bufhead[req->head].cmdempty) {
-			rc = NO_CMDQUEUE_ROOM;
-			goto out;
-		}
-
-		sh_bufwrite = zmalloc(cmdlen);
-		if (NULL == sh_bufwrite) {
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		cmddata = sh_bufwrite;
-		ncmddata = cmdlen;
-
-		sh_bufwrite->opcode = sh_bufwrite_cmd;
-		sh_bufwrite->lun = log2phy_lun(dev, req->lun);
-		sh_bufwrite->bsector = req->bsector;
-		sh_bufwrite->head = req->head;
-		sh_bufwrite->ppa = cpu_to_le32(req->ppa);
-		mem = zmalloc(sizeof(*mem));
-		if (NULL == mem) {
-			free(sh_bufwrite);
-			rc = ALLOCMEM_FAILED;
-			goto out;
-		}
-		mem->size = dev->config->sector_size;
-		dev->get_mem(dev, mem);
-		dev->write_mem(dev, mem->kernel_addr, req->data, dev->config->sector_size);
-		sh_bufwrite->pte = mem->dma_addr;
-		sh_bufwrite->metadata = req->metadata[0];
-		cpu_to_le64s(&sh_bufwrite->pte);
-		cpu_to_le64s(&sh_bufwrite->metadata);
-		list_add_tail(&mem->list, &req->mem_listhead);
-
+	} else {
 		req->cmdlen = cmdlen;
-		req->cmdhead = dev->bufhead[req->head].cmdhead; assert(req->head < INDEP_HEAD);
-		break;
-
-	default:
-		printf("%s(): No such command\n", __func__);
-		rc = ERR;
-		goto out;
+		req->cmdhead = cmdhead;
+		rc = layout->encode(dev, req, req, cmddata, iov, &niov);
 	}
+	if (rc)
+		return rc;
 
-	pad_cmdqueue(dev, req, cmddata, ncmddata);
-	free(cmddata);
+	if (niov)
+		dev->write_mem_v(dev, iov, niov);	/* data of all planes by one copy */
+	if (cmddata == cmdbuf)
+		copy_to_cmdqueue(dev, cmdq, cmdq_kernel, cmdhead, cmddata, ncmddata);
 
-	if (sh_bufwrite_cmd == req->opcode || sh_bufread_cmd == req->opcode) {
-		list_add_tail(&req->bufhead_list, &dev->bufhead[req->head].req_listhead);
+	if (NULL != dev->latency) {
+		req->submit_ns = now_ns();
+		list_for_each_entry(tmp, &req->chunk_list, chunk_list)
+			tmp->submit_ns = req->submit_ns;
+	}
+	if (NULL != dev->trace)
+		trace_submit(dev, req);
+
+	if (req->bufcmd) {
+		bufhead->cmdhead = (cmdhead + ncmddata) % PAGE_SIZE;
+		bufhead->cmdempty -= ncmddata;
+		list_add_tail(&req->bufhead_list, &bufhead->req_listhead);
 	} else {
+		thread->cmdhead = (cmdhead + ncmddata) % PAGE_SIZE;
+		thread->cmdempty -= ncmddata;
+		thread->req_count += nplane;
+
 		list_add_tail(&req->lun_list, &dev->lun[req->lun].req_listhead);
-		list_for_each_entry(tmp, &req->chunk_list, chunk_list)
+		list_add_tail(&req->thread_list, &thread->req_listhead);
+		list_for_each_entry(tmp, &req->chunk_list, chunk_list) {
 			list_add_tail(&tmp->lun_list, &dev->lun[tmp->lun].req_listhead);
+			list_add_tail(&tmp->thread_list, &dev->lun[tmp->lun].thread->req_listhead);
+		}
 	}
 
-out:
-	return rc;
+	return 0;
 }
 
-int __poll_cmdqueue(struct shannon_dev *dev, int lun, int wait)
+/*
+ * Submit n requests at once. Single-plane requests are merged into multi-plane chunks by merge_plane_array() and
+ * dispatched die interleaved by interleave_requests(), order in a lun is kept but not across luns, so raid heads must
+ * not be batched. A merged chunk is split again as soon as it is encoded, hw completes its planes one by one, so the
+ * caller gets back the same single-plane requests. Doorbell of every touched thread is rung once at the end, a thread
+ * short of cmdqueue room takes no more requests of the batch. reqs[] is reordered: submitted ones first in submit
+ * order, the rest behind them. Return number of submitted ones.
+ */
+int submit_batch(struct shannon_dev *dev, struct shannon_request **reqs, int n)
 {
-	int i, pos, timeout, thread_cmphead, thread_cmdhead;
-	struct memory *mem, *mem_tmp;
-	struct shannon_request *req, *req_tmp;
-	__u8 *p;
-	void *cmp_queue;
+	int i, k, tr, rc, nchunk, nsub, nsubmit, nrest;
+	int kick[dev->hw_threads];
+	char full[dev->hw_threads];
+	struct shannon_request *req, *sorted[n], *rest[n], *subs[8];
+
+	memcpy(sorted, reqs, n * sizeof(*reqs));
+	nchunk = merge_plane_array(dev, sorted, n);
+	interleave_requests(dev, sorted, nchunk);
+
+	for (tr = 0; tr < dev->hw_threads; tr++)
+		kick[tr] = -1;
+	memset(full, 0x00, sizeof(full));
+
+	nsubmit = nrest = 0;
+	for (i = 0; i < nchunk; i++) {
+		req = sorted[i];
+		assert(!req->bufcmd);
+		tr = dev->lun[req->lun].thread->phythread_idx;
+
+		rc = NO_CMDQUEUE_ROOM;
+		if (!full[tr]) {
+			rc = dev->submit_request(req);
+			if (0 == rc)
+				kick[tr] = req->lun;
+			else if (rc != NO_CMDQUEUE_ROOM)
+				submit_failed_exit(req->lun);
+			else
+				full[tr] = 1;
+		}
 
-	/* wait command queue execute completely */
-	if (wait) {
-		timeout = 0;
+		nsub = split_plane_chunk(req, subs);
+		if (0 == rc) {
+			reqs[nsubmit++] = req;
+			for (k = 0; k < nsub; k++)
+				reqs[nsubmit++] = subs[k];
+		} else {
+			rest[nrest++] = req;
+			for (k = 0; k < nsub; k++)
+				rest[nrest++] = subs[k];
+		}
+	}
+	memcpy(reqs + nsubmit, rest, nrest * sizeof(*reqs));
 
-		while (1) {
-			thread_cmdhead = dev->ioread_lunreg(dev, lun, HW_cmdq_head);
-			thread_cmphead = dev->ioread_lunreg(dev, lun, HW_cmpq_head);
+	for (tr = 0; tr < dev->hw_threads; tr++) {
+		if (kick[tr] >= 0)
+			update_cmdqueue(dev, kick[tr]);
+	}
 
-			if (dev->lun[lun].head == dev->lun[lun].tail) {
-				return 0;
-			} else if (thread_cmdhead == thread_cmphead) {
-				break;
-			}
+	return nsubmit;
+}
+/*
+ * Completion of req at pos of cmpqueue is copied at once if cmpqueue is mmaped, otherwise it is added to iov
+ */
+static inline void read_cmpqueue(struct shannon_iovec *iov, int *niov, void *cmpq, void *cmpq_kernel, int pos, void *dst, int size)
+{
+	if (NULL != cmpq)
+		memcpy(dst, cmpq + pos, size);
+	else
+		set_iovec(&iov[(*niov)++], cmpq_kernel + pos, dst, size);
+}
 
-			usleep(10);
-			if (timeout++ > 10 * RUNCMDQ_US_TIMEOUT) {	// 80ms
-				printf("\nHW Firmware BUG: lun %d command completion is not to return!\n", lun);
-				exit(EXIT_FAILURE);
-			}
+/*
+ * copy completion of a finished req, free memory, copy read data if it is read req
+ */
+static void retire_request(struct shannon_dev *dev, struct shannon_request *req)
+{
+	int i, pos;
+	struct memory *mem, *mem_tmp;
+	struct shannon_iovec iov[2 * req->nsector + 1];
+	int niov = 0;
+	struct shannon_thread *thread = dev->lun[req->lun].thread;
+	__u8 *p;
+	void *cmp_queue, *cmpq;
+
+	back_pad_cmdqueue(dev, req);
+	list_del(&req->lun_list);
+	list_del(&req->thread_list);
+
+	/* read data, ecc, metadata or status of this req by one vector copy */
+	p = req->data;
+	if (sh_cacheread_cmd == req->opcode && NULL != p) {
+		list_for_each_entry(mem, &req->mem_listhead, list) {
+			set_iovec(&iov[niov++], mem->kernel_addr, p, dev->config->sector_size);
+			if (req->rw_entire_buffer)
+				p += (dev->config->sector_size + METADATA_SIZE);
+			else
+				p += dev->config->sector_size;
 		}
 	}
 
-	dev->lun[lun].head = dev->lun[lun].tail = -1;
-
-	/* lookup finished req, copy completion, free memory, copy read data if it is read req */
-	list_for_each_entry_safe(req, req_tmp, &dev->lun[lun].req_listhead, lun_list) {
-		back_pad_cmdqueue(dev, req);
-		list_del(&req->lun_list);
-		p = req->data;
+	p = req->data + dev->config->sector_size;
+	cmp_queue = thread->cmpmem.kernel_addr;
+	cmpq = thread->cmpq;
 
-		/* just for read/write have mem list */
-		list_for_each_entry_safe(mem, mem_tmp, &req->mem_listhead, list) {
-			list_del(&mem->list);
+	if (sh_cacheread_cmd != req->opcode) {
+		read_cmpqueue(iov, &niov, cmpq, cmp_queue, req->cmdhead, &req->status, QW_SIZE);
+	} else {
+		read_cmpqueue(iov, &niov, cmpq, cmp_queue, req->cmdhead, req->ecc, req->nsector);	/* ecc */
 
-			if (sh_cacheread_cmd == req->opcode && NULL != p) {
-				dev->read_mem(dev, p, mem->kernel_addr, dev->config->sector_size);
+		if (req->metadata != NULL || req->rw_entire_buffer) {
+			for (i = 0; i < req->nsector; i++) {				/* metadata */
+				pos = (req->cmdhead + (1 + i) * QW_SIZE) % PAGE_SIZE;
 				if (req->rw_entire_buffer)
-					p += (dev->config->sector_size + METADATA_SIZE);
+					read_cmpqueue(iov, &niov, cmpq, cmp_queue, pos, p + i * (dev->config->sector_size + METADATA_SIZE), QW_SIZE);
 				else
-					p += dev->config->sector_size;
+					read_cmpqueue(iov, &niov, cmpq, cmp_queue, pos, req->metadata + i, QW_SIZE);
 			}
-
-			dev->free_mem(dev, mem);
-			free(mem);
 		}
+	}
+	if (niov)
+		dev->read_mem_v(dev, iov, niov);
+
+	if (sh_cacheread_cmd != req->opcode) {
+		if (sh_readid_cmd != req->opcode)
+			le64_to_cpus(&req->status);
+	} else if (req->metadata != NULL || req->rw_entire_buffer) {
+		for (i = 0; i < req->nsector; i++) {
+			if (req->rw_entire_buffer)
+				le64_to_cpus((__u64 *)(p + i * (dev->config->sector_size + METADATA_SIZE)));
+			else
+				le64_to_cpus(req->metadata + i);
+		}
+	}
 
-		/* copy completion data to user buffer */
-		p = req->data + dev->config->sector_size;
-		cmp_queue = dev->lun[lun].thread->cmpmem.kernel_addr;
+	/* just for read/write have mem list */
+	list_for_each_entry_safe(mem, mem_tmp, &req->mem_listhead, list) {
+		list_del(&mem->list);
+		put_dma_mem(dev, mem);
+	}
 
-		if (sh_cacheread_cmd != req->opcode) {
-			dev->read_mem(dev, &req->status, cmp_queue + req->cmdhead, QW_SIZE);
-			if (sh_readid_cmd != req->opcode)
-				le64_to_cpus(&req->status);
-		} else {
-			dev->read_mem(dev, req->ecc, cmp_queue + req->cmdhead, req->nsector);	/* ecc */
-
-			if (req->metadata != NULL || req->rw_entire_buffer) {
-				for (i = 0; i < req->nsector; i++) {				/* metadata */
-					pos = (req->cmdhead + (1 + i) * QW_SIZE) % PAGE_SIZE;
-					if (req->rw_entire_buffer) {
-						dev->read_mem(dev, p + i * (dev->config->sector_size + METADATA_SIZE), cmp_queue + pos, QW_SIZE);
-						le64_to_cpus((__u64 *)(p + i * (dev->config->sector_size + METADATA_SIZE)));
-					} else {
-						dev->read_mem(dev, req->metadata + i, cmp_queue + pos, QW_SIZE);
-						le64_to_cpus(req->metadata + i);
-					}
-				}
-			}
-		}
+	/* ring space of req is given back at once */
+	thread->cmptail = (thread->cmptail + req->cmdlen) % PAGE_SIZE;
+	thread->cmdempty += req->cmdlen;
+	thread->req_count--;
+	sched_pe_retired(dev, req);
+	if (NULL != dev->latency)
+		latency_record(dev, req, now_ns());
+	if (NULL != dev->trace)
+		trace_complete(dev, req);
+
+	if (NULL != req->worker)
+		engine_retired(req);	/* done is called by main thread */
+	else if (NULL != req->done)
+		req->done(req, req->done_ctx);
+}
+
+/*
+ * hw completes commands of a thread in order of cmdqueue, retire req from the oldest one until HW_cmpq_head.
+ * cmdempty never reaches PAGE_SIZE, so cmpq_head equal to cmptail always means nothing is done.
+ */
+int reap_cmdqueue(struct shannon_dev *dev, struct shannon_thread *thread)
+{
+	int cmphead, ndone, nreq;
+	struct shannon_request *req, *req_tmp;
+
+	if (list_empty(&thread->req_listhead))
+		return 0;
+
+	req = list_first_entry(&thread->req_listhead, struct shannon_request, thread_list);
+	cmphead = dev->ioread_lunreg(dev, req->lun, HW_cmpq_head);
+	ndone = (cmphead - thread->cmptail + PAGE_SIZE) % PAGE_SIZE;
+
+	nreq = 0;
+	list_for_each_entry_safe(req, req_tmp, &thread->req_listhead, thread_list) {
+		assert(req->cmdhead == thread->cmptail);
+		if (req->cmdlen > ndone)
+			break;
+		ndone -= req->cmdlen;
+		retire_request(dev, req);
+		nreq++;
+	}
+
+	if (list_empty(&thread->req_listhead))
+		assert(0 == thread->req_count && PAGE_SIZE - 8 == thread->cmdempty);
+
+	return nreq;
+}
+
+/*
+ * retire finished req of lun, or wait until all req of lun are retired. Req of other luns sharing the thread are
+ * retired on the way.
+ */
+int __poll_cmdqueue(struct shannon_dev *dev, int lun, int wait)
+{
+	struct poll_state ps;
+	struct shannon_thread *thread = dev->lun[lun].thread;
+
+	if (!wait) {
+		reap_cmdqueue(dev, thread);
+		return 0;
+	}
 
-		if (--dev->lun[lun].thread->req_count == 0)
-			dev->lun[lun].thread->cmdempty = PAGE_SIZE - 8;
+	if (list_empty(&dev->lun[lun].req_listhead))
+		return 0;
+
+	poll_start(dev, &ps, poll_class_lun(dev, lun), &dev->lun[lun].poll_stats);
+	while (1) {
+		if (reap_cmdqueue(dev, thread))
+			poll_progress(&ps);
+		if (list_empty(&dev->lun[lun].req_listhead))
+			break;
+
+		if (poll_wait(&ps)) {
+			printf("\nHW Firmware BUG: lun %d command completion is not to return!\n", lun);
+			exit(EXIT_FAILURE);
+		}
 	}
+	poll_end(&ps);
 
 	return 0;
 }
 
 int __poll_bufcmdqueue(struct shannon_dev *dev, int head, int wait)
 {
-	int timeout;
+	struct poll_state ps;
 	struct memory *mem, *mem_tmp;
 	struct shannon_request *req, *req_tmp;
 	void *cmp_queue;
+	int cmphead, last_cmphead;
 
 	/* wait command queue execute completely */
 	if (wait) {
-		timeout = 0;
-
-		while (dev->ioread_buflunreg(dev, head, HW_cmpq_head) != dev->bufhead[head].cmdhead) {
-			usleep(1);
-			if (timeout++ > 10 * RUNCMDQ_US_TIMEOUT) {	// 80ms
+		poll_start(dev, &ps, poll_class_bufhead(dev, head), &dev->bufhead[head].poll_stats);
+
+		last_cmphead = -1;
+		while ((cmphead = dev->ioread_buflunreg(dev, head, HW_cmpq_head)) != dev->bufhead[head].cmdhead) {
+			if (cmphead != last_cmphead) {
+				if (last_cmphead >= 0)
+					poll_progress(&ps);
+				last_cmphead = cmphead;
+			}
+			if (poll_wait(&ps)) {
 				if (dev->timeout_silent)
 					printf("### bufwrite/read head-%d wait for completion timeout ###\n", head);
 				return ERR;
 			}
 		}
+		poll_end(&ps);
 	}
 
 	/* lookup finished req, copy completion, free memory, copy read data if it is read req */
@@ -650,54 +900,193 @@ int __poll_bufcmdqueue(struct shannon_dev *dev, int head, int wait)
 			return 0;
 
 		back_pad_cmdqueue(dev, req);
-		list_del(&req->lun_list);
+		list_del_init(&req->bufhead_list);	/* retired once, done, latency and trace aren`t fired by a later poll */
 
 		list_for_each_entry_safe(mem, mem_tmp, &req->mem_listhead, list) {
 			list_del(&mem->list);
-			dev->free_mem(dev, mem);
-			free(mem);
+			put_dma_mem(dev, mem);
 		}
 
-		cmp_queue = dev->bufhead[head].cmpmem.kernel_addr;
-		dev->read_mem(dev, &req->status, cmp_queue + req->cmdhead, QW_SIZE);
+		if (NULL != dev->bufhead[head].cmpq) {
+			memcpy(&req->status, dev->bufhead[head].cmpq + req->cmdhead, QW_SIZE);
+		} else {
+			cmp_queue = dev->bufhead[head].cmpmem.kernel_addr;
+			dev->read_mem(dev, &req->status, cmp_queue + req->cmdhead, QW_SIZE);
+		}
 
 		dev->bufhead[head].cmdempty += req->cmdlen;
+		if (NULL != dev->latency)
+			latency_record(dev, req, now_ns());
+		if (NULL != dev->trace)
+			trace_complete(dev, req);
+
+		if (NULL != req->done)
+			req->done(req, req->done_ctx);
 	}
 
 	return 0;
 }
 
+/*
+ * cmdempty of a thread is its credit. A thread short of credit is marked full and requests behind it are deferred in
+ * order, requests of a raid head are deferred behind the head too, then submission goes on with other threads.
+ * Program/erase of a channel short of power budget is deferred the same way but leaves the thread not full.
+ * Deferred requests are linked by lun_list which is unused until they are submitted.
+ */
+static void submit_or_defer(struct shannon_dev *dev, struct shannon_request *req, struct list_head *defer_head,
+			    char *full, char *blocked, char *head_blocked)
+{
+	int rc;
+	int tr = dev->lun[req->lun].thread->phythread_idx;
+	int head = req->head & HEAD_MASK;
+	int raid = req_raid_head(req);
+
+	if (!blocked[tr] && !(raid && head_blocked[head]) && !sched_pe_busy(dev, req)) {
+		rc = dev->submit_request(req);
+		if (0 == rc) {
+			sched_pe_start(dev, req);
+			return;
+		} else if (rc != NO_CMDQUEUE_ROOM)
+			submit_failed_exit(req->lun);
+		full[tr] = 1;
+	}
+
+	blocked[tr] = 1;
+	if (raid)
+		head_blocked[head] = 1;
+	list_add_tail(&req->lun_list, defer_head);
+	dev->ndefer++;
+}
+
+/* first pass of submit_polling_loop(), requests are dispatched die interleaved unless order across luns matters */
+static void submit_list(struct shannon_dev *dev, struct list_head *req_head, int n, int raid, struct list_head *defer_head,
+			char *full, char *blocked, char *head_blocked)
+{
+	int i = 0;
+	struct shannon_request *req, *reqs[n];
+
+	list_for_each_entry(req, req_head, list)
+		reqs[i++] = req;
+
+	if (!raid)
+		interleave_requests(dev, reqs, n);
+
+	for (i = 0; i < n; i++)
+		submit_or_defer(dev, reqs[i], defer_head, full, blocked, head_blocked);
+}
+
+/* luns of a thread share its doorbell, ring it once per thread */
+static void update_all_cmdqueue(struct shannon_dev *dev)
+{
+	int lun, tr;
+	char kicked[dev->hw_threads];
+
+	memset(kicked, 0x00, sizeof(kicked));
+	for_dev_each_lun(dev, lun) {
+		tr = dev->lun[lun].thread->phythread_idx;
+		if (!kicked[tr]) {
+			update_cmdqueue(dev, lun);
+			kicked[tr] = 1;
+		}
+	}
+}
+
+/*
+ * kick all threads then wait until some thread retires requests, which gives back ring space of a full thread or dies
+ * of a channel short of power budget
+ */
+static void reap_any_thread(struct shannon_dev *dev, char *full)
+{
+	int lun, tr, done, class;
+	struct poll_state ps;
+
+	update_all_cmdqueue(dev);
+
+	class = POLL_READ;
+	for_dev_each_lun(dev, lun) {
+		if (poll_class_lun(dev, lun) > class)
+			class = poll_class_lun(dev, lun);
+	}
+
+	poll_start(dev, &ps, class, &dev->full_poll_stats);
+	while (1) {
+		done = 0;
+		for (tr = 0; tr < dev->hw_threads; tr++) {
+			if (!list_empty(&dev->thread[tr].req_listhead) && reap_cmdqueue(dev, &dev->thread[tr])) {
+				full[tr] = 0;
+				done++;
+			}
+		}
+		if (done)
+			break;
+
+		if (poll_wait(&ps)) {
+			printf("\nHW Firmware BUG: full command queue is not to drain!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	poll_end(&ps);
+}
+
 /*
  * this function submit all req in the list, wait if necessarily,
  */
 void submit_polling_loop(struct shannon_dev *dev, struct list_head *req_head)
 {
-	struct shannon_request *req;
-	int rc, lun;
+	struct shannon_request *req, *tmp;
+	struct list_head defer_head, retry_head;
+	char full[dev->hw_threads], blocked[dev->hw_threads], head_blocked[INDEP_HEAD];
+	int lun, n, raid;
 
-	/* submit all request and execute them */
+	merge_planes(dev, req_head);
+
+	n = raid = 0;
 	list_for_each_entry(req, req_head, list) {
-	again:
-		rc = dev->submit_request(req);
-		if (rc == 0) {
-			continue;
+		raid |= req_raid_head(req);
+		n++;
+	}
+
+	/* raid heads need order across threads which workers don`t keep */
+	if (dev->use_engine) {
+		if (!raid) {
+			if (engine_run(dev, req_head))
+				malloc_failed_exit();
+			split_planes(dev, req_head);
+			return;
 		}
-		else if (rc != NO_CMDQUEUE_ROOM)
-			submit_failed_exit(req->lun);
+		if (NULL != dev->engine)
+			dev->engine->nfallback++;
+	}
 
-		for_dev_each_lun(dev, lun)
-			update_cmdqueue(dev, lun);
+	sched_pe_setup(dev);
+	INIT_LIST_HEAD(&defer_head);
+	memset(full, 0x00, sizeof(full));
+	memset(blocked, 0x00, sizeof(blocked));
+	memset(head_blocked, 0x00, sizeof(head_blocked));
+
+	/* submit all request and execute them */
+	submit_list(dev, req_head, n, raid, &defer_head, full, blocked, head_blocked);
 
-		for_dev_each_lun(dev, lun)
-			poll_cmdqueue(dev, lun);
-		goto again;
+	while (!list_empty(&defer_head)) {
+		reap_any_thread(dev, full);
+
+		INIT_LIST_HEAD(&retry_head);
+		list_splice_init(&defer_head, &retry_head);
+		memcpy(blocked, full, sizeof(blocked));
+		memset(head_blocked, 0x00, sizeof(head_blocked));
+
+		list_for_each_entry_safe(req, tmp, &retry_head, lun_list) {
+			list_del(&req->lun_list);
+			submit_or_defer(dev, req, &defer_head, full, blocked, head_blocked);
+		}
 	}
+
 	// make sure everything is flushed
-	for_dev_each_lun(dev, lun)
-		update_cmdqueue(dev, lun);
+	update_all_cmdqueue(dev);
 	for_dev_each_lun(dev, lun)
 		poll_cmdqueue(dev, lun);
 
+	split_planes(dev, req_head);
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * plane merging: single-plane requests of a stream on the same lun and page of one chunk block are merged into one
+ * multi-plane chunk before submission, so callers need not build chunk_list by hand for scattered workloads.
+ *
+ * Only requests adjacent in the order of their lun are merged, a request of the lun which can`t join breaks the group,
+ * so order in a lun is kept. The chunk head is the plane-0 request and takes place of the earliest one of the group.
+ */
+struct plane_group {
+	int first;			/* index of the earliest member */
+	int slot[8];			/* index of every plane */
+	int n;
+};
+
+static int plane_shift(int opcode)
+{
+	switch (opcode) {
+	case sh_erase_cmd:
+		return SH_ERASE_PLANE_SHIFT;
+	case sh_preread_cmd:
+		return SH_READ_PLANE_SHIFT;
+	case sh_write_cmd:
+		return SH_WRITE_PLANE_SHIFT;
+	default:
+		return -1;
+	}
+}
+
+static int plane_mergeable(struct shannon_request *req)
+{
+	int shift = plane_shift(req->opcode);
+
+	/* raid writes are ordered with raidinit/raidwrite of their head */
+	if (shift < 0 || !list_empty(&req->chunk_list) || req->bufcmd || (req->head >> shift) & 0x01 || req_raid_head(req))
+		return 0;
+
+	return 1;
+}
+
+static int plane_compatible(struct shannon_request *a, struct shannon_request *b, int mask)
+{
+	return a->opcode == b->opcode && a->head == b->head && (a->ppa & ~mask) == (b->ppa & ~mask) &&
+		a->no_dma == b->no_dma && a->rw_entire_buffer == b->rw_entire_buffer;
+}
+
+static void merge_group(struct shannon_dev *dev, struct shannon_request **reqs, struct plane_group *group)
+{
+	int plane, shift;
+	struct shannon_request *chunk_head_req = reqs[group->slot[0]];
+
+	shift = plane_shift(chunk_head_req->opcode);
+
+	chunk_head_req->head |= (1 << shift);
+	chunk_head_req->plane_merged = 1;
+	reqs[group->slot[0]] = NULL;
+
+	for (plane = 1; plane < dev->config->nplane; plane++) {
+		reqs[group->slot[plane]]->head |= (1 << shift);
+		list_add_tail(&reqs[group->slot[plane]]->chunk_list, &chunk_head_req->chunk_list);
+		reqs[group->slot[plane]] = NULL;
+	}
+
+	reqs[group->first] = chunk_head_req;
+	dev->nplane_merge++;
+}
+
+/*
+ * merge requests of reqs[] in place, siblings are taken out and the rest are packed in order. Return number left.
+ * split_plane_chunk() must be called on every merged chunk head before it is used as single-plane requests again.
+ */
+int merge_plane_array(struct shannon_dev *dev, struct shannon_request **reqs, int n)
+{
+	int nplane = dev->config->nplane;
+	int i, k, mask, plane, nmerge;
+	struct plane_group *group, *g;
+	struct shannon_request *req;
+
+	if (nplane < 2 || n < nplane)
+		return n;
+
+	/* chunk block interleaves planes by block, which must be within plane bits of the flash row address */
+	mask = (nplane - 1) * dev->flash->npage;
+	if (mask & ~dev->flash->plane_mask)
+		return n;
+
+	group = zmalloc(dev->config->luns * sizeof(*group));
+	if (NULL == group)
+		return n;
+
+	nmerge = 0;
+	for (i = 0; i < n; i++) {
+		req = reqs[i];
+		g = &group[req->lun];
+		if (!plane_mergeable(req)) {
+			g->n = 0;
+			continue;
+		}
+
+		plane = (req->ppa / dev->flash->npage) % nplane;
+		if (g->n && (!plane_compatible(reqs[g->first], req, mask) || g->slot[plane] >= 0))
+			g->n = 0;
+
+		if (0 == g->n) {
+			g->first = i;
+			for (k = 0; k < nplane; k++)
+				g->slot[k] = -1;
+		}
+		g->slot[plane] = i;
+
+		if (++g->n == nplane) {
+			merge_group(dev, reqs, g);
+			g->n = 0;
+			nmerge++;
+		}
+	}
+	free(group);
+
+	if (!nmerge)
+		return n;
+
+	for (i = k = 0; i < n; i++) {
+		if (NULL != reqs[i])
+			reqs[k++] = reqs[i];
+	}
+	return k;
+}
+
+/* give back siblings of a merged chunk to subs[] in plane order as single-plane requests again, return number of them */
+int split_plane_chunk(struct shannon_request *req, struct shannon_request **subs)
+{
+	int n = 0, shift;
+	struct shannon_request *sub, *tmp;
+
+	if (!req->plane_merged)
+		return 0;
+
+	shift = plane_shift(req->opcode);
+	list_for_each_entry_safe(sub, tmp, &req->chunk_list, chunk_list) {
+		list_del_init(&sub->chunk_list);
+		sub->head &= ~(1 << shift);
+		subs[n++] = sub;
+	}
+
+	req->head &= ~(1 << shift);
+	req->plane_merged = 0;
+	return n;
+}
+
+/* merge_plane_array() on requests linked by req->list in req_head, return number of chunks merged */
+int merge_planes(struct shannon_dev *dev, struct list_head *req_head)
+{
+	int i, n = 0, nleft;
+	struct shannon_request *req;
+
+	list_for_each_entry(req, req_head, list)
+		n++;
+	if (n < 2)
+		return 0;
+
+	struct shannon_request *reqs[n];
+
+	i = 0;
+	list_for_each_entry(req, req_head, list)
+		reqs[i++] = req;
+
+	nleft = merge_plane_array(dev, reqs, n);
+	if (nleft == n)
+		return 0;
+
+	INIT_LIST_HEAD(req_head);
+	for (i = 0; i < nleft; i++)
+		list_add_tail(&reqs[i]->list, req_head);
+
+	return (n - nleft) / (dev->config->nplane - 1);
+}
+
+/* give back siblings of merged chunks to req_head right behind their chunk head */
+void split_planes(struct shannon_dev *dev, struct list_head *req_head)
+{
+	int i, n;
+	struct list_head *pos;
+	struct shannon_request *req, *subs[8];
+
+	list_for_each_entry(req, req_head, list) {
+		n = split_plane_chunk(req, subs);
+		pos = &req->list;
+		for (i = 0; i < n; i++) {
+			list_add(&subs[i]->list, pos);
+			pos = &subs[i]->list;
+		}
+	}
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * die interleaving: luns are ranked channel first, then thread, then lun in thread, and requests are dispatched round
+ * robin over luns in rank order, so consecutive commands spread over channels before they stack on one. Order in a lun
+ * is kept, order across luns is not, so the caller leaves raid heads out.
+ */
+struct lun_rank {
+	int key;
+	int lun;
+};
+
+static int cmp_lun_rank(const void *a, const void *b)
+{
+	return ((struct lun_rank *)a)->key - ((struct lun_rank *)b)->key;
+}
+
+void interleave_requests(struct shannon_dev *dev, struct shannon_request **reqs, int n)
+{
+	int i, k, r, lun, nlun = dev->config->luns;
+	int begin[nlun + 1], count[nlun];
+	struct lun_rank rank[nlun];
+	struct shannon_request *bylun[n];
+
+	for (lun = 0; lun < nlun; lun++) {
+		rank[lun].key = (get_phylun(dev, lun) * dev->config->nthread + get_phythread(dev, lun)) * dev->config->nchannel
+			+ get_phychannel(dev, lun);
+		rank[lun].lun = lun;
+	}
+	qsort(rank, nlun, sizeof(rank[0]), cmp_lun_rank);
+
+	/* bucket by lun, stable */
+	memset(begin, 0x00, sizeof(begin));
+	for (i = 0; i < n; i++)
+		begin[reqs[i]->lun + 1]++;
+	for (lun = 0; lun < nlun; lun++) {
+		count[lun] = begin[lun + 1];
+		begin[lun + 1] += begin[lun];
+	}
+	for (i = 0; i < n; i++)
+		bylun[begin[reqs[i]->lun]++] = reqs[i];
+	for (lun = 0; lun < nlun; lun++)
+		begin[lun] -= count[lun];
+
+	for (i = r = 0; i < n; r++) {
+		for (k = 0; k < nlun; k++) {
+			lun = rank[k].lun;
+			if (r < count[lun])
+				reqs[i++] = bylun[begin[lun] + r];
+		}
+	}
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * power budget: --power-budget is also taken as the number of dies which may program or erase at once on the board,
+ * shared evenly by channels. A multi-plane chunk occupies one die. Units of the hw_power_budget register aren`t known,
+ * so its default value doesn`t throttle anything, only a budget given by user does. Only submit_polling_loop() defers
+ * by it, other submit paths run as before.
+ */
+static int opcode_is_pe(int opcode)
+{
+	return sh_write_cmd == opcode || sh_raidwrite_cmd == opcode || sh_erase_cmd == opcode;
+}
+
+void sched_pe_setup(struct shannon_dev *dev)
+{
+	int budget = dev->power_budget;
+
+	dev->pe_limit = budget ? budget / dev->config->nchannel : 0;
+	if (budget && 0 == dev->pe_limit)
+		dev->pe_limit = 1;
+
+	if (dev->pe_limit && NULL == dev->pe_inflight) {
+		dev->pe_inflight = zmalloc(dev->config->nchannel * sizeof(*dev->pe_inflight));
+		if (NULL == dev->pe_inflight)
+			malloc_failed_exit();
+	}
+}
+
+/* return 1 if channel of req has no die left for it */
+int sched_pe_busy(struct shannon_dev *dev, struct shannon_request *req)
+{
+	if (!dev->pe_limit || !opcode_is_pe(req->opcode))
+		return 0;
+
+	if (dev->pe_inflight[dev->lun[req->lun].channel] < dev->pe_limit)
+		return 0;
+
+	dev->npe_throttle++;
+	return 1;
+}
+
+/* planes of a multi-plane chunk retire one by one, the die is held till the last of them */
+void sched_pe_start(struct shannon_dev *dev, struct shannon_request *req)
+{
+	struct shannon_request *sub;
+
+	if (!dev->pe_limit || !opcode_is_pe(req->opcode))
+		return;
+
+	dev->pe_inflight[dev->lun[req->lun].channel]++;
+	req->pe_chunk = req;
+	req->pe_counted = 1;
+	list_for_each_entry(sub, &req->chunk_list, chunk_list) {
+		sub->pe_chunk = req;
+		req->pe_counted++;
+	}
+}
+
+void sched_pe_retired(struct shannon_dev *dev, struct shannon_request *req)
+{
+	struct shannon_request *chunk = req->pe_chunk;
+
+	if (NULL == chunk)
+		return;
+
+	req->pe_chunk = NULL;
+	if (0 == --chunk->pe_counted)
+		dev->pe_inflight[dev->lun[chunk->lun].channel]--;
+}
+
+void free_sched(struct shannon_dev *dev)
+{
+	free(dev->pe_inflight);
+	dev->pe_inflight = NULL;
+}
+
+void pr_sched_stats(struct shannon_dev *dev)
+{
+	printf("plane merge: nplane=%d chunk=%ld\n", dev->config->nplane, dev->nplane_merge);
+	printf("power budget: die/channel=%d throttled=%ld\n", dev->pe_limit, dev->npe_throttle);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
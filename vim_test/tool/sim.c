@@ -0,0 +1,971 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * Userspace emulated controller selected by --dev=sim:<geometry>. Registers, dma memory and cmdqueue/cmpqueue of
+ * every thread are emulated in process by the dev function table, flash behind them is a sparse NAND model.
+ *
+ * geometry is a comma separated list, every item is optional:
+ *	ch=n		channels, default 1
+ *	th=n		threads per channel, default 2
+ *	lun=n		luns per thread, default 1
+ *	bus=8|16	flash bus width, default 16
+ *	id=b0:b1:..:b7	flash id, must be found in flash lib, default Toshiba 19nm 64GB
+ *	tR=us		page read latency, default 50
+ *	tPROG=us	page program latency, default 600
+ *	tBERS=us	block erase latency, default 3000
+ *	bad=n		factory bad blocks per 1000 blocks, default 5
+ *	ecc=n		max corrected bits injected per sector of programed page, default 4
+ *	flip=n		one data bit of a sector read is flipped behind ecc with chance 1/n, default 0 never
+ *	seed=n		seed of bad blocks and ecc injection, default 1
+ */
+#define	SIM_BAR_DWLEN		4096			/* 16KB BAR0, all of it is dumped by record_live_context() */
+#define	SIM_CTRL_TEMP_DWOFF	0x26
+#define	SIM_CTRL_TEMP_CODE	646			/* 45 Celsius */
+#define	SIM_MAX_CMDLEN		(sizeof(struct sh_write) + 256 * sizeof(struct sh_write_sector))
+#define	SIM_NRAID_HEAD		2
+#define	SIM_MAX_PLANE		8
+
+#define	SIM_STATUS_FAIL		0x41
+#define	SIM_ECC_EMPTY		0xFB
+#define	SIM_ECC_UNCORRECTABLE	0xFE
+#define	SIM_NO_DMA		0x20			/* head bit of cacheread, see submit_request() */
+
+struct sim_page {
+	int size;
+	__u8 raw[0];		/* sectors of data followed by metadata */
+};
+
+struct sim_block {
+	struct sim_page **page;	/* NULL page is erased */
+	long nerase;
+};
+
+struct sim_lun {
+	struct sim_block *blk;
+	int nblk;		/* geometry when blk is allocated, flash is freed before sim */
+	int npage;
+	long long busy_ns;	/* lun is busy until then */
+};
+
+struct sim_pending {
+	int end;		/* cmdqueue offset behind the command */
+	long long done_ns;
+};
+
+struct sim_thread {
+	void *mem;		/* 4 pages, the same layout as thread mem got by SHANNONC_IOC_GF */
+	int cmdtail;		/* commands before it have been fetched */
+	int cmphead;
+
+	struct sim_pending pending[PAGE_SIZE / QW_SIZE];
+	int first;
+	int npending;
+};
+
+struct shannon_sim {
+	int nchannel;
+	int nthread;
+	int nlun;
+	int iowidth;
+	union flash_id id;
+	long long tr_ns;
+	long long tprog_ns;
+	long long tbers_ns;
+	int bad_permille;
+	int ecc_max;
+	int flip;
+	unsigned int seed;
+	unsigned int rand_state;
+
+	__u32 regs[SIM_BAR_DWLEN];	/* little endian as hw */
+	struct sim_thread *thread;
+	struct sim_lun *lun;
+	struct sim_page *parity[SIM_NRAID_HEAD][SIM_MAX_PLANE];
+	pthread_mutex_t lock;		/* engine workers ring doorbell and read cmpq_head at the same time */
+
+	long nerase;
+	long nprogram;
+	long nread_sector;
+	long nflip;
+	long nfail;
+};
+
+static inline void *sim_dma_ptr(__u64 dma_addr)
+{
+	return (void *)(unsigned long)dma_addr;
+}
+
+static inline __u8 sim_cfg_byte(struct shannon_dev *dev, int dw, int byte)
+{
+	return le32_to_cpu(dev->sim->regs[dev->cfgreg_dwoff + dw]) >> (byte * 8);
+}
+
+static unsigned int sim_hash(unsigned int seed, unsigned int a, unsigned int b)
+{
+	unsigned int h = seed ^ (a * 0x9E3779B1u) ^ (b * 0x85EBCA77u);
+
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return h;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* NAND model */
+static int sim_bad_block(struct shannon_dev *dev, int phylun, int blk)
+{
+	if (blk < dev->config->nplane)		/* first super block is always good like real flash */
+		return 0;
+
+	return sim_hash(dev->sim->seed, phylun, blk) % 1000 < dev->sim->bad_permille;
+}
+
+static struct sim_block *sim_get_block(struct shannon_dev *dev, int phylun, int ppa)
+{
+	int blk = ppa / dev->flash->npage;
+	struct sim_lun *lun = &dev->sim->lun[phylun];
+
+	if (blk >= dev->flash_bakup->nblk)
+		return NULL;
+
+	if (NULL == lun->blk) {
+		lun->blk = zmalloc(dev->flash_bakup->nblk * sizeof(*lun->blk));
+		if (NULL == lun->blk)
+			malloc_failed_exit();
+		lun->nblk = dev->flash_bakup->nblk;
+		lun->npage = dev->flash->npage;
+	}
+
+	if (NULL == lun->blk[blk].page) {
+		lun->blk[blk].page = zmalloc(lun->npage * sizeof(*lun->blk[blk].page));
+		if (NULL == lun->blk[blk].page)
+			malloc_failed_exit();
+	}
+
+	return &lun->blk[blk];
+}
+
+static void sim_erase_block(struct shannon_dev *dev, struct sim_block *block)
+{
+	int page;
+
+	for (page = 0; page < dev->flash->npage; page++) {
+		free(block->page[page]);
+		block->page[page] = NULL;
+	}
+	block->nerase++;
+}
+
+/* raw page is page_nsector sectors, every sector is sector data followed by its metadata */
+static inline int sim_sector_stride(struct shannon_dev *dev)
+{
+	return sim_cfg_byte(dev, 1, 0) * 512 + METADATA_SIZE;
+}
+
+static struct sim_page *sim_alloc_page(int size)
+{
+	struct sim_page *page;
+
+	page = zmalloc(sizeof(*page) + size);
+	if (NULL == page)
+		malloc_failed_exit();
+	page->size = size;
+
+	return page;
+}
+
+/* raw bytes [off, off + len) of page, factory invalid block mark is put at factory_ivb position */
+static void sim_read_raw(struct shannon_dev *dev, int bad, struct sim_page *page, int row, int off, __u8 *buf, int len)
+{
+	int i, lo, hi;
+
+	memset(buf, 0x00, len);		/* erased cell reads 0x00 behind the controller */
+
+	if (bad) {
+		for (i = 0; i < 8 && dev->flash->factory_ivb[i].row != -1; i++) {
+			if (dev->flash->factory_ivb[i].row != row)
+				continue;
+			lo = dev->flash->factory_ivb[i].lo_col > off ? dev->flash->factory_ivb[i].lo_col : off;
+			hi = dev->flash->factory_ivb[i].hi_col < off + len - 1 ? dev->flash->factory_ivb[i].hi_col : off + len - 1;
+			if (lo <= hi)
+				memset(buf + lo - off, 0xFF, hi - lo + 1);
+		}
+	} else if (NULL != page && off < page->size) {
+		memcpy(buf, page->raw + off, (off + len <= page->size) ? len : page->size - off);
+	}
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* command execution */
+static void ring_read(void *dst, __u8 *ring, int pos, int len)
+{
+	int n = (len < PAGE_SIZE - pos) ? len : PAGE_SIZE - pos;
+
+	memcpy(dst, ring + pos, n);
+	if (len > n)
+		memcpy(dst + n, ring, len - n);
+}
+
+static void ring_write(__u8 *ring, int pos, void *src, int len)
+{
+	int n = (len < PAGE_SIZE - pos) ? len : PAGE_SIZE - pos;
+
+	memcpy(ring + pos, src, n);
+	if (len > n)
+		memcpy(ring, src + n, len - n);
+}
+
+static void sim_status(__u8 *cmpq, int pos, __u64 status)
+{
+	status = cpu_to_le64(status);
+	ring_write(cmpq, pos, &status, QW_SIZE);
+}
+
+static int sim_cmdlen(struct shannon_dev *dev, __u8 *cmd)
+{
+	switch (cmd[0]) {
+	case sh_writereg_cmd:
+		return sizeof(struct sh_writereg) + ((((struct sh_writereg *)cmd)->nbyte > 1) ? 8 : 0);
+	case sh_cacheread_cmd:
+	case sh_last_cacheread_cmd:
+	case sh_cacheread_adv_cmd:
+		return sizeof(struct sh_cacheread) + (((struct sh_cacheread *)cmd)->nsector + 1) * QW_SIZE;
+	case sh_write_cmd:
+		return sizeof(struct sh_write) + (sim_cfg_byte(dev, 0, 1) + 1) * sizeof(struct sh_write_sector);
+	case sh_bufwrite_cmd:
+		return sizeof(struct sh_bufwrite);
+	default:
+		return QW_SIZE;
+	}
+}
+
+/* planes of a multi-plane operation run together, only the last plane costs latency */
+static long long sim_plane_ns(struct shannon_dev *dev, int head, int ppa, long long ns)
+{
+	int nplane = dev->config->nplane;
+
+	if (((head >> SH_ERASE_PLANE_SHIFT) & 0x01) && nplane > 1 && (ppa / dev->flash->npage) % nplane != nplane - 1)
+		return 0;
+	return ns;
+}
+
+static void sim_parity_xor(struct shannon_dev *dev, int head, int plane, struct sim_page *page)
+{
+	int i;
+	struct sim_page **parity = &dev->sim->parity[head][plane];
+
+	if (NULL == *parity || (*parity)->size != page->size) {
+		free(*parity);
+		*parity = sim_alloc_page(page->size);
+	}
+
+	for (i = 0; i < page->size; i++)
+		(*parity)->raw[i] ^= page->raw[i];
+}
+
+static __u64 sim_program(struct shannon_dev *dev, int phylun, int ppa, struct sim_page *page)
+{
+	struct sim_block *block;
+
+	block = sim_get_block(dev, phylun, ppa);
+	if (NULL == block || sim_bad_block(dev, phylun, ppa / dev->flash->npage)) {
+		free(page);
+		return SIM_STATUS_FAIL;
+	}
+
+	free(block->page[ppa % dev->flash->npage]);
+	block->page[ppa % dev->flash->npage] = page;
+	dev->sim->nprogram++;
+
+	return dev->flash->success_status;
+}
+
+static void sim_cacheread(struct shannon_dev *dev, struct sh_cacheread *cmd, int phylun, int ppa, __u8 *cmpq, int pos)
+{
+	int i, bad, stride, nsector, ecc_bypass;
+	unsigned int h;
+	struct sim_block *block;
+	struct sim_page *page;
+	__u8 ecc[256];
+	__u8 sector[sim_sector_stride(dev)];
+	void *dst;
+
+	stride = sim_sector_stride(dev);
+	nsector = cmd->nsector + 1;
+	ecc_bypass = (ECCMODE_DISABLE == sim_cfg_byte(dev, 4, 0));
+
+	block = sim_get_block(dev, phylun, ppa);
+	bad = (NULL == block) || sim_bad_block(dev, phylun, ppa / dev->flash->npage);
+	page = (NULL == block) ? NULL : block->page[ppa % dev->flash->npage];
+
+	for (i = 0; i < nsector; i++) {
+		sim_read_raw(dev, bad, page, ppa % dev->flash->npage, (cmd->bsector + i) * stride, sector, stride);
+		if (dev->sim->flip) {
+			h = sim_hash(~dev->sim->seed, phylun, ppa * 256 + cmd->bsector + i);
+			if (0 == h % dev->sim->flip) {
+				sector[(h >> 3) % (stride - METADATA_SIZE)] ^= 1 << (h & 0x07);
+				dev->sim->nflip++;
+			}
+		}
+
+		dst = sim_dma_ptr(le64_to_cpu(cmd->pte[i]));
+		if (!(cmd->head & SIM_NO_DMA) && sh_cacheread_adv_cmd != cmd->opcode && NULL != dst)
+			memcpy(dst, sector, stride - METADATA_SIZE);
+		ring_write(cmpq, (pos + (1 + i) * QW_SIZE) % PAGE_SIZE, sector + stride - METADATA_SIZE, METADATA_SIZE);
+
+		if (ecc_bypass)
+			ecc[i] = 0;
+		else if (bad)
+			ecc[i] = SIM_ECC_UNCORRECTABLE;
+		else if (NULL == page)
+			ecc[i] = SIM_ECC_EMPTY;
+		else
+			ecc[i] = rand_r(&dev->sim->rand_state) % (dev->sim->ecc_max + 1);
+	}
+	ring_write(cmpq, pos, ecc, nsector);
+	dev->sim->nread_sector += nsector;
+}
+
+/* execute one command fetched from cmdqueue, return time when it is done */
+static long long sim_exec(struct shannon_dev *dev, __u8 *cmd, __u8 *cmpq, int pos, long long now)
+{
+	int i, phylun, ppa, head, stride, nsector;
+	long long ns = 0;
+	__u64 status, pte;
+	struct sim_lun *lun;
+	struct sim_block *block;
+	struct sim_page *page;
+	struct shannon_sim *sim = dev->sim;
+	struct sh_write *sh_write = (struct sh_write *)cmd;
+
+	head = cmd[3];
+	ppa = le32_to_cpu(*(__u32 *)(cmd + 4));
+	if (sh_reset_cmd == cmd[0] || sh_readid_cmd == cmd[0] || sh_writereg_cmd == cmd[0])
+		phylun = cmd[7];
+	else
+		phylun = ppa >> 24;
+	ppa &= 0x00FFFFFF;
+
+	if (phylun >= sim->nchannel * sim->nthread * sim->nlun) {
+		sim_status(cmpq, pos, SIM_STATUS_FAIL);
+		sim->nfail++;
+		return now;
+	}
+	lun = &sim->lun[phylun];
+	status = dev->flash->success_status;
+
+	switch (cmd[0]) {
+	case sh_reset_cmd:
+	case sh_writereg_cmd:
+		break;
+
+	case sh_readid_cmd:
+		status = sim->id.longid;	/* id bytes are returned as they are */
+		break;
+
+	case sh_erase_cmd:
+		block = sim_get_block(dev, phylun, ppa);
+		if (NULL == block || sim_bad_block(dev, phylun, ppa / dev->flash->npage)) {
+			status = SIM_STATUS_FAIL;
+		} else {
+			sim_erase_block(dev, block);
+			sim->nerase++;
+		}
+		ns = sim_plane_ns(dev, head, ppa, sim->tbers_ns);
+		break;
+
+	case sh_preread_cmd:
+		ns = sim_plane_ns(dev, head, ppa, sim->tr_ns);
+		break;
+
+	case sh_cacheread_cmd:
+	case sh_last_cacheread_cmd:
+	case sh_cacheread_adv_cmd:
+		sim_cacheread(dev, (struct sh_cacheread *)cmd, phylun, ppa, cmpq, pos);
+		if (lun->busy_ns < now)
+			lun->busy_ns = now;
+		return lun->busy_ns;
+
+	case sh_write_cmd:
+		stride = sim_sector_stride(dev);
+		nsector = sim_cfg_byte(dev, 0, 1) + 1;
+		page = sim_alloc_page(nsector * stride);
+		for (i = 0; i < nsector; i++) {
+			pte = le64_to_cpu(sh_write->sector[i].pte);
+			if (pte > 1)	/* 0x1 is the no dma backdoor */
+				memcpy(page->raw + i * stride, sim_dma_ptr(pte), stride - METADATA_SIZE);
+			memcpy(page->raw + i * stride + stride - METADATA_SIZE, &sh_write->sector[i].metadata, METADATA_SIZE);
+		}
+		if ((sim_cfg_byte(dev, 3, 0) & RAIDMODE_ENABLE) && (head & HEAD_MASK) < SIM_NRAID_HEAD)
+			sim_parity_xor(dev, head & HEAD_MASK, (ppa / dev->flash->npage) % dev->config->nplane, page);
+		status = sim_program(dev, phylun, ppa, page);
+		ns = sim_plane_ns(dev, head, ppa, sim->tprog_ns);
+		break;
+
+	case sh_raidinit_cmd:
+		for (i = 0; i < SIM_MAX_PLANE && (head & HEAD_MASK) < SIM_NRAID_HEAD; i++) {
+			free(sim->parity[head & HEAD_MASK][i]);
+			sim->parity[head & HEAD_MASK][i] = NULL;
+		}
+		break;
+
+	case sh_raidwrite_cmd:
+		i = (ppa / dev->flash->npage) % dev->config->nplane;
+		if ((head & HEAD_MASK) >= SIM_NRAID_HEAD || NULL == sim->parity[head & HEAD_MASK][i]) {
+			status = SIM_STATUS_FAIL;
+		} else {
+			page = sim_alloc_page(sim->parity[head & HEAD_MASK][i]->size);
+			memcpy(page->raw, sim->parity[head & HEAD_MASK][i]->raw, page->size);
+			status = sim_program(dev, phylun, ppa, page);
+		}
+		ns = sim_plane_ns(dev, head, ppa, sim->tprog_ns);
+		break;
+
+	default:
+		status = SIM_STATUS_FAIL;
+		break;
+	}
+
+	if (status == SIM_STATUS_FAIL)
+		sim->nfail++;
+	if (sh_readid_cmd == cmd[0])
+		ring_write(cmpq, pos, &status, QW_SIZE);
+	else
+		sim_status(cmpq, pos, status);
+
+	lun->busy_ns = ((lun->busy_ns > now) ? lun->busy_ns : now) + ns;
+	return lun->busy_ns;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* thread queues */
+static inline void *sim_lunreg_ptr(struct shannon_dev *dev, int phytr, enum HW_lunreg lo)
+{
+	__u32 *reg = &dev->sim->regs[dev->lunreg_dwoff + phytr * dev->lunreg_dwsize];
+
+	return sim_dma_ptr(((__u64)le32_to_cpu(reg[lo + 1]) << 32) | le32_to_cpu(reg[lo]));
+}
+
+static void sim_reset(struct shannon_dev *dev)
+{
+	int phytr;
+	__u32 *reg;
+
+	for (phytr = 0; phytr < dev->hw_threads; phytr++) {
+		dev->sim->thread[phytr].cmdtail = dev->sim->thread[phytr].cmphead = 0;
+		dev->sim->thread[phytr].first = dev->sim->thread[phytr].npending = 0;
+
+		reg = &dev->sim->regs[dev->lunreg_dwoff + phytr * dev->lunreg_dwsize];
+		reg[HW_cmdq_head] = reg[HW_cmpq_head] = reg[HW_cmdq_tail] = 0;
+	}
+}
+
+/* new cmdhead is written: fetch and execute commands, their completion is visible when they are done */
+static void sim_doorbell(struct shannon_dev *dev, int phytr, int cmdhead)
+{
+	int len;
+	__u8 cmd[SIM_MAX_CMDLEN];
+	__u8 *cmdq, *cmpq;
+	long long now = now_ns();
+	struct sim_thread *thread = &dev->sim->thread[phytr];
+	struct sim_pending *pending;
+
+	cmdq = sim_lunreg_ptr(dev, phytr, HW_cmdq_pte_lo);
+	cmpq = sim_lunreg_ptr(dev, phytr, HW_cmpq_pte_lo);
+	cmdhead %= PAGE_SIZE;
+
+	while (thread->cmdtail != cmdhead) {
+		ring_read(cmd, cmdq, thread->cmdtail, QW_SIZE);
+		len = sim_cmdlen(dev, cmd);
+		assert(len <= sizeof(cmd));
+		ring_read(cmd, cmdq, thread->cmdtail, len);
+
+		assert(thread->npending < ARRAY_SIZE(thread->pending));
+		pending = &thread->pending[(thread->first + thread->npending++) % ARRAY_SIZE(thread->pending)];
+		pending->done_ns = sim_exec(dev, cmd, cmpq, thread->cmdtail, now);
+		thread->cmdtail = (thread->cmdtail + len) % PAGE_SIZE;
+		pending->end = thread->cmdtail;
+	}
+}
+
+/* completion is in order of cmdqueue, cmpq_head stops at the first command not done */
+static void sim_complete(struct shannon_dev *dev, int phytr)
+{
+	long long now = now_ns();
+	struct sim_thread *thread = &dev->sim->thread[phytr];
+	struct sim_pending *pending;
+
+	while (thread->npending) {
+		pending = &thread->pending[thread->first];
+		if (pending->done_ns > now)
+			break;
+		thread->cmphead = pending->end;
+		thread->first = (thread->first + 1) % ARRAY_SIZE(thread->pending);
+		thread->npending--;
+	}
+
+	dev->sim->regs[dev->lunreg_dwoff + phytr * dev->lunreg_dwsize + HW_cmpq_head] = cpu_to_le32(thread->cmphead);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* registers */
+static int sim_lunreg(struct shannon_dev *dev, int dwoff, int *phytr)
+{
+	if (dwoff < dev->lunreg_dwoff || dwoff >= dev->lunreg_dwoff + dev->hw_threads * dev->lunreg_dwsize)
+		return -1;
+
+	*phytr = (dwoff - dev->lunreg_dwoff) / dev->lunreg_dwsize;
+	return (dwoff - dev->lunreg_dwoff) % dev->lunreg_dwsize;
+}
+
+/* codeword_size is calculated by hw from sector config: data, metadata share and bch parity */
+static void sim_codeword(struct shannon_dev *dev, __u32 secto)
+{
+	int sector_size, ncodeword, codeword;
+	__u32 *reg = &dev->sim->regs[dev->cfgreg_dwoff + HW_cfg_ecc];
+
+	sector_size = (secto & 0xFF) * 512;
+	ncodeword = (secto >> 8) & 0xFF;
+	if (!ncodeword)
+		return;
+
+	codeword = sector_size / ncodeword + (METADATA_SIZE + ncodeword - 1) / ncodeword + (dev->tmode * dev->mmode + 7) / 8;
+	codeword = (codeword + 1) & ~1;
+	*reg = cpu_to_le32((le32_to_cpu(*reg) & 0xFFFF) | (codeword << 16));
+}
+
+static __u32 sim_ioread32(struct shannon_dev *dev, int dwoff)
+{
+	int phytr;
+	__u32 value;
+
+	assert(dwoff >= 0 && dwoff < SIM_BAR_DWLEN);
+
+	pthread_mutex_lock(&dev->sim->lock);
+	if (HW_cmpq_head == sim_lunreg(dev, dwoff, &phytr))
+		sim_complete(dev, phytr);
+
+	value = le32_to_cpu(dev->sim->regs[dwoff]);
+	pthread_mutex_unlock(&dev->sim->lock);
+
+	return value;
+}
+
+static void sim_iowrite32(struct shannon_dev *dev, __u32 value, int dwoff)
+{
+	int phytr;
+	__u32 *reg = &dev->sim->regs[dwoff];
+
+	assert(dwoff >= 0 && dwoff < SIM_BAR_DWLEN);
+
+	pthread_mutex_lock(&dev->sim->lock);
+	if (dwoff == dev->cfgreg_dwoff + HW_cfg_ecc)		/* codeword_nbyte is readonly */
+		value = (value & 0xFFFF) | (le32_to_cpu(*reg) & 0xFFFF0000);
+	*reg = cpu_to_le32(value);
+
+	if (dwoff == dev->cfgreg_dwoff + HW_cfg_flash && (value & (1u << 24)))
+		sim_reset(dev);
+	else if (dwoff == dev->cfgreg_dwoff + HW_cfg_secto)
+		sim_codeword(dev, value);
+	else if (HW_cmdq_head == sim_lunreg(dev, dwoff, &phytr))
+		sim_doorbell(dev, phytr, value);
+	pthread_mutex_unlock(&dev->sim->lock);
+}
+
+static __u32 sim_raw_readl(struct shannon_dev *dev, int dwoff)
+{
+	return cpu_to_le32(sim_ioread32(dev, dwoff));
+}
+
+static void sim_raw_writel(struct shannon_dev *dev, __u32 value, int dwoff)
+{
+	sim_iowrite32(dev, le32_to_cpu(value), dwoff);
+}
+
+/* multi read is a snapshot of registers without side effect */
+static void sim_multi_raw_readl(struct shannon_dev *dev, __u32 *des, int dwoff, int dwlen)
+{
+	assert(dwoff >= 0 && dwoff + dwlen <= SIM_BAR_DWLEN);
+	memcpy(des, &dev->sim->regs[dwoff], dwlen * DW_SIZE);
+}
+
+static void sim_multi_ioread32(struct shannon_dev *dev, __u32 *des, int dwoff, int dwlen)
+{
+	int i;
+
+	sim_multi_raw_readl(dev, des, dwoff, dwlen);
+	for (i = 0; i < dwlen; i++)
+		le32_to_cpus(&des[i]);
+}
+
+static void sim_multi_raw_writel(struct shannon_dev *dev, __u32 *src, int dwoff, int dwlen)
+{
+	int i;
+
+	for (i = 0; i < dwlen; i++)
+		sim_raw_writel(dev, src[i], dwoff + i);
+}
+
+static void sim_multi_iowrite32(struct shannon_dev *dev, __u32 *src, int dwoff, int dwlen)
+{
+	int i;
+
+	for (i = 0; i < dwlen; i++)
+		sim_iowrite32(dev, src[i], dwoff + i);
+}
+
+static __u32 sim_ioread_lunreg(struct shannon_dev *dev, int lun, enum HW_lunreg dwoff)
+{
+	return sim_ioread32(dev, dev->lunreg_dwoff + (log2phy_lun(dev, lun) / dev->hw_nlun) * dev->lunreg_dwsize + dwoff);
+}
+
+static void sim_iowrite_lunreg(struct shannon_dev *dev, __u32 value, int lun, enum HW_lunreg dwoff)
+{
+	sim_iowrite32(dev, value, dev->lunreg_dwoff + (log2phy_lun(dev, lun) / dev->hw_nlun) * dev->lunreg_dwsize + dwoff);
+}
+
+/* no write buffer is emulated, buflun registers are plain registers */
+static __u32 sim_ioread_buflunreg(struct shannon_dev *dev, int head, enum HW_lunreg dwoff)
+{
+	assert(head < 2);
+	return sim_ioread32(dev, dev->lunreg_dwoff + (dev->hw_threads + head) * dev->lunreg_dwsize + dwoff);
+}
+
+static void sim_iowrite_buflunreg(struct shannon_dev *dev, __u32 value, int head, enum HW_lunreg dwoff)
+{
+	assert(head < 2);
+	sim_iowrite32(dev, value, dev->lunreg_dwoff + (dev->hw_threads + head) * dev->lunreg_dwsize + dwoff);
+}
+
+static void sim_ioread_config(struct shannon_dev *dev)
+{
+	assert(NULL != dev->hw_config);
+
+	sim_multi_raw_readl(dev, (__u32 *)dev->hw_config, dev->cfgreg_dwoff, sizeof(*dev->hw_config) / DW_SIZE);
+	le16_to_cpus(&dev->hw_config->hw_full_sector_nbyte);
+	le16_to_cpus(&dev->hw_config->hw_full_page_nbyte);
+	le16_to_cpus(&dev->hw_config->hw_codeword_nbyte);
+	le32_to_cpus(&dev->hw_config->hw_dw6_srv);
+}
+
+static void sim_iowrite_config(struct shannon_dev *dev)
+{
+	struct hw_config hwcfg;
+
+	assert(NULL != dev->hw_config);
+
+	memcpy(&hwcfg, dev->hw_config, sizeof(hwcfg));
+	cpu_to_le16s(&hwcfg.hw_full_sector_nbyte);
+	cpu_to_le16s(&hwcfg.hw_full_page_nbyte);
+	cpu_to_le16s(&hwcfg.hw_codeword_nbyte);
+	cpu_to_le32s(&hwcfg.hw_dw6_srv);
+
+	sim_multi_raw_writel(dev, (__u32 *)&hwcfg, dev->cfgreg_dwoff, sizeof(hwcfg) / DW_SIZE);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* dma memory is process memory, dma_addr is its virtual address */
+static void sim_get_mem(struct shannon_dev *dev, struct memory *mem)
+{
+	INIT_LIST_HEAD(&mem->list);
+	INIT_LIST_HEAD(&mem->glist);
+
+	if (posix_memalign(&mem->kernel_addr, PAGE_SIZE, mem->size))
+		perror_exit("%s() failed", __func__);
+	memset(mem->kernel_addr, 0x00, mem->size);
+	mem->dma_addr = (dma_addr_t)(unsigned long)mem->kernel_addr;
+
+	list_add_tail(&mem->glist, &dev->mem_glisthead);
+}
+
+static void sim_free_mem(struct shannon_dev *dev, struct memory *mem)
+{
+	free(mem->kernel_addr);
+	list_del(&mem->glist);
+}
+
+static void sim_read_mem(struct shannon_dev *dev, void *user_addr, void *kernel_addr, int size)
+{
+	memcpy(user_addr, kernel_addr, size);
+}
+
+static void sim_write_mem(struct shannon_dev *dev, void *kernel_addr, void *user_addr, int size)
+{
+	memcpy(kernel_addr, user_addr, size);
+}
+
+static void sim_read_mem_v(struct shannon_dev *dev, struct shannon_iovec *iov, int niov)
+{
+	int i;
+
+	for (i = 0; i < niov; i++)
+		memcpy(iov[i].user_addr, iov[i].kernel_addr, iov[i].size);
+}
+
+static void sim_write_mem_v(struct shannon_dev *dev, struct shannon_iovec *iov, int niov)
+{
+	int i;
+
+	for (i = 0; i < niov; i++)
+		memcpy(iov[i].kernel_addr, iov[i].user_addr, iov[i].size);
+}
+
+static void sim_deliver_userdata(struct shannon_dev *dev)
+{
+	/* no driver to deliver to */
+}
+
+static void sim_do_direct_io(struct shannon_dev *dev, struct direct_io *dio)
+{
+	printf("%s(): direct io is done by driver, sim device doesn't support it\n", __func__);
+	exit(EXIT_FAILURE);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+static int parse_sim_geometry(struct shannon_sim *sim, char *geometry)
+{
+	int i;
+	char *s, *opt, *val, *endptr, *saveptr;
+
+	sim->nchannel = 1;
+	sim->nthread = 2;
+	sim->nlun = 1;
+	sim->iowidth = 2;
+	sim->id.longid = 0x0408d77a93953a98ULL;
+	sim->tr_ns = 50 * 1000LL;
+	sim->tprog_ns = 600 * 1000LL;
+	sim->tbers_ns = 3000 * 1000LL;
+	sim->bad_permille = 5;
+	sim->ecc_max = 4;
+	sim->seed = 1;
+
+	s = strdup(geometry);
+	if (NULL == s)
+		return ERR;
+
+	for (opt = strtok_r(s, ",", &saveptr); NULL != opt; opt = strtok_r(NULL, ",", &saveptr)) {
+		val = strchr(opt, '=');
+		if (NULL == val)
+			goto invalid;
+		*val++ = '\0';
+
+		if (!strcmp(opt, "ch")) {
+			sim->nchannel = atoi(val);
+		} else if (!strcmp(opt, "th")) {
+			sim->nthread = atoi(val);
+		} else if (!strcmp(opt, "lun")) {
+			sim->nlun = atoi(val);
+		} else if (!strcmp(opt, "bus")) {
+			sim->iowidth = atoi(val) / 8;
+		} else if (!strcmp(opt, "id")) {
+			for (i = 0; i < 8; i++) {
+				sim->id.byteid[i] = strtoul(val, &endptr, 16);
+				if (endptr == val || (i < 7 && ':' != *endptr))
+					goto invalid;
+				val = endptr + 1;
+			}
+		} else if (!strcmp(opt, "tR")) {
+			sim->tr_ns = atol(val) * 1000LL;
+		} else if (!strcmp(opt, "tPROG")) {
+			sim->tprog_ns = atol(val) * 1000LL;
+		} else if (!strcmp(opt, "tBERS")) {
+			sim->tbers_ns = atol(val) * 1000LL;
+		} else if (!strcmp(opt, "bad")) {
+			sim->bad_permille = atoi(val);
+		} else if (!strcmp(opt, "ecc")) {
+			sim->ecc_max = atoi(val);
+		} else if (!strcmp(opt, "flip")) {
+			sim->flip = atoi(val);
+		} else if (!strcmp(opt, "seed")) {
+			sim->seed = strtoul(val, NULL, 0);
+		} else {
+			goto invalid;
+		}
+	}
+
+	if (sim->nchannel < 1 || sim->nchannel > 32 || sim->nthread < 1 || sim->nthread > 15 ||
+			sim->nlun < 1 || sim->nlun > 16 || sim->nchannel * sim->nthread > 256 || (1 != sim->iowidth && 2 != sim->iowidth) ||
+			sim->tr_ns < 0 || sim->tprog_ns < 0 || sim->tbers_ns < 0 ||
+			sim->bad_permille < 0 || sim->bad_permille > 1000 || sim->ecc_max < 0 || sim->ecc_max >= SIM_ECC_EMPTY ||
+			sim->flip < 0) {
+		printf("Invalid sim geometry: %s\n", geometry);
+		free(s);
+		return ERR;
+	}
+
+	free(s);
+	return 0;
+
+invalid:
+	printf("Invalid sim geometry item: %s\n", opt);
+	free(s);
+	return ERR;
+}
+
+static void init_sim_regs(struct shannon_dev *dev)
+{
+	struct shannon_sim *sim = dev->sim;
+	struct hw_sysinfo sysinfo;
+
+	memset(&sysinfo, 0x00, sizeof(sysinfo));
+	sysinfo.hw_version = 4;				/* no advance read microcode */
+	sysinfo.hw_if_support = ((sim->nlun > 1) ? (1 << CE_NLUN_SHIFT) : 0) | 0x0F;
+	sysinfo.hw_nchannel = sim->nchannel;
+	sysinfo.hw_nthread_nlun = sim->nthread | ((sim->nlun - 1) << 4);
+	sysinfo.hw_raid_support = 1;
+	sysinfo.hw_nraid_head = SIM_NRAID_HEAD;
+	sysinfo.hw_misc_1 = ((sim->iowidth - 1) << 4) | 0x03;	/* 64KB multi-plane page */
+	sysinfo.hw_ecc_mode = (2 == sim->iowidth) ? 0x02 : 0x01;
+	sysinfo.hw_ecc_tmode = 0x04;
+	sysinfo.firmware_tag = cpu_to_le32(0x5349D000);
+
+	memcpy(&sim->regs[dev->sysreg_dwoff], &sysinfo, sizeof(sysinfo));
+	sim->regs[SIM_CTRL_TEMP_DWOFF] = cpu_to_le32(SIM_CTRL_TEMP_CODE);
+}
+
+/*
+ * called by alloc_device() instead of opening /dev/shannon_cdev
+ */
+int alloc_sim(struct shannon_dev *dev, char *geometry)
+{
+	int phytr, threads;
+	struct shannon_sim *sim;
+
+	if (sizeof(dma_addr_t) < sizeof(void *)) {
+		printf("sim device needs DMA_ADDR_LENGTH=8\n");
+		return ERR;
+	}
+
+	sim = zmalloc(sizeof(*sim));
+	if (NULL == sim)
+		return ALLOCMEM_FAILED;
+
+	if (parse_sim_geometry(sim, geometry))
+		goto free_sim_out;
+	sim->rand_state = sim->seed;
+	pthread_mutex_init(&sim->lock, NULL);
+
+	threads = sim->nchannel * sim->nthread;
+	sim->thread = zmalloc(threads * sizeof(*sim->thread));
+	if (NULL == sim->thread)
+		goto free_sim_out;
+	for (phytr = 0; phytr < threads; phytr++) {
+		if (posix_memalign(&sim->thread[phytr].mem, PAGE_SIZE, 4 * PAGE_SIZE))
+			goto free_thread_out;
+		memset(sim->thread[phytr].mem, 0x00, 4 * PAGE_SIZE);
+	}
+
+	sim->lun = zmalloc(threads * sim->nlun * sizeof(*sim->lun));
+	if (NULL == sim->lun)
+		goto free_thread_out;
+
+	dev->sim = sim;
+	dev->fd = -1;
+	dev->bar_dwlen[0] = SIM_BAR_DWLEN;
+	dev->bar_dwlen[1] = 0;
+	init_sim_regs(dev);
+
+	dev->ioread32		= sim_ioread32;
+	dev->iowrite32		= sim_iowrite32;
+
+	dev->raw_readl		= sim_raw_readl;
+	dev->raw_writel		= sim_raw_writel;
+
+	dev->multi_ioread32	= sim_multi_ioread32;
+	dev->multi_iowrite32	= sim_multi_iowrite32;
+
+	dev->multi_raw_readl	= sim_multi_raw_readl;
+	dev->multi_raw_writel	= sim_multi_raw_writel;
+
+	dev->ioread_lunreg	= sim_ioread_lunreg;
+	dev->iowrite_lunreg	= sim_iowrite_lunreg;
+
+	dev->ioread_buflunreg	= sim_ioread_buflunreg;
+	dev->iowrite_buflunreg	= sim_iowrite_buflunreg;
+
+	dev->ioread_config	= sim_ioread_config;
+	dev->iowrite_config	= sim_iowrite_config;
+
+	dev->get_mem		= sim_get_mem;
+	dev->free_mem		= sim_free_mem;
+	dev->read_mem		= sim_read_mem;
+	dev->write_mem		= sim_write_mem;
+	dev->read_mem_v		= sim_read_mem_v;
+	dev->write_mem_v	= sim_write_mem_v;
+
+	dev->deliver_userdata	= sim_deliver_userdata;
+	dev->do_direct_io	= sim_do_direct_io;
+
+	return 0;
+
+free_thread_out:
+	for (phytr = 0; phytr < threads; phytr++)
+		free(sim->thread[phytr].mem);
+	free(sim->thread);
+free_sim_out:
+	free(sim);
+	return ERR;
+}
+
+/* the same as SHANNONC_IOC_GF */
+void get_sim_thread_mem(struct shannon_dev *dev)
+{
+	int phytr;
+
+	for (phytr = 0; phytr < dev->hw_threads; phytr++) {
+		dev->phythread_mem[phytr].kernel_addr = dev->sim->thread[phytr].mem;
+		dev->phythread_mem[phytr].dma_addr = (dma_addr_t)(unsigned long)dev->sim->thread[phytr].mem;
+	}
+}
+
+void free_sim(struct shannon_dev *dev)
+{
+	int phylun, blk, page, head, plane;
+	struct shannon_sim *sim = dev->sim;
+	struct sim_lun *lun;
+
+	for (phylun = 0; phylun < sim->nchannel * sim->nthread * sim->nlun; phylun++) {
+		lun = &sim->lun[phylun];
+		if (NULL == lun->blk)
+			continue;
+
+		for (blk = 0; blk < lun->nblk; blk++) {
+			if (NULL == lun->blk[blk].page)
+				continue;
+			for (page = 0; page < lun->npage; page++)
+				free(lun->blk[blk].page[page]);
+			free(lun->blk[blk].page);
+		}
+		free(lun->blk);
+	}
+
+	for (head = 0; head < SIM_NRAID_HEAD; head++) {
+		for (plane = 0; plane < SIM_MAX_PLANE; plane++)
+			free(sim->parity[head][plane]);
+	}
+
+	for (phylun = 0; phylun < sim->nchannel * sim->nthread; phylun++)
+		free(sim->thread[phylun].mem);
+	free(sim->thread);
+	free(sim->lun);
+	free(sim);
+	dev->sim = NULL;
+}
+
+void pr_sim_stats(struct shannon_dev *dev)
+{
+	struct shannon_sim *sim = dev->sim;
+
+	printf("sim: erase=%ld program=%ld read_sector=%ld flipped_sector=%ld failed_status=%ld\n",
+		sim->nerase, sim->nprogram, sim->nread_sector, sim->nflip, sim->nfail);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "tool.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * data kernels of verify paths. The tool is built for a generic cpu, so x86 AVX2 kernels are compiled by target attribute
+ * and picked at run time, aarch64 always has NEON. Every kernel has a scalar fallback giving the same result.
+ */
+int cpu_has_avx2(void)
+{
+#if defined(__x86_64__)
+	static int has_avx2 = -1;
+
+	if (has_avx2 < 0)
+		has_avx2 = __builtin_cpu_supports("avx2");
+	return has_avx2;
+#else
+	return 0;
+#endif
+}
+
+static long xor_popcount_scalar(const __u8 *a, const __u8 *b, int n)
+{
+	int i;
+	long nbit = 0;
+	__u64 x, y;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		nbit += __builtin_popcountll(x ^ y);
+	}
+	for (; i < n; i++)
+		nbit += __builtin_popcount(a[i] ^ b[i]);
+	return nbit;
+}
+
+#if defined(__x86_64__)
+/* popcount of bytes by nibble lookup, summed to 4 QWs by sad */
+__attribute__((target("avx2")))
+static long xor_popcount_avx2(const __u8 *a, const __u8 *b, int n, int *done)
+{
+	int i;
+	__m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+				       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	__m256i low = _mm256_set1_epi8(0x0F);
+	__m256i sum = _mm256_setzero_si256();
+	__m256i x, cnt;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		x = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(a + i)), _mm256_loadu_si256((__m256i *)(b + i)));
+		cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+				      _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+
+	*done = i;
+	return _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+}
+#endif
+
+/* number of different bits between a and b */
+long xor_popcount(const void *a, const void *b, int n)
+{
+	int done = 0;
+	long nbit = 0;
+
+#if defined(__x86_64__)
+	if (cpu_has_avx2())
+		nbit = xor_popcount_avx2(a, b, n, &done);
+#elif defined(__aarch64__)
+	uint64x2_t sum = vdupq_n_u64(0);
+
+	for (; done + 16 <= n; done += 16) {
+		uint8x16_t x = veorq_u8(vld1q_u8((__u8 *)a + done), vld1q_u8((__u8 *)b + done));
+		sum = vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(vcntq_u8(x))));
+	}
+	nbit = vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+#endif
+
+	return nbit + xor_popcount_scalar((__u8 *)a + done, (__u8 *)b + done, n - done);
+}
+
+/*
+ * lane split of xor_popcount() for 16bit flash bus, even bytes are low byte lane and odd bytes high byte lane. Different
+ * bits and different bytes of every lane are added to nbit[] and nbyte[], a is taken as starting at an even offset
+ */
+static void xor_popcount_lanes_scalar(const __u8 *a, const __u8 *b, int n, long nbit[2], long nbyte[2])
+{
+	int i;
+	__u8 x;
+
+	for (i = 0; i < n; i++) {
+		x = a[i] ^ b[i];
+		nbit[i & 0x01] += __builtin_popcount(x);
+		nbyte[i & 0x01] += !!x;
+	}
+}
+
+#if defined(__x86_64__)
+/* bytes of one lane are kept by mask before summed by sad, so no shuffle is needed to deinterleave them */
+__attribute__((target("avx2")))
+static int xor_popcount_lanes_avx2(const __u8 *a, const __u8 *b, int n, long nbit[2], long nbyte[2])
+{
+	int i, lane;
+	__m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+				       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	__m256i low = _mm256_set1_epi8(0x0F), one = _mm256_set1_epi8(1), zero = _mm256_setzero_si256();
+	__m256i lanemask[2] = {_mm256_set1_epi16(0x00FF), _mm256_set1_epi16((short)0xFF00)};
+	__m256i sbit[2] = {zero, zero}, sbyte[2] = {zero, zero};
+	__m256i x, cnt, diff;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		x = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(a + i)), _mm256_loadu_si256((__m256i *)(b + i)));
+		cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+				      _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+		diff = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, zero), one);
+
+		for (lane = 0; lane < 2; lane++) {
+			sbit[lane] = _mm256_add_epi64(sbit[lane], _mm256_sad_epu8(_mm256_and_si256(cnt, lanemask[lane]), zero));
+			sbyte[lane] = _mm256_add_epi64(sbyte[lane], _mm256_sad_epu8(_mm256_and_si256(diff, lanemask[lane]), zero));
+		}
+	}
+
+	for (lane = 0; lane < 2; lane++) {
+		nbit[lane] += _mm256_extract_epi64(sbit[lane], 0) + _mm256_extract_epi64(sbit[lane], 1) +
+			_mm256_extract_epi64(sbit[lane], 2) + _mm256_extract_epi64(sbit[lane], 3);
+		nbyte[lane] += _mm256_extract_epi64(sbyte[lane], 0) + _mm256_extract_epi64(sbyte[lane], 1) +
+			_mm256_extract_epi64(sbyte[lane], 2) + _mm256_extract_epi64(sbyte[lane], 3);
+	}
+	return i;
+}
+#elif defined(__aarch64__)
+/* vld2q deinterleaves even and odd bytes at load */
+static int xor_popcount_lanes_neon(const __u8 *a, const __u8 *b, int n, long nbit[2], long nbyte[2])
+{
+	int i, lane;
+	uint8x16x2_t va, vb;
+	uint8x16_t x;
+	uint64x2_t sbit[2] = {vdupq_n_u64(0), vdupq_n_u64(0)}, sbyte[2] = {vdupq_n_u64(0), vdupq_n_u64(0)};
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		va = vld2q_u8(a + i);
+		vb = vld2q_u8(b + i);
+		for (lane = 0; lane < 2; lane++) {
+			x = veorq_u8(va.val[lane], vb.val[lane]);
+			sbit[lane] = vpadalq_u32(sbit[lane], vpaddlq_u16(vpaddlq_u8(vcntq_u8(x))));
+			sbyte[lane] = vpadalq_u32(sbyte[lane], vpaddlq_u16(vpaddlq_u8(vminq_u8(x, vdupq_n_u8(1)))));
+		}
+	}
+
+	for (lane = 0; lane < 2; lane++) {
+		nbit[lane] += vgetq_lane_u64(sbit[lane], 0) + vgetq_lane_u64(sbit[lane], 1);
+		nbyte[lane] += vgetq_lane_u64(sbyte[lane], 0) + vgetq_lane_u64(sbyte[lane], 1);
+	}
+	return i;
+}
+#endif
+
+void xor_popcount_lanes(const void *a, const void *b, int n, long nbit[2], long nbyte[2])
+{
+	int done = 0;
+
+#if defined(__x86_64__)
+	if (cpu_has_avx2())
+		done = xor_popcount_lanes_avx2(a, b, n, nbit, nbyte);
+#elif defined(__aarch64__)
+	done = xor_popcount_lanes_neon(a, b, n, nbit, nbyte);
+#endif
+
+	/* done is even, so lanes of the rest keep their parity */
+	xor_popcount_lanes_scalar((__u8 *)a + done, (__u8 *)b + done, n - done, nbit, nbyte);
+}
+
+/* dst ^= src, for raid parity */
+static void xor_into_scalar(__u8 *dst, const __u8 *src, int n)
+{
+	int i;
+	__u64 x, y;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		memcpy(&x, dst + i, 8);
+		memcpy(&y, src + i, 8);
+		x ^= y;
+		memcpy(dst + i, &x, 8);
+	}
+	for (; i < n; i++)
+		dst[i] ^= src[i];
+}
+
+#if defined(__x86_64__)
+/* 4 loads in flight per step, sector size is multiple of 128 */
+__attribute__((target("avx2")))
+static int xor_into_avx2(__u8 *dst, const __u8 *src, int n)
+{
+	int i, k;
+	__m256i x[4];
+
+	for (i = 0; i + 128 <= n; i += 128) {
+		for (k = 0; k < 4; k++)
+			x[k] = _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(dst + i + 32 * k)), _mm256_loadu_si256((__m256i *)(src + i + 32 * k)));
+		for (k = 0; k < 4; k++)
+			_mm256_storeu_si256((__m256i *)(dst + i + 32 * k), x[k]);
+	}
+	return i;
+}
+#endif
+
+void xor_into(void *dst, const void *src, int n)
+{
+	int done = 0;
+
+#if defined(__x86_64__)
+	if (cpu_has_avx2())
+		done = xor_into_avx2(dst, src, n);
+#elif defined(__aarch64__)
+	for (; done + 16 <= n; done += 16)
+		vst1q_u8((__u8 *)dst + done, veorq_u8(vld1q_u8((__u8 *)dst + done), vld1q_u8((__u8 *)src + done)));
+#endif
+
+	xor_into_scalar((__u8 *)dst + done, (__u8 *)src + done, n - done);
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/
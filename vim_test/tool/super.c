@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "tool.h"
 
@@ -642,6 +643,209 @@ free_req_out:
 }
 
 /*-----------------------------------------------------------------------------------------------------------*/
+/*
+ * data generation pipeline of super-write: main thread allocates write requests of the pages ahead into a ring of
+ * slots, generator threads fill their sectors while main thread submits and polls the page before them. Main thread
+ * waits for the oldest slot to be filled and allocates no more when ring is full, so a slow generator throttles
+ * submission and a slow flash throttles generation. Without generator thread the ring has one slot filled inline.
+ */
+#define	WRGEN_MAX_THREAD	4
+
+struct wrgen_slot {
+	int blk;
+	int page;
+	int ready;
+	struct list_head req_head;	/* write chunk heads of this page */
+};
+
+struct wrgen {
+	struct shannon_dev *dev;
+	int seed;
+	int nthread;
+	int depth;
+	int stop;
+	unsigned long head;		/* oldest slot, next to submit */
+	unsigned long fill;		/* next slot for generator */
+	unsigned long tail;		/* next slot to allocate */
+	pthread_t tid[WRGEN_MAX_THREAD];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* slot to fill is added, slot is ready or stop */
+	struct wrgen_slot slot[WRGEN_MAX_THREAD + 2];
+};
+
+/* fill all sectors of write requests of one page, sector pattern only depends on seed and address */
+static void super_write_fill(struct shannon_dev *dev, int seed, struct list_head *req_head)
+{
+	struct shannon_request *req, *sub;
+
+	list_for_each_entry(req, req_head, list) {
+		prng_fill_request(dev, dev->pattern, seed, req);
+		list_for_each_entry(sub, &req->chunk_list, chunk_list)
+			prng_fill_request(dev, dev->pattern, seed, sub);
+	}
+}
+
+static void *wrgen_main(void *arg)
+{
+	struct wrgen *wg = arg;
+	struct wrgen_slot *slot;
+
+	pthread_mutex_lock(&wg->lock);
+	while (1) {
+		while (!wg->stop && wg->fill == wg->tail)
+			pthread_cond_wait(&wg->cond, &wg->lock);
+		if (wg->stop)
+			break;
+
+		slot = &wg->slot[wg->fill++ % wg->depth];
+		pthread_mutex_unlock(&wg->lock);
+
+		super_write_fill(wg->dev, wg->seed, &slot->req_head);
+
+		pthread_mutex_lock(&wg->lock);
+		slot->ready = 1;
+		pthread_cond_broadcast(&wg->cond);
+	}
+	pthread_mutex_unlock(&wg->lock);
+
+	return NULL;
+}
+
+static int init_wrgen(struct shannon_dev *dev, struct wrgen *wg, int seed, int nthread)
+{
+	int i;
+
+	memset(wg, 0x00, sizeof(*wg));
+	wg->dev = dev;
+	wg->seed = seed;
+	wg->depth = nthread ? nthread + 2 : 1;
+	for (i = 0; i < wg->depth; i++)
+		INIT_LIST_HEAD(&wg->slot[i].req_head);
+	pthread_mutex_init(&wg->lock, NULL);
+	pthread_cond_init(&wg->cond, NULL);
+
+	for (wg->nthread = 0; wg->nthread < nthread; wg->nthread++) {
+		if (pthread_create(&wg->tid[wg->nthread], NULL, wrgen_main, wg)) {
+			printf("%s() create generator %d failed\n", __func__, wg->nthread);
+			return ERR;
+		}
+	}
+
+	return 0;
+}
+
+/* generators are stopped before requests they may be filling are freed */
+static void free_wrgen(struct wrgen *wg)
+{
+	int i;
+	struct shannon_request *req, *tmp;
+
+	pthread_mutex_lock(&wg->lock);
+	wg->stop = 1;
+	pthread_cond_broadcast(&wg->cond);
+	pthread_mutex_unlock(&wg->lock);
+
+	for (i = 0; i < wg->nthread; i++)
+		pthread_join(wg->tid[i], NULL);
+
+	for (i = 0; i < wg->depth; i++) {
+		list_for_each_entry_safe(req, tmp, &wg->slot[i].req_head, list) {
+			list_del(&req->list);
+			free_request(req);
+		}
+	}
+	pthread_mutex_destroy(&wg->lock);
+	pthread_cond_destroy(&wg->cond);
+}
+
+/* allocate write requests of one page of superblock blk, data is left to super_write_fill() */
+static int super_write_alloc_page(struct shannon_dev *dev, int blk, int page, int head, struct list_head *req_head)
+{
+	int lun, plane;
+	int ppa = blk * dev->config->nplane * dev->flash->npage;
+	struct shannon_request *chunk_head_req, *req;
+
+	for_dev_each_lun(dev, lun) {
+		if (is_bad_lunblock(dev, lun, blk))
+			continue;
+
+		if (dev->config->raid_mode && (head & HEAD_MASK) != INDEP_HEAD &&  superblock_paritylun(dev, blk) == lun)	// raid lun
+			continue;
+
+		chunk_head_req = alloc_request_no_dma(dev, sh_write_cmd, lun, ppa + page, head, 0, dev->config->page_nsector, REQ_DMA_MAPPED);
+		if (NULL == chunk_head_req)
+			return ALLOCMEM_FAILED;
+		list_add_tail(&chunk_head_req->list, req_head);
+
+		for (plane = 1; plane < dev->config->nplane; plane++) {
+			req = alloc_request_no_dma(dev, sh_write_cmd, lun, ppa + plane * dev->flash->npage + page, head, 0, dev->config->page_nsector, REQ_DMA_MAPPED);
+			if (NULL ==req)
+				return ALLOCMEM_FAILED;
+			list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
+		}
+	}
+
+	return 0;
+}
+
+/* allocate the next page into ring and hand it to generators, return 0 if ring is full or no page is left */
+static int wrgen_prepare(struct wrgen *wg, int end_blk, int frompage, int topage, int head, int *blk, int *page, int *rc)
+{
+	struct shannon_dev *dev = wg->dev;
+	struct wrgen_slot *slot;
+
+	if (wg->tail - wg->head == wg->depth)
+		return 0;
+
+	if (*page < topage) {
+		(*page)++;
+	} else {
+		for ((*blk)++; *blk < end_blk && is_bad_superblock(dev, *blk); (*blk)++)
+			;
+		if (*blk >= end_blk)
+			return 0;
+		*page = frompage;
+	}
+
+	slot = &wg->slot[wg->tail % wg->depth];
+	slot->blk = *blk;
+	slot->page = *page;
+	slot->ready = 0;
+	if ((*rc = super_write_alloc_page(dev, *blk, *page, head, &slot->req_head)))
+		return 0;
+
+	if (!wg->nthread) {
+		super_write_fill(dev, wg->seed, &slot->req_head);
+		slot->ready = 1;
+		wg->fill++;
+	}
+
+	pthread_mutex_lock(&wg->lock);
+	wg->tail++;
+	pthread_cond_broadcast(&wg->cond);
+	pthread_mutex_unlock(&wg->lock);
+	return 1;
+}
+
+/* wait the oldest page filled and move its requests to req_head, return NULL if ring is empty */
+static struct wrgen_slot *wrgen_take(struct wrgen *wg, struct list_head *req_head)
+{
+	struct wrgen_slot *slot;
+
+	if (wg->head == wg->tail)
+		return NULL;
+
+	slot = &wg->slot[wg->head % wg->depth];
+	pthread_mutex_lock(&wg->lock);
+	while (!slot->ready)
+		pthread_cond_wait(&wg->cond, &wg->lock);
+	wg->head++;
+	pthread_mutex_unlock(&wg->lock);
+
+	list_splice_tail_init(&slot->req_head, req_head);
+	return slot;
+}
+
 static void shannon_super_write_usage(void)
 {
 	printf("Description:\n");
@@ -667,6 +871,9 @@ static void shannon_super_write_usage(void)
 		"\t\tWrite per-blcok from this page offset\n\n");
 	printf("\t-B, --to-page=n\n"
 		"\t\tWrite per-blcok to this page offset\n\n");
+	printf("\t-j, --gen-threads=n\n"
+		"\t\tGenerate data of next pages by n threads while current page is programming, 0 generates it inline. Default is\n"
+		"\t\tonline cpus minus one and at most %d\n\n", WRGEN_MAX_THREAD);
 	printf("\t-h, --help\n"
 		"\t\tDisplay this help and exit\n\n");
 
@@ -684,19 +891,23 @@ int shannon_super_write(struct shannon_dev *dev, int argc, char **argv)
 		{"present-luns", required_argument, NULL, 'T'},
 		{"from-page", required_argument, NULL, 'A'},
 		{"to-page", required_argument, NULL, 'B'},
+		{"gen-threads", required_argument, NULL, 'j'},
 		{"help", no_argument, NULL, 'h'},
 		{0, 0, 0, 0},
 	};
-	int i, rc = 0;
+	int rc = 0;
 	int opt;
 	char *luninfo_file;
 	int seed, head, seed_way, noprogress;
-	int blk, plane, ppa, page, sector_seed;
+	int blk, plane, ppa, page;
 	int lun, begin_chunkblock, count;
 	struct shannon_request *chunk_head_req, *req, *tmp;
 	struct list_head req_head;
 	int pre_cent, now_cent;		// used for show progress
 	int frompage = 0, topage = dev->flash->npage - 1;
+	int nthread, prep_blk, prep_page;
+	struct wrgen wg;
+	struct wrgen_slot *slot;
 
 	/* analyse argument */
 	luninfo_file = NULL;
@@ -704,8 +915,13 @@ int shannon_super_write(struct shannon_dev *dev, int argc, char **argv)
 	head = INDEP_HEAD;
 	seed_way = 0;
 	noprogress = 0;
+	nthread = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (nthread > WRGEN_MAX_THREAD)
+		nthread = WRGEN_MAX_THREAD;
+	if (nthread < 0)
+		nthread = 0;
 
-	while ((opt = getopt_long(argc, argv, ":f:e:H:Nt:T:A:B:h", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, ":f:e:H:Nt:T:A:B:j:h", longopts, NULL)) != -1) {
 		switch (opt) {
 		case 'f':
 			luninfo_file = optarg;
@@ -736,6 +952,13 @@ int shannon_super_write(struct shannon_dev *dev, int argc, char **argv)
 		case 'B':
 			topage = atoi(optarg);
 			break;
+		case 'j':
+			nthread = atoi(optarg);
+			if (nthread < 0 || nthread > WRGEN_MAX_THREAD) {
+				printf("Generator threads should be 0 to %d\n", WRGEN_MAX_THREAD);
+				return ERR;
+			}
+			break;
 		case 'h':
 			shannon_super_write_usage();
 			return 0;
@@ -791,62 +1014,33 @@ int shannon_super_write(struct shannon_dev *dev, int argc, char **argv)
 
 	INIT_LIST_HEAD(&req_head);
 
-	for (blk = begin_chunkblock; blk < begin_chunkblock + count; blk++) {
-		if (is_bad_superblock(dev, blk))
-			continue;
+	if ((rc = init_wrgen(dev, &wg, seed, nthread)))
+		goto free_wrgen_out;
+	prep_blk = begin_chunkblock - 1;
+	prep_page = topage;
 
+	while (1) {
+		/* keep ring full so generators work on the next pages while this one is programming */
+		while (wrgen_prepare(&wg, begin_chunkblock + count, frompage, topage, head, &prep_blk, &prep_page, &rc))
+			;
+		if (rc)
+			goto free_wrgen_out;
+
+		/* write requests of the oldest page, wait until they are filled */
+		if (NULL == (slot = wrgen_take(&wg, &req_head)))
+			break;
+		blk = slot->blk;
+		page = slot->page;
 		ppa = blk * dev->config->nplane * dev->flash->npage;
-		page = frompage;
 
 		/* raid init before per-block if needed */
-		if (dev->config->raid_mode && (head & HEAD_MASK) != INDEP_HEAD) {
+		if (page == frompage && dev->config->raid_mode && (head & HEAD_MASK) != INDEP_HEAD) {
 			req = alloc_request(dev, sh_raidinit_cmd, superblock_paritylun(dev, blk), ppa, head, 0, superblock_ndatalun(dev, blk));
 			if (NULL == req)  {
 				rc = ALLOCMEM_FAILED;
-				goto free_req_out;
-			}
-			list_add_tail(&req->list, &req_head);
-		}
-
-next_block_page: /* write chunk */
-		for_dev_each_lun(dev, lun) {
-			if (is_bad_lunblock(dev, lun, blk))
-				continue;
-
-			if (dev->config->raid_mode && (head & HEAD_MASK) != INDEP_HEAD &&  superblock_paritylun(dev, blk) == lun)	// raid lun
-				continue;
-
-			chunk_head_req = alloc_request(dev, sh_write_cmd, lun, ppa + page, head, 0, dev->config->page_nsector);
-			if (NULL == chunk_head_req) {
-				rc = ALLOCMEM_FAILED;
-				goto free_req_out;
-			}
-			for (i = 0; i < dev->config->page_nsector; i++) {
-				sector_seed = ((ppa + page) * dev->config->page_nsector + i) + ((lun + seed)<<24);
-				srand(sector_seed);
-				pad_rand(chunk_head_req->data + i * dev->config->sector_size, dev->config->sector_size);
-				pad_rand(chunk_head_req->metadata + i, METADATA_SIZE);
-				// pad_same_u32(chunk_head_req->data + i * dev->config->sector_size, dev->config->sector_size, sector_seed);
-				// pad_same_u32(chunk_head_req->metadata + i, METADATA_SIZE, sector_seed);
-			}
-			list_add_tail(&chunk_head_req->list, &req_head);
-
-			for (plane = 1; plane < dev->config->nplane; plane++) {
-				req = alloc_request(dev, sh_write_cmd, lun, ppa + plane * dev->flash->npage + page, head, 0, dev->config->page_nsector);
-				if (NULL ==req) {
-					rc = ALLOCMEM_FAILED;
-					goto free_req_out;
-				}
-				for (i = 0; i < dev->config->page_nsector; i++) {
-					sector_seed = ((ppa + plane * dev->flash->npage + page) * dev->config->page_nsector + i) + ((lun + seed)<<24);
-					srand(sector_seed);
-					pad_rand(req->data + i * dev->config->sector_size, dev->config->sector_size);
-					pad_rand(req->metadata + i, METADATA_SIZE);
-					// pad_same_u32(req->data + i * dev->config->sector_size, dev->config->sector_size, sector_seed);
-					// pad_same_u32(req->metadata + i, METADATA_SIZE, sector_seed);
-				}
-				list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
+				goto free_wrgen_out;
 			}
+			list_add(&req->list, &req_head);
 		}
 
 		/* raid write request */
@@ -854,7 +1048,7 @@ next_block_page: /* write chunk */
 			chunk_head_req = alloc_request(dev, sh_raidwrite_cmd, superblock_paritylun(dev, blk), ppa + page, head, 0, 0);
 			if (NULL == chunk_head_req) {
 				rc = ALLOCMEM_FAILED;
-				goto free_req_out;
+				goto free_wrgen_out;
 			}
 			list_add_tail(&chunk_head_req->list, &req_head);
 
@@ -862,7 +1056,7 @@ next_block_page: /* write chunk */
 				req = alloc_request(dev, sh_raidwrite_cmd, superblock_paritylun(dev, blk), ppa + plane * dev->flash->npage + page, head, 0, 0);
 				if (NULL == req) {
 					rc = ALLOCMEM_FAILED;
-					goto free_req_out;
+					goto free_wrgen_out;
 				}
 				list_add_tail(&req->chunk_list, &chunk_head_req->chunk_list);
 			}
@@ -871,7 +1065,7 @@ next_block_page: /* write chunk */
 		/* summit and execute all request */
 		list_for_each_entry(req, &req_head, list) {
 			if ((rc = dev->submit_request(req)))
-				goto free_req_out;
+				goto free_wrgen_out;
 		}
 
 		for_dev_each_lun(dev, lun)
@@ -879,7 +1073,7 @@ next_block_page: /* write chunk */
 
 		for_dev_each_lun(dev, lun) {
 			if ((rc = poll_cmdqueue(dev, lun)))
-				goto free_req_out;
+				goto free_wrgen_out;
 		}
 
 		/* check status */
@@ -903,15 +1097,13 @@ next_block_page: /* write chunk */
 				pre_cent = now_cent;
 			}
 		}
-
-		if (++page < topage + 1)
-			goto next_block_page;
 	}
 
 	if (!noprogress)
 		printf("\n");
 
-free_req_out:
+free_wrgen_out:
+	free_wrgen(&wg);
 	list_for_each_entry_safe(req, tmp, &req_head, list) {
 		list_del(&req->list);
 		free_request(req);
@@ -925,6 +1117,206 @@ free_req_out:
 /*
  * super read chunk and check data consistence
  */
+struct data_check_stats {
+	long nsector;
+	long nmismatch;
+	long nbit;		/* flipped bits against pattern regenerated from seed */
+	int max_cw_nbit;
+};
+
+/*
+ * raid parity of super-read. Sectors of a stripe are folded as their cacheread retires: the first lun is copied and the
+ * others are xor-ed in, so buffers aren`t cleared per page. A sector is checked as soon as its last lun is folded, and
+ * luns with uncorrectable ecc or data mismatch on it are reported as suspects. Sectors not folded by every lun when the
+ * page is done are reported as unchecked.
+ */
+struct raid_check {
+	int nlun;		/* luns folded into every sector of this page */
+	int *nfold;
+	int *suspect;		/* lun, -1 if none, -2 if more than one */
+	__u8 *data;
+	__u64 *metadata;
+	__u8 *zero;		/* a zero sector to count residue bits */
+	long nstripe;
+	long nfailed;
+	long nunfolded;
+};
+
+static int init_raid_check(struct shannon_dev *dev, struct raid_check *rc)
+{
+	memset(rc, 0x00, sizeof(*rc));
+
+	rc->nfold = malloc(dev->config->chunk_nsector * sizeof(*rc->nfold));
+	rc->suspect = malloc(dev->config->chunk_nsector * sizeof(*rc->suspect));
+	rc->data = malloc(dev->config->chunk_ndata);
+	rc->metadata = malloc(dev->config->chunk_nmeta);
+	rc->zero = zmalloc(dev->config->sector_size);
+	if (NULL == rc->nfold || NULL == rc->suspect || NULL == rc->data || NULL == rc->metadata || NULL == rc->zero)
+		return ALLOCMEM_FAILED;
+	return 0;
+}
+
+static void free_raid_check(struct raid_check *rc)
+{
+	free(rc->nfold);
+	free(rc->suspect);
+	free(rc->data);
+	free(rc->metadata);
+	free(rc->zero);
+}
+
+static void raid_check_begin_page(struct shannon_dev *dev, struct raid_check *rc, int nlun)
+{
+	rc->nlun = nlun;
+	memset(rc->nfold, 0x00, dev->config->chunk_nsector * sizeof(*rc->nfold));
+	memset(rc->suspect, 0xFF, dev->config->chunk_nsector * sizeof(*rc->suspect));
+}
+
+static void raid_check_end_page(struct shannon_dev *dev, struct raid_check *rc, int blk, int page)
+{
+	int sector;
+
+	for (sector = 0; sector < dev->config->chunk_nsector; sector++) {
+		if (rc->nfold[sector] == rc->nlun)
+			continue;
+
+		rc->nunfolded++;
+		printf("Raid check skipped: block=%d page=%d sector=%d folded luns=%d of %d\n", blk, page, sector,
+			rc->nfold[sector], rc->nlun);
+	}
+}
+
+static void raid_check_suspect(struct raid_check *rc, int sector, int lun)
+{
+	if (-1 == rc->suspect[sector] || lun == rc->suspect[sector])
+		rc->suspect[sector] = lun;
+	else
+		rc->suspect[sector] = -2;
+}
+
+static void raid_check_fold(struct shannon_dev *dev, struct raid_check *rc, struct shannon_request *req)
+{
+	int i, sector, nbit, meta_nbit;
+	int sector_size = dev->config->sector_size;
+	__u8 *parity;
+
+	for (i = 0; i < req->nsector; i++) {
+		sector = req->chunk_plane * dev->config->page_nsector + req->bsector + i;
+		parity = rc->data + sector * sector_size;
+
+		if (0 == rc->nfold[sector]) {
+			memcpy(parity, req->data + i * sector_size, sector_size);
+			rc->metadata[sector] = req->metadata[i];
+		} else {
+			xor_into(parity, req->data + i * sector_size, sector_size);
+			rc->metadata[sector] ^= req->metadata[i];
+		}
+
+		if (++rc->nfold[sector] != rc->nlun)
+			continue;
+
+		rc->nstripe++;
+		nbit = xor_popcount(parity, rc->zero, sector_size);
+		meta_nbit = __builtin_popcountll(rc->metadata[sector]);
+		if (!nbit && !meta_nbit)
+			continue;
+
+		rc->nfailed++;
+		printf("Raid check failed: block=%d page=%d sector=%d bits=%d meta-bits=%d ", req->chunk_block, req->page, sector, nbit, meta_nbit);
+		if (rc->suspect[sector] >= 0)
+			printf("suspect lun=%d\n", rc->suspect[sector]);
+		else
+			printf("suspect lun=%s\n", (-2 == rc->suspect[sector]) ? "several" : "unknown");
+	}
+}
+
+struct super_read_ctx {
+	struct shannon_dev *dev;
+	long **lun_ecc_statistics;
+	struct data_check_stats *lun_check_stats;
+	int pr_error_location;
+	int check_data;
+	int seed;
+	int blk;
+	struct raid_check *raid;	/* NULL if raid isn`t checked */
+};
+
+/*
+ * status, ecc and data of a req are checked as soon as it retires, while others are still running in flash. Raid parity
+ * is folded after them, so suspects of a sector are known when its stripe completes
+ */
+static void super_read_done(struct shannon_request *req, void *ctx)
+{
+	int i, sector;
+	struct super_read_ctx *rd = ctx;
+	struct shannon_dev *dev = rd->dev;
+	struct data_check_stats *cs;
+	struct sector_verify sv;
+
+	if (sh_preread_cmd == req->opcode) {
+		if (rd->pr_error_location)
+			check_req_status(req);
+		else
+			check_req_status_silent(req);
+		return;
+	}
+
+	if (sh_cacheread_cmd != req->opcode)
+		return;
+
+	for (i = 0; i < req->nsector; i++) {
+		rd->lun_ecc_statistics[req->lun][req->ecc[i]]++;
+
+		if (req->ecc[i] < 251)
+			continue;
+
+		sector = i + req->bsector + req->chunk_plane * dev->config->page_nsector;
+		if (NULL != rd->raid && req->ecc[i] > 251)
+			raid_check_suspect(rd->raid, sector, req->lun);
+		if (!rd->pr_error_location)
+			continue;
+
+		if (req->ecc[i] == 251)
+			printf("Super-read blank %02X. ", req->ecc[i]);
+		else if (req->ecc[i] > 251)
+			printf("Super-read ecc failed: %02X. ", req->ecc[i]);
+
+		printf("lun=%d block=%d page=%d sector=%d\n", req->lun, req->chunk_block, req->page, sector);
+	}
+
+	/* check data consistence if needed, parity lun doesn`t hold pattern */
+	if (!rd->check_data || (NULL != rd->raid && superblock_paritylun(dev, rd->blk) == req->lun))
+		goto fold_raid;
+
+	cs = &rd->lun_check_stats[req->lun];
+	for (i = 0; i < req->nsector; i++) {
+		cs->nsector++;
+		if (!prng_verify_sector(dev, rd->seed, req->lun, req->ppa, req->bsector + i,
+				req->data + i * dev->config->sector_size, req->metadata + i, &sv))
+			continue;
+
+		cs->nmismatch++;
+		cs->nbit += sv.nbit;
+		if (sv.max_cw_nbit > cs->max_cw_nbit)
+			cs->max_cw_nbit = sv.max_cw_nbit;
+
+		sector = i + req->bsector + req->chunk_plane * dev->config->page_nsector;
+		if (NULL != rd->raid)
+			raid_check_suspect(rd->raid, sector, req->lun);
+
+		if (sv.first_off < dev->config->sector_size)	// data
+			printf("Data mismatch: lun=%d block=%d page=%d sector=%d off=%d write=%02X read=%02X bits=%d max-codeword-bits=%d\n",
+				req->lun, req->chunk_block, req->page, sector, sv.first_off, sv.first_expect, sv.first_read, sv.nbit, sv.max_cw_nbit);
+		else						// metadata
+			printf("Metadata mismatch: lun=%d block=%d page=%d sector=%d bits=%d\n",
+				req->lun, req->chunk_block, req->page, sector, sv.meta_nbit);
+	}
+
+fold_raid:
+	if (NULL != rd->raid)
+		raid_check_fold(dev, rd->raid, req);
+}
+
 static void shannon_super_read_usage(void)
 {
 	printf("Description:\n");
@@ -984,14 +1376,17 @@ int shannon_super_read(struct shannon_dev *dev, int argc, char **argv)
 	int opt;
 	char *luninfo_file;
 	int raid, pr_error_location;
-	int sector_seed, seed, check_data, head, noprogress;
-	void *raid_data, *raid_metadata;
+	int seed, check_data, head, noprogress;
+	struct super_read_ctx rd;
+	struct raid_check raid_check;
+	int nlun;
 	int blk, plane, ppa, page;
 	int lun, begin_chunkblock, count;
 	struct shannon_request *chunk_head_req, *req, *tmp, *tmp1;
 	struct list_head req_head;
 	int pre_cent, now_cent;		// used for show progress
 	long **lun_ecc_statistics;
+	struct data_check_stats *lun_check_stats = NULL;
 	int last_cacheread = 1;
 	int pr_switch = 0, pr_ecc = 0, pr_meta = 0, pr_data = 0, chunknsector;
 	int frompage = 0, topage = dev->flash->npage - 1;
@@ -1104,6 +1499,11 @@ int shannon_super_read(struct shannon_dev *dev, int argc, char **argv)
 			goto free_lun_ecc_statistics;
 		}
 	}
+	lun_check_stats = zmalloc(dev->config->luns * sizeof(*lun_check_stats));
+	if (NULL == lun_check_stats) {
+		rc = ALLOCMEM_FAILED;
+		goto free_lun_ecc_statistics;
+	}
 
 	/* construct luninfo if needed */
 	if (NULL != luninfo_file) {
@@ -1111,16 +1511,9 @@ int shannon_super_read(struct shannon_dev *dev, int argc, char **argv)
 			return ERR;
 	}
 
-	if (raid) {
-		raid_data = malloc(dev->config->chunk_ndata);
-		if (NULL == raid_data)
-			return ERR;
-
-		raid_metadata = malloc(dev->config->chunk_nmeta);
-		if (NULL == raid_metadata) {
-			free(raid_data);
-			return ERR;
-		}
+	if (raid && (rc = init_raid_check(dev, &raid_check))) {
+		free_raid_check(&raid_check);
+		goto free_lun_ecc_statistics;
 	}
 
 	/* manipulate read chunk block and check process */
@@ -1134,17 +1527,28 @@ int shannon_super_read(struct shannon_dev *dev, int argc, char **argv)
 
 	INIT_LIST_HEAD(&req_head);
 
+	rd.dev = dev;
+	rd.lun_ecc_statistics = lun_ecc_statistics;
+	rd.lun_check_stats = lun_check_stats;
+	rd.pr_error_location = pr_error_location;
+	rd.check_data = check_data;
+	rd.seed = seed;
+	rd.raid = (raid && !pr_switch) ? &raid_check : NULL;
+
 	for (blk = begin_chunkblock; blk < begin_chunkblock + count; blk++) {
 		if (is_bad_superblock(dev, blk))
 			continue;
 
 		ppa = blk * dev->config->nplane * dev->flash->npage;
 		page = frompage;
+		rd.blk = blk;
 
 next_block_page: /* read chunk */
+		nlun = 0;
 		for_dev_each_lun(dev, lun) {
 			if (is_bad_lunblock(dev, lun, blk))
 				continue;
+			nlun++;
 
 			chunk_head_req = alloc_request(dev, sh_preread_cmd, lun, ppa + page, head, 0, 0);	// preread
 			if (NULL == chunk_head_req) {
@@ -1170,7 +1574,7 @@ next_block_page: /* read chunk */
 					ns = (remain_ns >= 8) ? 8 : remain_ns;
 
 					if (check_data || raid)
-						req = alloc_request(dev, sh_cacheread_cmd, lun, ppa + plane * dev->flash->npage + page, head, bs, ns);
+						req = alloc_request_no_dma(dev, sh_cacheread_cmd, lun, ppa + plane * dev->flash->npage + page, head, bs, ns, REQ_DMA_MAPPED);
 					else
 						req = alloc_request(dev, sh_cacheread_cmd, lun, ppa + plane * dev->flash->npage + page, head, bs, 0);	// disable alloc memory
 					if (NULL == req) {
@@ -1187,8 +1591,15 @@ next_block_page: /* read chunk */
 			req->last_cacheread = last_cacheread;
 		}
 
-		/* summit and execute all request */
+		if (NULL != rd.raid)
+			raid_check_begin_page(dev, rd.raid, nlun);
+
+		/* summit and execute all request, just print path checks nothing */
 		list_for_each_entry(req, &req_head, list) {
+			if (!pr_switch) {
+				req->done = super_read_done;
+				req->done_ctx = &rd;
+			}
 			if ((rc = dev->submit_request(req)))
 				goto free_req_out;
 		}
@@ -1201,8 +1612,11 @@ next_block_page: /* read chunk */
 				goto free_req_out;
 		}
 
+		/* status, ecc, data and raid parity are checked by super_read_done() */
+		if (NULL != rd.raid)
+			raid_check_end_page(dev, rd.raid, blk, page);
 		if (!pr_switch)
-			goto not_print_path;
+			goto skip_check_data;
 
 		/* just print ecc/meta/data no check */
 		list_for_each_entry(req, &req_head, list) {
@@ -1270,106 +1684,6 @@ next_block_page: /* read chunk */
 
 			req = tmp1;
 		}
-		goto skip_check_data;
-
-		/* check status and ecc */
-not_print_path:
-		list_for_each_entry(req, &req_head, list) {
-			if (sh_preread_cmd == req->opcode) {
-				if (pr_error_location)
-					check_req_status(req);
-				else
-					check_req_status_silent(req);
-			}
-
-			if (sh_cacheread_cmd == req->opcode) {
-				for (i = 0; i < req->nsector; i++) {
-					lun_ecc_statistics[req->lun][req->ecc[i]]++;
-
-					if (req->ecc[i] < 251 || !pr_error_location)
-						continue;
-
-					if (req->ecc[i] == 251)
-						printf("Super-read blank %02X. ", req->ecc[i]);
-					else if (req->ecc[i] > 251)
-						printf("Super-read ecc failed: %02X. ", req->ecc[i]);
-
-					printf("lun=%d block=%d page=%d sector=%d\n",
-						req->lun, req->chunk_block, req->page, i + req->bsector + req->chunk_plane * dev->config->page_nsector);
-				}
-			}
-		}
-
-		/* check data consistence if needed */
-		if (!check_data && !raid)
-			goto skip_check_data;
-
-		if(raid) {
-			memset(raid_data, 0x00, dev->config->chunk_ndata);
-			memset(raid_metadata, 0x00, dev->config->chunk_nmeta);
-		}
-
-		list_for_each_entry(req, &req_head, list) {
-			if (sh_cacheread_cmd != req->opcode)
-				continue;
-
-			if (raid) {
-				memxor(raid_data + (req->chunk_plane * dev->config->page_nsector + req->bsector) * dev->config->sector_size, req->data, req->nsector * dev->config->sector_size);
-				memxor(raid_metadata + (req->chunk_plane * dev->config->page_nsector + req->bsector) * METADATA_SIZE, req->metadata, req->nsector * METADATA_SIZE);
-
-				if (superblock_paritylun(dev, blk) == req->lun)
-					continue;
-			}
-
-			if (!check_data)
-				continue;
-
-			for (i = 0; i < req->nsector; i++) {
-				__u8 ch;
-				int ibx, jump = 0;
-
-				sector_seed = (req->ppa * dev->config->page_nsector + req->bsector + i) + ((req->lun + seed)<<24);
-				srand(sector_seed);
-
-				for (ibx = 0; ibx < dev->config->sector_size; ibx++) {	// data
-					if ((ch = rand()) != req->data[i * dev->config->sector_size + ibx]) {
-						printf("Data mismatch: lun=%d block=%d page=%d sector=%d off=%d write=%02X read=%02X\n",
-							req->lun, req->chunk_block, req->page, i + req->bsector + req->chunk_plane * dev->config->page_nsector,
-							ibx, ch, req->data[i * dev->config->sector_size + ibx]);
-						jump = 1;
-						break;
-					}
-				}
-
-				if (jump)
-					continue;
-
-				for (ibx = 0; ibx < METADATA_SIZE; ibx++) {		// metadata
-					if ((ch = rand()) != ((__u8 *)req->metadata)[i * METADATA_SIZE + ibx]) {
-						printf("Metadata mismatch: lun=%d block=%d page=%d sector=%d\n",
-							req->lun, req->chunk_block, req->page, i + req->bsector + req->chunk_plane * dev->config->page_nsector);
-						break;
-					}
-				}
-			}
-		}
-
-		/* check raid data if needed */
-		if (raid) {
-			for (i = 0; i < dev->config->chunk_ndata; i++) {	// data
-				if (((__u8 *)raid_data)[i] != 0) {
-					printf("Raid check failed: block=%d page=%d\n", blk, list_first_entry(&req_head, struct shannon_request, list)->page);
-					goto skip_check_data;
-				}
-			}
-
-			for (i = 0; i < dev->config->chunk_nmeta; i++) {	// metadata
-				if (((__u8 *)raid_metadata)[i] != 0) {
-					printf("Raid check failed: block=%d page=%d\n", blk, list_first_entry(&req_head, struct shannon_request, list)->page);
-					goto skip_check_data;
-				}
-			}
-		}
 
 skip_check_data: /* free request */
 		list_for_each_entry_safe(req, tmp, &req_head, list) {
@@ -1424,6 +1738,19 @@ skip_check_data: /* free request */
 				(100.0 * strip_cnt) / (vluns * count * (topage - frompage + 1)  * dev->config->chunk_nsector));
 	}
 
+	if (check_data) {
+		printf("\n#Data check result:\n");
+		for_dev_each_lun(dev, lun) {
+			if (lun_check_stats[lun].nsector)
+				printf("lun-%2d sectors=%ld mismatch=%ld bits=%ld max-codeword-bits=%d\n", lun, lun_check_stats[lun].nsector,
+					lun_check_stats[lun].nmismatch, lun_check_stats[lun].nbit, lun_check_stats[lun].max_cw_nbit);
+		}
+	}
+
+	if (raid)
+		printf("\n#Raid check result:\nstripe-sectors=%ld failed=%ld unchecked=%ld\n", raid_check.nstripe, raid_check.nfailed,
+			raid_check.nunfolded);
+
 	/* success return */
 	rc = 0;
 free_req_out:
@@ -1432,11 +1759,10 @@ free_req_out:
 		free_request(req);
 	}
 
-	if (raid) {
-		free(raid_data);
-		free(raid_metadata);
-	}
+	if (raid)
+		free_raid_check(&raid_check);
 free_lun_ecc_statistics:
+	free(lun_check_stats);
 	for_dev_each_lun(dev, lun) {
 		if (NULL == lun_ecc_statistics[lun])
 			break;
@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# checks run against the emulated controller, no hw is needed: tests/sim_check.sh [ztool]
+#
+ZTOOL=$(readlink -f ${1:-./ztool})
+TOPDIR=$(readlink -f $(dirname $0)/..)
+DEV=--dev=sim:ch=2,th=2,ecc=3
+TMP=$(mktemp -d)
+NFAIL=0
+
+trap 'rm -rf $TMP' EXIT
+
+# tool reads flash lib and config from working directory
+cd $TMP || exit 1
+cp $TOPDIR/config . || exit 1
+cat > flash <<FLASH
+[TOSHIBA_19NM_64GB]
+id=98:3a:95:93:7a:d7:08:04
+blk_num=2096
+page_num=256
+page_size_shift=14
+oob_size=1280
+lun_mask=0
+plane_num=2
+plane_mask=0x100
+ifmode=sync
+factory_ivb=[0,0,0] [0,16384,16384] [255,0,0] [255,16384,16384]
+drvmode=None
+FLASH
+
+fail()
+{
+	echo "FAIL: $*"
+	NFAIL=$((NFAIL + 1))
+}
+
+pass()
+{
+	echo "PASS: $*"
+}
+
+# erase scan builds single-plane requests, submit_batch() must merge them into multi-plane chunks
+check_plane_merge()
+{
+	$ZTOOL $DEV --stats bbt $TMP/bbt -e > $TMP/out 2>&1 || { fail "plane merge: bbt exit $?"; return; }
+
+	nchunk=$(sed -n 's/^plane merge: nplane=2 chunk=\([0-9]*\)$/\1/p' $TMP/out)
+	if [ -z "$nchunk" ] || [ "$nchunk" -eq 0 ]; then
+		fail "plane merge: no chunk is merged"
+		return
+	fi
+	pass "plane merge: $nchunk chunks"
+}
+
+# trace is on without --trace, trace-decode needs no device, completion of cacheread records ecc of its sectors,
+# 0xFB is blank page of sim
+check_trace_decode()
+{
+	rm -f ztool.trace
+	$ZTOOL $DEV super-read -N 0 1 > /dev/null 2>&1 || { fail "trace decode: super-read exit $?"; return; }
+	$ZTOOL --dev=/dev/nonexistent trace-decode ztool.trace > $TMP/out 2>&1 || { fail "trace decode: exit $?"; return; }
+
+	if ! grep -q "complete lun-[0-9]* cacheread .* ecc=FB FB FB FB FB FB FB FB$" $TMP/out; then
+		fail "trace decode: no ecc of cacheread completion"
+		return
+	fi
+	pass "trace decode: $(grep -c "complete lun-[0-9]* cacheread" $TMP/out) cacheread completions"
+}
+
+# ifmode writes a block of every lun with the pattern and reads it back, with ecc closed sim returns data as programmed
+check_patterns()
+{
+	mkdir $TMP/noecc && cp flash $TMP/noecc/ && sed 's/^ecc_mode=.*/ecc_mode=1/' config > $TMP/noecc/config || { fail "patterns: noecc config"; return; }
+
+	npattern=0
+	for p in random solid:A5 inc inc-byte walk1 walk0 checker prbs7 prbs15 prbs31 prbs7,inverse,hl-not,clock-not \
+		inc-byte,hl-same,clock-not; do
+		(cd $TMP/noecc && $ZTOOL $DEV ifmode -N -P $p 0 1) > $TMP/out 2>&1 || { fail "patterns: ifmode -P $p exit $?"; return; }
+		if ! grep -q "^ERR BITS SUM: 0$" $TMP/out; then
+			fail "patterns: $p isn't read back as written"
+			return
+		fi
+		npattern=$((npattern + 1))
+	done
+	pass "patterns: $npattern patterns read back"
+}
+
+# parity of a stripe of erased pages folds to zero, a bit flipped behind ecc in one lun must fail its stripe sector
+check_raid_fold()
+{
+	$ZTOOL $DEV super-read --raid -N 0 1 > $TMP/out 2>&1 || { fail "raid fold: super-read exit $?"; return; }
+	if ! grep -q "^stripe-sectors=[1-9][0-9]* failed=0 unchecked=0$" $TMP/out; then
+		fail "raid fold: clean stripes aren't all checked and passed"
+		return
+	fi
+
+	$ZTOOL $DEV,flip=1000 --stats super-read --raid -N 0 1 > $TMP/out 2>&1 || { fail "raid fold: flip super-read exit $?"; return; }
+	nfailed=$(sed -n 's/^stripe-sectors=[0-9]* failed=\([0-9]*\) unchecked=0$/\1/p' $TMP/out)
+	nflip=$(sed -n 's/^sim: .* flipped_sector=\([0-9]*\) .*$/\1/p' $TMP/out)
+	if [ -z "$nfailed" ] || [ -z "$nflip" ] || [ "$nflip" -eq 0 ] || [ "$nfailed" -eq 0 ] || [ "$nfailed" -gt "$nflip" ]; then
+		fail "raid fold: ${nflip:-?} flipped sectors give ${nfailed:-?} failed stripe sectors"
+		return
+	fi
+	pass "raid fold: $nfailed stripe sectors failed by $nflip flipped sectors"
+}
+
+check_plane_merge
+check_trace_decode
+check_patterns
+check_raid_fold
+
+[ $NFAIL -eq 0 ] || exit 1
+exit 0
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * checks of data generators and kernels which need no device, built with them by make check and run before
+ * tests/sim_check.sh. Every check prints one PASS or FAIL line.
+ */
+static int nfail;
+
+#define	fail(fmt, args...)	do { printf("FAIL: " fmt "\n", ##args); nfail++; } while (0)
+#define	pass(fmt, args...)	printf("PASS: " fmt "\n", ##args)
+
+static struct usr_flash flash;
+static struct usr_config config;
+static struct shannon_dev dev;
+
+static void init_dev(int sector_size_shift, int page_nsector, int iowidth)
+{
+	flash.npage = 256;
+	config.sector_size_shift = sector_size_shift;
+	config.sector_size = 1 << sector_size_shift;
+	config.page_nsector = page_nsector;
+	config.ndata = page_nsector * config.sector_size;
+	config.nmeta = page_nsector * METADATA_SIZE;
+	dev.flash = &flash;
+	dev.config = &config;
+	dev.iowidth = iowidth;
+	dev.prng_mode = PRNG_RAND;
+	dev.pattern = NULL;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* data written by older tools is srand(sector_index + ((lun + seed) << 24)) then rand() per byte of data and metadata */
+static void check_rand_compat(void)
+{
+	static const int seeds[] = {0, 1, 2016, 999999};
+	static const int luns[] = {0, 3, 255};
+	static const int ppas[] = {0, 1, 12345, 536869};
+	int is, il, ip, sector, i, nsector = 0;
+	__u8 data[4096], metadata[METADATA_SIZE], ref[4096 + METADATA_SIZE];
+
+	init_dev(12, 4, 2);
+
+	for (is = 0; is < ARRAY_SIZE(seeds); is++) {
+		for (il = 0; il < ARRAY_SIZE(luns); il++) {
+			for (ip = 0; ip < ARRAY_SIZE(ppas); ip++) {
+				for (sector = 0; sector < config.page_nsector; sector++) {
+					prng_fill_sector(&dev, seeds[is], luns[il], ppas[ip], sector, data, metadata);
+
+					srand((unsigned int)(ppas[ip] * config.page_nsector + sector) + ((unsigned int)(luns[il] + seeds[is]) << 24));
+					for (i = 0; i < sizeof(ref); i++)
+						ref[i] = rand();
+
+					if (memcmp(data, ref, sizeof(data)) || memcmp(metadata, ref + sizeof(data), sizeof(metadata))) {
+						fail("rand compat: seed %d lun %d ppa %d sector %d differs from rand()", seeds[is], luns[il], ppas[ip], sector);
+						return;
+					}
+					nsector++;
+				}
+			}
+		}
+	}
+	pass("rand compat: %d sectors", nsector);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+#define	KERNEL_MAX_LEN		600
+#define	KERNEL_MAX_OFF		32
+
+static __u8 kbuf_a[KERNEL_MAX_LEN + KERNEL_MAX_OFF], kbuf_b[KERNEL_MAX_LEN + KERNEL_MAX_OFF];
+
+static const char *simd_path(void)
+{
+#if defined(__x86_64__)
+	return cpu_has_avx2() ? "avx2" : "scalar";
+#elif defined(__aarch64__)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+/* b is a with about one byte of 'sparse' flipped, or random if sparse is 0 */
+static void fill_kernel_bufs(int sparse)
+{
+	int i;
+
+	for (i = 0; i < sizeof(kbuf_a); i++) {
+		kbuf_a[i] = rand();
+		kbuf_b[i] = (!sparse || 0 == rand() % sparse) ? rand() : kbuf_a[i];
+	}
+}
+
+/* vector kernels are checked against byte loops for every length up to KERNEL_MAX_LEN at every alignment, tails included */
+static void check_xor_popcount(void)
+{
+	int sparse, off, len, i;
+	long nbit, ref;
+
+	srand(1);
+	for (sparse = 0; sparse <= 64; sparse += 8) {
+		fill_kernel_bufs(sparse);
+		for (off = 0; off < KERNEL_MAX_OFF; off++) {
+			for (len = 0; len <= KERNEL_MAX_LEN; len++) {
+				nbit = xor_popcount(kbuf_a + off, kbuf_b + off, len);
+				for (ref = i = 0; i < len; i++)
+					ref += __builtin_popcount(kbuf_a[off + i] ^ kbuf_b[off + i]);
+				if (nbit != ref) {
+					fail("xor_popcount: off %d len %d gives %ld, %ld expected", off, len, nbit, ref);
+					return;
+				}
+			}
+		}
+	}
+	pass("xor_popcount: %s path matches byte loop", simd_path());
+}
+
+/* lanes are by offset from a, so odd alignments are checked too, nbit[] and nbyte[] are added to */
+static void check_xor_popcount_lanes(void)
+{
+	int sparse, off, len, i;
+	long nbit[2], nbyte[2], ref_nbit[2], ref_nbyte[2];
+	__u8 x;
+
+	srand(2);
+	for (sparse = 0; sparse <= 64; sparse += 8) {
+		fill_kernel_bufs(sparse);
+		for (off = 0; off < KERNEL_MAX_OFF; off++) {
+			for (len = 0; len <= KERNEL_MAX_LEN; len++) {
+				nbit[0] = ref_nbit[0] = 1;
+				nbit[1] = ref_nbit[1] = 2;
+				nbyte[0] = ref_nbyte[0] = 3;
+				nbyte[1] = ref_nbyte[1] = 4;
+				xor_popcount_lanes(kbuf_a + off, kbuf_b + off, len, nbit, nbyte);
+				for (i = 0; i < len; i++) {
+					x = kbuf_a[off + i] ^ kbuf_b[off + i];
+					ref_nbit[i & 0x01] += __builtin_popcount(x);
+					ref_nbyte[i & 0x01] += !!x;
+				}
+				if (memcmp(nbit, ref_nbit, sizeof(nbit)) || memcmp(nbyte, ref_nbyte, sizeof(nbyte))) {
+					fail("xor_popcount_lanes: off %d len %d gives bits %ld/%ld bytes %ld/%ld, %ld/%ld %ld/%ld expected",
+						off, len, nbit[0], nbit[1], nbyte[0], nbyte[1], ref_nbit[0], ref_nbit[1], ref_nbyte[0], ref_nbyte[1]);
+					return;
+				}
+			}
+		}
+	}
+	pass("xor_popcount_lanes: %s path matches byte loop", simd_path());
+}
+
+/* raid parity fold, bytes around the range must be left as they are */
+static void check_xor_into(void)
+{
+	int off, len, i;
+	__u8 dst[KERNEL_MAX_LEN + KERNEL_MAX_OFF + 1], ref[KERNEL_MAX_LEN + KERNEL_MAX_OFF + 1];
+
+	srand(3);
+	fill_kernel_bufs(0);
+	for (off = 0; off < KERNEL_MAX_OFF; off++) {
+		for (len = 0; len <= KERNEL_MAX_LEN; len++) {
+			memcpy(dst, kbuf_a, sizeof(kbuf_a));
+			dst[sizeof(kbuf_a)] = 0x5A;
+			memcpy(ref, dst, sizeof(dst));
+			xor_into(dst + off, kbuf_b + off, len);
+			for (i = 0; i < len; i++)
+				ref[off + i] ^= kbuf_b[off + i];
+			if (memcmp(dst, ref, sizeof(dst))) {
+				fail("xor_into: off %d len %d differs from byte loop", off, len);
+				return;
+			}
+		}
+	}
+	pass("xor_into: %s path matches byte loop", simd_path());
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/* page of ifmode -i, -s, -n and -k as older tools wrote it, over whole page data and whole page metadata */
+static void old_ifmode_page(__u8 *data, __u8 *meta, int hi_same_lo, int hi_not_lo, int even_not_odd)
+{
+	int i, n, k;
+	__u8 *buf;
+
+	for (k = 0; k < 2; k++) {
+		buf = k ? meta : data;
+		n = k ? config.nmeta : config.ndata;
+
+		for (i = 0; i < n; i++)
+			buf[i] = i;
+		if (hi_same_lo || hi_not_lo) {
+			for (i = 1; i < n; i += 2)
+				buf[i] = hi_same_lo ? buf[i - 1] : ~buf[i - 1];
+		}
+		if (even_not_odd) {
+			for (i = 1; i < n / 2; i += 2)
+				((__u16 *)buf)[i] = ~((__u16 *)buf)[i - 1];
+		}
+	}
+}
+
+/* inc-byte with lane modifiers filled sector by sector gives the page ifmode -i wrote */
+static void check_inc_byte(void)
+{
+	static const char *mods[] = {"", ",hl-same", ",hl-not", ",clock-not", ",hl-same,clock-not", ",hl-not,clock-not"};
+	char spec[64];
+	int m, sector;
+	__u8 *data, *meta, *ref_data, *ref_meta;
+
+	init_dev(12, 4, 2);
+	data = malloc(config.ndata);
+	meta = malloc(config.nmeta);
+	ref_data = malloc(config.ndata);
+	ref_meta = malloc(config.nmeta);
+	if (NULL == data || NULL == meta || NULL == ref_data || NULL == ref_meta) {
+		fail("inc-byte: alloc buffers");
+		goto out;
+	}
+
+	for (m = 0; m < ARRAY_SIZE(mods); m++) {
+		sprintf(spec, "inc-byte%s", mods[m]);
+		dev.pattern = parse_pattern(&dev, spec);
+		if (NULL == dev.pattern) {
+			fail("inc-byte: parse %s", spec);
+			goto out;
+		}
+		for (sector = 0; sector < config.page_nsector; sector++)
+			prng_fill_sector(&dev, 0, 0, 0, sector, data + sector * config.sector_size, meta + sector * METADATA_SIZE);
+		free(dev.pattern);
+		dev.pattern = NULL;
+
+		old_ifmode_page(ref_data, ref_meta, NULL != strstr(spec, "hl-same"), NULL != strstr(spec, "hl-not"),
+			NULL != strstr(spec, "clock-not"));
+		if (memcmp(data, ref_data, config.ndata) || memcmp(meta, ref_meta, config.nmeta)) {
+			fail("inc-byte: %s differs from page of older ifmode -i", spec);
+			goto out;
+		}
+	}
+	pass("inc-byte: %d modifier sets match older ifmode -i", m);
+out:
+	free(data);
+	free(meta);
+	free(ref_data);
+	free(ref_meta);
+}
+
+/* PRBS stream is msb first, every bit after the first a is s[n-a] ^ s[n-b] and period is 2^a - 1 bits */
+static void check_prbs(void)
+{
+	static const struct {
+		const char *spec;
+		int a, b;
+	} prbs[] = {{"prbs7", 7, 6}, {"prbs15", 15, 14}, {"prbs31", 31, 28}};
+	static const __u32 keys[] = {0, 1, 0x12345678, 0xFFFFFFFF};
+	struct pattern_stream ps;
+	struct pattern *pt;
+	__u8 buf[4096 + METADATA_SIZE];
+	int ip, ik, n, period, nbit = sizeof(buf) * 8;
+
+	init_dev(12, 4, 2);
+#define	PRBS_BIT(n)	((buf[(n) / 8] >> (7 - (n) % 8)) & 0x01)
+	for (ip = 0; ip < ARRAY_SIZE(prbs); ip++) {
+		pt = parse_pattern(&dev, prbs[ip].spec);
+		if (NULL == pt) {
+			fail("prbs: parse %s", prbs[ip].spec);
+			return;
+		}
+		period = (1 << prbs[ip].a) - 1;
+		for (ik = 0; ik < ARRAY_SIZE(keys); ik++) {
+			/* data and metadata are filled by two calls as prng.c does */
+			pattern_stream_init(&ps, pt, keys[ik], 0, 0, 4096);
+			pattern_stream_fill(&ps, buf, 4096);
+			pattern_stream_fill(&ps, buf + 4096, METADATA_SIZE);
+
+			for (n = prbs[ip].a; n < nbit; n++) {
+				if (PRBS_BIT(n) != (PRBS_BIT(n - prbs[ip].a) ^ PRBS_BIT(n - prbs[ip].b))) {
+					fail("prbs: %s key %08X bit %d breaks recurrence", prbs[ip].spec, keys[ik], n);
+					free(pt);
+					return;
+				}
+			}
+			for (n = 0; n + period < nbit; n++) {
+				if (PRBS_BIT(n) != PRBS_BIT(n + period)) {
+					fail("prbs: %s key %08X period isn`t %d bits", prbs[ip].spec, keys[ik], period);
+					free(pt);
+					return;
+				}
+			}
+		}
+		free(pt);
+	}
+#undef	PRBS_BIT
+	pass("prbs: recurrence and period of prbs7/15/31");
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+	check_rand_compat();
+	check_xor_popcount();
+	check_xor_popcount_lanes();
+	check_xor_into();
+	check_inc_byte();
+	check_prbs();
+
+	return nfail ? 1 : 0;
+}
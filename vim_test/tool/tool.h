@@ -5,6 +5,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <signal.h>
+#include <pthread.h>
 #include "list.h"
 #include "graphics.h"
 
@@ -77,6 +78,14 @@ typedef __u8 u8;
 #define	RAIDMODE_ENABLE			1
 
 #define	RUNCMDQ_US_TIMEOUT		8000
+#define	POLL_NS_TIMEOUT			(100LL * RUNCMDQ_US_TIMEOUT * 1000)	/* 800ms wall clock without completion */
+
+#define	DMA_POOL_DEPTH		2	/* default pool buffers per lun-plane page */
+
+/* dma mode of request data, the last argument of alloc_request_no_dma() */
+#define	REQ_DMA_COPY		0	/* data is malloced, copied to/from dma memory */
+#define	REQ_NO_DMA		1	/* no dma at all */
+#define	REQ_DMA_MAPPED		2	/* data points to mmaped dma region, no copy */
 
 #define	FLASH_SUCCESS_MASK	0x41
 #define	FLASH_SUCCESS_STATUS	0x40
@@ -88,31 +97,168 @@ struct memory {
 	int size;
 	void *kernel_addr;
 	dma_addr_t dma_addr;
+	int pooled;		/* belong to dev->dma_pool */
 	struct list_head list;
 	struct list_head glist;
 };
 
+struct dma_pool {
+	int size;		/* byte size of every buffer */
+	int total;		/* buffers owned by pool, free and inuse */
+	int target;		/* buffers pool is sized to, allocated at first borrow */
+	int inuse;
+	int high_water;		/* max inuse */
+	long borrow;
+	long miss;		/* borrow but free list is empty and pool is filled to target */
+	struct list_head free_listhead;
+	pthread_mutex_t lock;	/* engine workers get and put buffers at the same time */
+};
+
+struct dma_region {
+	int size;
+	void *kernel_addr;
+	dma_addr_t dma_addr;
+	__u8 *user_addr;	/* mmaped address of kernel_addr */
+
+	int slot_size;		/* page_nsector sectors per slot */
+	int nslot;
+	int nfree;
+	int *free_slot;		/* stack of free slot index */
+	int high_water;
+	long miss;		/* REQ_DMA_MAPPED request falls back to REQ_DMA_COPY */
+};
+
+/*
+ * request slab: shannon_request objects are carved from chunks and recycled by a free list. Data and metadata of
+ * a request share one cache-aligned buffer of page_nsector sectors recycled by another free list, so alloc_request()
+ * doesn`t call malloc at all once the slab is warm.
+ */
+#define	REQ_SLAB_ALIGN		64
+#define	REQ_SLAB_CHUNK_NOBJ	1024
+
+struct req_slab_chunk {
+	struct list_head list;
+	void *addr;
+};
+
+struct req_slab {
+	int objsize;		/* sizeof(struct shannon_request) rounded up to REQ_SLAB_ALIGN */
+	int bufsize;		/* data and metadata bytes of page_nsector sectors */
+	int total;		/* objects in chunks */
+	int inuse;
+	int high_water;
+	int nchunk;
+	int nbuf;		/* buffers owned by slab, free and inuse */
+	int buf_inuse;
+	long borrow;
+	long grow;		/* borrow but free list is empty */
+	long fallback;		/* buffers malloced since they don`t fit in bufsize */
+	struct list_head free_listhead;		/* free objects linked by req->list */
+	struct list_head buf_listhead;		/* free buffers, list_head is kept at the front of buffer */
+	struct list_head chunk_listhead;
+};
+
+/*
+ * request set: request graph of one block is built once, then bound to ppa of every block of a scan
+ */
+struct req_set {
+	struct shannon_dev *dev;
+	struct list_head req_listhead;	/* chunk head requests linked by set_list, siblings are in their chunk_list */
+	int nreq;
+};
+
+/*
+ * execution engine: a worker pthread per hw thread, requests go to it by sq and come back by cq after retired
+ */
+#define	ENGINE_RING_SIZE	4096	/* power of 2 */
+#define	ENGINE_IDLE_SPIN	1000	/* cpu_relax() rounds before sleeping */
+#define	ENGINE_IDLE_NS		20000
+
+struct engine_ring {
+	unsigned int head __attribute__((aligned(64)));	/* written by consumer */
+	unsigned int tail __attribute__((aligned(64)));	/* written by producer */
+	struct shannon_request *slot[ENGINE_RING_SIZE];
+};
+
+struct engine_worker {
+	struct shannon_dev *dev;
+	int tr;				/* index of dev->thread */
+	pthread_t tid;
+	int inflight;			/* submitted and not retired yet */
+	struct list_head backlog_listhead;	/* popped from sq but cmdqueue is full, linked by lun_list */
+	struct engine_ring sq;
+	struct engine_ring cq;
+	long nsubmit;
+	long nreap;
+	long nsleep;
+};
+
+struct shannon_engine {
+	int nworker;
+	int stop;
+	struct engine_worker *worker;
+	long nrun;
+	long nfallback;			/* lists with raid head are run by submit_polling_loop() itself */
+	long nsleep;
+};
+
 /*-----------------------------------------------------------------------------------------------------------------------------*/
 struct shannon_thread {
 	int phythread_idx;
 	int cmdhead;		/* byte unit */
 	int cmdempty;
+	int cmptail;		/* cmdhead of the oldest req not retired */
 	int req_count;
 	struct thread_mem cmdmem;
 	struct thread_mem cmpmem;
-	struct list_head req_listhead;
+	void *cmdq;		/* mmaped cmdmem, NULL means access it by write_mem */
+	void *cmpq;		/* mmaped cmpmem */
+	struct list_head req_listhead;	/* req linked by thread_list */
+	__u8 cmdbuf[PAGE_SIZE] __attribute__((aligned(8)));	/* commands are encoded here if they can`t be in cmdq */
 };
 
-struct shannon_lun {
-	int head;		/* first cmd head of this lun */
-	int tail;		/* last cmd tail of this lun */
+/*
+ * completion polling: busy-spin for spin_ns, then sleep from min_sleep_ns and double it up to max_sleep_ns.
+ * policy class is chosen by the slowest outstanding opcode.
+ */
+enum poll_class {
+	POLL_READ,
+	POLL_PROGRAM,
+	POLL_ERASE,
+	POLL_NCLASS,
+};
+
+struct poll_policy {
+	long spin_ns;
+	long min_sleep_ns;
+	long max_sleep_ns;
+};
+
+struct poll_stats {
+	long npoll;
+	long nsleep;
+	long spin_ns;
+	long sleep_ns;
+};
 
+struct poll_state {
+	struct poll_policy *policy;
+	struct poll_stats *stats;
+	long long start_ns;
+	long long deadline_ns;	/* moved on by poll_progress() */
+	long sleep_ns;		/* next sleep, 0 means still spinning */
+	long slept_ns;
+	long nsleep;
+};
+
+struct shannon_lun {
 	int channel;
 	int phylun;
 	int loglun;
 	struct shannon_thread *thread;
 
 	struct list_head req_listhead;
+	struct poll_stats poll_stats;
 };
 
 struct shannon_bufhead {
@@ -120,12 +266,146 @@ struct shannon_bufhead {
 	int cmdempty;
 	struct thread_mem cmdmem;
 	struct thread_mem cmpmem;
+	void *cmdq;
+	void *cmpq;
 	struct list_head req_listhead;
+	struct poll_stats poll_stats;
+	__u8 cmdbuf[PAGE_SIZE] __attribute__((aligned(8)));
 };
 
 #define MAX_LUN		( 256 )
 #define MAX_LUN_NLONG	( (MAX_LUN + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long)))
 #define MAX_LUN_NBYTE	( MAX_LUN_NLONG * sizeof(unsigned long) )
+
+/*
+ * latency histogram per (lun, opcode), log-linear buckets of 1 << LAT_SUB_SHIFT per power of 2 up to LAT_MAX_NS
+ */
+enum lat_op {
+	LAT_ERASE,
+	LAT_WRITE,
+	LAT_PREREAD,
+	LAT_CACHEREAD,
+	LAT_BUFWRITE,
+	LAT_RAID,
+	LAT_OTHER,
+	LAT_NOP,
+};
+
+#define	LAT_SUB_SHIFT	3
+#define	LAT_MAX_SHIFT	40
+#define	LAT_MAX_NS	( (1LL << LAT_MAX_SHIFT) - 1 )
+#define	LAT_NBUCKET	( (LAT_MAX_SHIFT - LAT_SUB_SHIFT + 1) << LAT_SUB_SHIFT )
+
+struct lat_hist {
+	long long count;
+	long long sum;
+	long long min;
+	long long max;
+	unsigned int bucket[LAT_NBUCKET];
+};
+
+struct shannon_latency {
+	char *file;		/* dump buckets to it at exit if not NULL */
+	struct lat_hist hist[MAX_LUN][LAT_NOP];
+};
+
+/*
+ * binary trace of commands and completions, records are kept in a ring of TRACE_DEPTH and the latest ones are written
+ * to file on exit. File is struct trace_file_head followed by nrec of struct trace_rec, oldest first.
+ */
+#define	TRACE_DEPTH		( 1 << 16 )
+#define	TRACE_FILE		"ztool.trace"	/* written unless --trace gives another file */
+#define	TRACE_MAGIC		0x0045434152544853ULL	/* "SHTRACE" */
+#define	TRACE_VERSION		1
+
+enum trace_type {
+	TRACE_SUBMIT	= 1,
+	TRACE_COMPLETE	= 2,
+};
+
+struct trace_rec {
+	__u64 ns;
+	__u64 status;		/* completion: status, or the first 8 ecc bytes of cacheread */
+	__u32 ppa;
+	__u16 lun;
+	__u16 cmdhead;
+	__u16 head;
+	__u8 type;
+	__u8 opcode;
+	__u32 rsvd;
+};
+
+struct trace_file_head {
+	__u64 magic;
+	__u32 version;
+	__u32 rec_size;
+	__u64 nrec_total;	/* records ever traced, nrec_total - nrec were overwritten */
+	__u32 nrec;
+	__u32 rsvd;
+};
+
+struct shannon_trace {
+	char *file;
+	unsigned long seq;	/* next record, bumped atomically since workers trace too */
+	struct trace_rec rec[TRACE_DEPTH];
+};
+
+enum prng_mode {
+	PRNG_RAND,	/* stream of srand()/rand(), compatible with data written by older tools */
+	PRNG_CTR,	/* counter based, vectorized */
+};
+
+enum pattern_base {
+	PATTERN_RANDOM,	/* generator of --prng */
+	PATTERN_SOLID,
+	PATTERN_INC,
+	PATTERN_INC_BYTE,	/* -i of ifmode in older tools */
+	PATTERN_WALK1,
+	PATTERN_WALK0,
+	PATTERN_CHECKER,
+	PATTERN_PRBS7,
+	PATTERN_PRBS15,
+	PATTERN_PRBS31,
+	PATTERN_NBASE,
+};
+
+struct pattern_stream;
+typedef void (*pattern_fill_fn)(struct pattern_stream *ps, __u8 *buf, int count);
+typedef void (*pattern_lane_fn)(__u8 *buf, int count);
+
+/* test pattern parsed by parse_pattern(), kernels are picked for bus width there */
+struct pattern {
+	int base;
+	int inverse;		/* odd page is inverse of the page before */
+	__u8 solid;
+	pattern_fill_fn fill;	/* NULL for PATTERN_RANDOM */
+	pattern_lane_fn lane[2];	/* byte lane then clock modifier, NULL if none */
+};
+
+struct pattern_stream {
+	const struct pattern *pt;
+	__u32 pos;		/* byte offset from begin of stream */
+	__u32 page;
+	int sector;		/* sector in page, stream is its data then its metadata */
+	int sector_size;
+	__u64 hist;		/* PRBS, latest bits and the newest is bit 0 */
+	__u64 acc;		/* PRBS, generated bits not output yet */
+	int nacc;
+};
+
+#define	MAX_SECTOR_NCODEWORD	16
+
+/* result of prng_verify_sector() */
+struct sector_verify {
+	int nbit;		/* flipped bits of data and metadata */
+	int meta_nbit;
+	int max_cw_nbit;
+	int cw_nbit[MAX_SECTOR_NCODEWORD];
+	int first_off;		/* first different byte, offset of metadata follows data, -1 if none */
+	__u8 first_expect;
+	__u8 first_read;
+};
+
 struct shannon_bbt {
 	char name[32];
 
@@ -191,6 +471,7 @@ struct shannon_request {
 
 	__u8 *data;
 	__u64 *metadata;	/* cacheread needs */
+	int dma_slot;		/* slot of dev->dma_region data points to, -1 means none */
 	union {
 		__u8 id[8];	/* readid cmd needs */
 		__u8 ecc[64];	/* cacheread cmd needs */
@@ -200,6 +481,8 @@ struct shannon_request {
 	int bfree;		/* decide whether free data/metadata mem or not */
 	int rw_entire_buffer;	/* mean data and metadata are in the entire buffer if set */
 	int no_dma;             /* mean the request will not generate DMA at all */
+	__u8 *slab_buf;		/* buffer borrowed from request slab, data and metadata may point into it */
+	int slab_bufsize;
 	int last_cacheread;
 	int wr_flash_reg_nbyte;
 
@@ -215,7 +498,17 @@ struct shannon_request {
 		struct list_head lun_list;	/* link req mounted on this lun */
 		struct list_head bufhead_list;
 	};
+	struct list_head thread_list;	/* link req mounted on thread in order of cmdqueue */
 	struct list_head mem_listhead;	/* head of memory recording kernel_addr and dma_addr */
+	void (*done)(struct shannon_request *req, void *ctx);	/* called when req is retired, it mustn`t free req */
+	void *done_ctx;
+	struct engine_worker *worker;	/* worker req is passed to, NULL if it is submitted by main thread */
+	struct list_head set_list;	/* linked to req_set if it is a chunk head request of set */
+	int set_ppa;			/* ppa offset to ppa the set is bound to */
+	int plane_merged;		/* chunk_list is built by merge_plane_array() and given back by split_plane_chunk() */
+	int pe_counted;			/* on chunk head, planes of chunk not retired yet, die is in pe_inflight till 0 */
+	struct shannon_request *pe_chunk;	/* chunk head holding die of req in pe_inflight */
+	long long submit_ns;		/* stamped by submit_request() if latency is recorded */
 
 	int private_int;
 	int private_int_1;
@@ -232,8 +525,10 @@ struct norflash_info {
 	char model_id[40];
 };
 
+struct shannon_sim;
+
 struct shannon_dev {
-	int fd;
+	int fd;				/* -1 for sim device */
 	char name[32];
 	char domains[32];
 	int init_mode;			/* 0, normal init; 1, use present hw config */
@@ -266,6 +561,28 @@ struct shannon_dev {
 
 	struct list_head mem_glisthead;
 	struct memory dummy_mem;
+	struct dma_pool dma_pool;
+	int dma_pool_depth;		/* 0 disable dma pool */
+	struct req_slab req_slab;
+	struct dma_region dma_region;
+	int zero_copy;			/* mmap dma region for REQ_DMA_MAPPED requests */
+	int map_rings;			/* mmap cmdqueue and cmpqueue of every thread */
+	int ring_maplen;		/* byte length mmaped per thread, 0 means not mmaped */
+	int print_stats;
+	struct poll_policy poll_policy[POLL_NCLASS];
+	int use_engine;				/* submit_polling_loop() hands requests to worker per hw thread */
+	int prng_mode;				/* generator of sector pattern by prng_fill_sector() */
+	struct pattern *pattern;		/* NULL unless --pattern, used instead of prng_mode */
+	struct shannon_engine *engine;		/* started by first engine_run() */
+	struct poll_stats full_poll_stats;	/* submit_polling_loop() waiting for a full thread */
+	long ndefer;				/* requests deferred behind a full thread or raid head */
+	long nplane_merge;			/* multi-plane chunks merged from single-plane requests */
+	int pe_limit;				/* dies per channel allowed to program/erase at once, 0 is no limit */
+	int *pe_inflight;			/* program/erase in flight per channel */
+	long npe_throttle;
+	struct shannon_latency *latency;	/* NULL unless --latency */
+	struct shannon_trace *trace;		/* NULL unless --trace */
+	struct shannon_sim *sim;	/* emulated controller, NULL for real device */
 
 	int iowidth;			/* 1, 8bit; 2, 16bit */
 	int tmode;
@@ -303,6 +620,7 @@ struct shannon_dev {
 	int lunreg_dwoff;
 	int lunreg_dwsize;
 	int bar_dwlen[2];
+	volatile __u32 *bar;		/* mmaped BAR0, NULL means registers are accessed by read/write syscall */
 
 	int timeout_silent;		/* 1 don`t print cmdqueue timeout information */
 	int valid_luns;
@@ -373,6 +691,9 @@ struct shannon_dev {
 	void (*free_mem)(struct shannon_dev *dev, struct memory *mem);
 	void (*read_mem)(struct shannon_dev *dev, void *user_addr, void *kernel_addr, int size);
 	void (*write_mem)(struct shannon_dev *dev, void *kernel_addr, void *user_addr, int size);
+	void (*read_mem_v)(struct shannon_dev *dev, struct shannon_iovec *iov, int niov);
+	void (*write_mem_v)(struct shannon_dev *dev, struct shannon_iovec *iov, int niov);
+	int no_mem_v;			/* driver doesn`t support vector ioctl, copy element one by one */
 
 	void (*deliver_userdata)(struct shannon_dev *dev);
 
@@ -513,12 +834,54 @@ static inline void pad_same_u32(void *buf, int count, __u32 value)
 		((__u32*)buf)[i] = value;
 }
 
-static inline void memxor(void *dst, void *src, int cnt)
+static inline void set_iovec(struct shannon_iovec *iov, void *kernel_addr, void *user_addr, int size)
 {
-	int i;
+	iov->kernel_addr = kernel_addr;
+	iov->user_addr = user_addr;
+	iov->size = size;
+}
+
+static inline long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* orders stores to dma memory before a following store to mmio BAR, as wmb() of kernel */
+static inline void wmb(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("sfence" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("dsb st" ::: "memory");
+#else
+	__sync_synchronize();
+#endif
+}
 
-	for (i = 0; i < cnt; i++)
-		((__u8 *)dst)[i] ^= ((__u8 *)src)[i];
+/* orders a load from mmio BAR before following loads from dma memory, as rmb() of kernel */
+static inline void rmb(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("lfence" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("dsb ld" ::: "memory");
+#else
+	__sync_synchronize();
+#endif
 }
 /*-----------------------------------------------------------------------------------------------------------------------------*/
 // init.c
@@ -526,6 +889,92 @@ extern struct shannon_dev *alloc_device(char *devname);
 extern int init_device(struct shannon_dev *dev);
 extern int re_init_device(struct shannon_dev *dev);
 extern void free_device(struct shannon_dev *dev);
+extern int mmap_device_bar(struct shannon_dev *dev);
+
+// mem.c
+extern int init_dma_pool(struct shannon_dev *dev);
+extern void free_dma_pool(struct shannon_dev *dev);
+extern struct memory *get_dma_mem(struct shannon_dev *dev, int size);
+extern void put_dma_mem(struct shannon_dev *dev, struct memory *mem);
+extern void pr_dma_pool_stats(struct shannon_dev *dev);
+extern int init_dma_region(struct shannon_dev *dev);
+extern void free_dma_region(struct shannon_dev *dev);
+extern int get_dma_slot(struct shannon_dev *dev);
+extern void put_dma_slot(struct shannon_dev *dev, int slot);
+extern void pr_dma_region_stats(struct shannon_dev *dev);
+extern void init_req_slab(struct shannon_dev *dev);
+extern void free_req_slab(struct shannon_dev *dev);
+extern struct shannon_request *get_slab_request(struct shannon_dev *dev);
+extern void put_slab_request(struct shannon_dev *dev, struct shannon_request *req);
+extern __u8 *get_slab_buf(struct shannon_dev *dev, struct shannon_request *req);
+extern void pr_req_slab_stats(struct shannon_dev *dev);
+
+// poll.c
+extern void init_poll_policy(struct shannon_dev *dev, int spin_us);
+extern int poll_class_lun(struct shannon_dev *dev, int lun);
+extern int poll_class_bufhead(struct shannon_dev *dev, int head);
+extern void poll_start(struct shannon_dev *dev, struct poll_state *ps, int class, struct poll_stats *stats);
+extern int poll_wait(struct poll_state *ps);
+extern void poll_progress(struct poll_state *ps);
+extern void poll_end(struct poll_state *ps);
+extern void pr_poll_stats(struct shannon_dev *dev);
+
+// engine.c
+extern int engine_run(struct shannon_dev *dev, struct list_head *req_head);
+extern void engine_retired(struct shannon_request *req);
+extern void free_engine(struct shannon_dev *dev);
+extern void pr_engine_stats(struct shannon_dev *dev);
+
+// latency.c
+extern int init_latency(struct shannon_dev *dev, char *file);
+extern void free_latency(struct shannon_dev *dev);
+extern void latency_record(struct shannon_dev *dev, struct shannon_request *req, long long now);
+extern void pr_latency(struct shannon_dev *dev);
+
+// pattern.c
+extern struct pattern *parse_pattern(struct shannon_dev *dev, const char *spec);
+extern void pattern_stream_init(struct pattern_stream *ps, const struct pattern *pt, __u32 key, int page, int sector, int sector_size);
+extern void pattern_stream_fill(struct pattern_stream *ps, void *buf, int count);
+extern void pattern_modify(const struct pattern *pt, void *buf, int count, int invert);
+
+// prng.c
+extern int parse_prng_mode(char *s);
+extern void prng_fill_sector(struct shannon_dev *dev, int seed, int lun, int ppa, int sector, void *data, void *metadata);
+extern void prng_fill_request(struct shannon_dev *dev, const struct pattern *pt, int seed, struct shannon_request *req);
+extern int prng_verify_sector(struct shannon_dev *dev, int seed, int lun, int ppa, int sector, void *data, void *metadata,
+	struct sector_verify *sv);
+
+// simd.c
+extern int cpu_has_avx2(void);
+extern long xor_popcount(const void *a, const void *b, int n);
+extern void xor_popcount_lanes(const void *a, const void *b, int n, long nbit[2], long nbyte[2]);
+extern void xor_into(void *dst, const void *src, int n);
+
+// trace.c
+extern int init_trace(struct shannon_dev *dev, char *file);
+extern void free_trace(struct shannon_dev *dev);
+extern void trace_submit(struct shannon_dev *dev, struct shannon_request *req);
+extern void trace_complete(struct shannon_dev *dev, struct shannon_request *req);
+extern int shannon_trace_decode(struct shannon_dev *dev, int argc, char **argv);
+
+// sched.c
+extern int merge_plane_array(struct shannon_dev *dev, struct shannon_request **reqs, int n);
+extern int split_plane_chunk(struct shannon_request *req, struct shannon_request **subs);
+extern int merge_planes(struct shannon_dev *dev, struct list_head *req_head);
+extern void split_planes(struct shannon_dev *dev, struct list_head *req_head);
+extern void interleave_requests(struct shannon_dev *dev, struct shannon_request **reqs, int n);
+extern void sched_pe_setup(struct shannon_dev *dev);
+extern int sched_pe_busy(struct shannon_dev *dev, struct shannon_request *req);
+extern void sched_pe_start(struct shannon_dev *dev, struct shannon_request *req);
+extern void sched_pe_retired(struct shannon_dev *dev, struct shannon_request *req);
+extern void free_sched(struct shannon_dev *dev);
+extern void pr_sched_stats(struct shannon_dev *dev);
+
+// sim.c
+extern int alloc_sim(struct shannon_dev *dev, char *geometry);
+extern void get_sim_thread_mem(struct shannon_dev *dev);
+extern void free_sim(struct shannon_dev *dev);
+extern void pr_sim_stats(struct shannon_dev *dev);
 
 // parse.c
 extern int parse_flash(struct shannon_dev *dev);
@@ -544,9 +993,18 @@ extern struct shannon_request *alloc_request(struct shannon_dev *dev, enum shann
 extern struct shannon_request *alloc_request_no_dma(struct shannon_dev *dev, enum shannon_cmd opcode,
 						   int lun, int ppa, int head, int bsector, int nsector, int no_dma);
 extern void free_request(struct shannon_request *req);
+extern void init_req_set(struct req_set *set, struct shannon_dev *dev);
+extern struct shannon_request *req_set_add(struct req_set *set, struct shannon_request *chunk_head_req, enum shannon_cmd opcode,
+					   int lun, int ppa_off, int head, int bsector, int nsector, int no_dma);
+extern void bind_req_set(struct req_set *set, int ppa);
+extern void list_req_set(struct req_set *set, struct list_head *req_head, unsigned long *skip_luns);
+extern int array_req_set(struct req_set *set, struct shannon_request **reqs, unsigned long *skip_luns);
+extern void free_req_set(struct req_set *set);
 extern int submit_request(struct shannon_request *req);
+extern int submit_batch(struct shannon_dev *dev, struct shannon_request **reqs, int n);
 extern void submit_polling_loop(struct shannon_dev *dev, struct list_head *req_head);
 
+extern int reap_cmdqueue(struct shannon_dev *dev, struct shannon_thread *thread);
 extern int __poll_cmdqueue(struct shannon_dev *dev, int lun, int wait);
 extern int __poll_bufcmdqueue(struct shannon_dev *dev, int head, int wait);
 
@@ -679,6 +1137,19 @@ static inline int check_status(struct shannon_dev *dev, enum shannon_cmd cmd, __
 	return (status & dev->flash->success_mask) == dev->flash->success_status;
 }
 
+/* requests of a raid head are ordered across luns, reads and erases carry no head */
+static inline int req_raid_head(struct shannon_request *req)
+{
+	switch (req->opcode) {
+	case sh_write_cmd:
+	case sh_raidinit_cmd:
+	case sh_raidwrite_cmd:
+		return (req->head & HEAD_MASK) < INDEP_HEAD;
+	default:
+		return 0;
+	}
+}
+
 /* coordinate of phylun is (get_phychannel, get_phythread, get_phylun) */
 static inline int get_phychannel(struct shannon_dev *dev, int loglun)
 {
@@ -733,6 +1204,27 @@ static inline void *zmalloc(int size)
 	return mem;
 }
 
+static inline __u8 *dma_slot_user_addr(struct shannon_dev *dev, int slot)
+{
+	return dev->dma_region.user_addr + slot * dev->dma_region.slot_size;
+}
+
+static inline dma_addr_t dma_slot_dma_addr(struct shannon_dev *dev, int slot)
+{
+	return dev->dma_region.dma_addr + slot * dev->dma_region.slot_size;
+}
+
+/* data is in dma region and hw can access it directly */
+static inline int req_dma_mapped(struct shannon_request *req)
+{
+	return req->dma_slot >= 0 && !req->rw_entire_buffer && req->data == dma_slot_user_addr(req->dev, req->dma_slot);
+}
+
+static inline int req_slab_owns(struct shannon_request *req, void *p)
+{
+	return NULL != req->slab_buf && (__u8 *)p >= req->slab_buf && (__u8 *)p < req->slab_buf + req->slab_bufsize;
+}
+
 static inline int is_bad_lunblock(struct shannon_dev *dev, int lun, int blk)
 {
 	if (!dev->targetlun[lun].blk_hole_count)
@@ -762,6 +1254,17 @@ static inline int superblock_ndatalun(struct shannon_dev *dev, int superblk)
 	return dev->sb[superblk].sb_luninfo.ndatalun;
 }
 
+/*
+ * end of user data of codeword cw in a sector. sector_size is not always a multiple of sector_ncodeword, so it is taken
+ * as an even split on QW boundaries
+ */
+static inline int codeword_data_end(struct shannon_dev *dev, int cw)
+{
+	if (cw + 1 >= dev->config->sector_ncodeword)
+		return dev->config->sector_size;
+	return ((cw + 1) * dev->config->sector_size / dev->config->sector_ncodeword) & ~(QW_SIZE - 1);
+}
+
 static inline int getseed(int way)
 {
 	struct timeval tv;
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include "tool.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+/*
+ * command trace: submit_request() and retirement append a fixed size record to an in-memory ring, nothing else is done
+ * in the io path. The ring is always on, --trace only chooses the file. The ring is written to file once, when the device is freed or the tool exits by exit(), SIGINT, an
+ * assert or a crash, so a firmware timeout leaves the latest commands and completions behind without a live capture.
+ */
+static struct shannon_dev *trace_dev;		/* device whose ring is not flushed yet */
+
+/* only open/write/close here, it may run in a signal handler */
+static void flush_trace(struct shannon_trace *trace)
+{
+	int fd, first, n;
+	unsigned long seq = trace->seq;
+	struct trace_file_head fh;
+
+	fd = open(trace->file, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+	if (fd < 0)
+		return;
+
+	memset(&fh, 0x00, sizeof(fh));
+	fh.magic = TRACE_MAGIC;
+	fh.version = TRACE_VERSION;
+	fh.rec_size = sizeof(struct trace_rec);
+	fh.nrec_total = seq;
+	fh.nrec = (seq < TRACE_DEPTH) ? seq : TRACE_DEPTH;
+	if (write(fd, &fh, sizeof(fh)) != sizeof(fh))
+		goto out;
+
+	/* oldest first, the ring wraps at most once */
+	first = (seq - fh.nrec) % TRACE_DEPTH;
+	n = (fh.nrec < TRACE_DEPTH - first) ? fh.nrec : TRACE_DEPTH - first;
+	if (write(fd, &trace->rec[first], n * sizeof(struct trace_rec)) != n * sizeof(struct trace_rec))
+		goto out;
+	if (fh.nrec > n && write(fd, trace->rec, (fh.nrec - n) * sizeof(struct trace_rec)) < 0)
+		goto out;
+out:
+	close(fd);
+}
+
+static void trace_atexit(void)
+{
+	if (NULL == trace_dev)
+		return;
+
+	flush_trace(trace_dev->trace);
+	trace_dev = NULL;
+}
+
+static void trace_fatal_signal(int sig)
+{
+	trace_atexit();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+int init_trace(struct shannon_dev *dev, char *file)
+{
+	static int registered;
+
+	dev->trace = zmalloc(sizeof(*dev->trace));
+	if (NULL == dev->trace)
+		return ALLOCMEM_FAILED;
+	dev->trace->file = file;
+
+	if (!registered) {
+		if (atexit(trace_atexit))
+			return ERR;
+		signal(SIGABRT, trace_fatal_signal);
+		signal(SIGSEGV, trace_fatal_signal);
+		signal(SIGBUS, trace_fatal_signal);
+		registered = 1;
+	}
+
+	trace_dev = dev;
+	return 0;
+}
+
+void free_trace(struct shannon_dev *dev)
+{
+	if (NULL == dev->trace)
+		return;
+
+	if (trace_dev == dev)
+		trace_atexit();
+	free(dev->trace);
+	dev->trace = NULL;
+}
+
+static void trace_req(struct shannon_trace *trace, struct shannon_request *req, int type, long long ns)
+{
+	struct trace_rec *rec = &trace->rec[__sync_fetch_and_add(&trace->seq, 1) % TRACE_DEPTH];
+
+	rec->ns = ns;
+	rec->status = 0;
+	if (TRACE_COMPLETE == type && sh_cacheread_cmd == req->opcode)
+		memcpy(&rec->status, req->ecc, (req->nsector < 8) ? req->nsector : 8);	/* ecc of sector k in byte k */
+	else if (TRACE_COMPLETE == type)
+		rec->status = req->status;
+	rec->ppa = req->ppa;
+	rec->lun = req->lun;
+	rec->cmdhead = req->cmdhead;
+	rec->head = req->head;
+	rec->type = type;
+	rec->opcode = req->opcode;
+}
+
+/* chunk siblings are traced one by one behind their chunk head */
+void trace_submit(struct shannon_dev *dev, struct shannon_request *req)
+{
+	long long ns = now_ns();
+	struct shannon_request *sub;
+
+	trace_req(dev->trace, req, TRACE_SUBMIT, ns);
+	list_for_each_entry(sub, &req->chunk_list, chunk_list)
+		trace_req(dev->trace, sub, TRACE_SUBMIT, ns);
+}
+
+void trace_complete(struct shannon_dev *dev, struct shannon_request *req)
+{
+	trace_req(dev->trace, req, TRACE_COMPLETE, now_ns());
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------*/
+static void shannon_trace_decode_usage(void)
+{
+	printf("Usage:\n");
+	printf("\ttrace-decode [option] trace-file\n\n");
+
+	printf("Description:\n");
+	printf("\tDecode trace file written by --trace to text, time is us since the first record. Completion of cacheread shows\n"
+		"\tecc of its first 8 sectors, status in csv holds them from the lowest byte\n\n");
+
+	printf("Option:\n");
+	printf("\t-c, --csv\n\t\tPrint as csv with raw ns\n");
+	printf("\t-h, --help\n\t\tDisplay this help and exit\n");
+}
+
+static const char *trace_opcode_name(int opcode)
+{
+	switch (opcode) {
+	case sh_preread_cmd:
+		return "preread";
+	case sh_cacheread_cmd:
+		return "cacheread";
+	case sh_last_cacheread_cmd:
+		return "lastcacheread";
+	case sh_cacheread_adv_cmd:
+		return "cacheread-adv";
+	case sh_erase_cmd:
+		return "erase";
+	case sh_write_cmd:
+		return "write";
+	case sh_bufwrite_cmd:
+		return "bufwrite";
+	case sh_bufread_cmd:
+		return "bufread";
+	case sh_readid_cmd:
+		return "readid";
+	case sh_writereg_cmd:
+		return "writereg";
+	case sh_raidwrite_cmd:
+		return "raidwrite";
+	case sh_raidinit_cmd:
+		return "raidinit";
+	case sh_reset_cmd:
+		return "reset";
+	default:
+		return "unknown";
+	}
+}
+
+int shannon_trace_decode(struct shannon_dev *dev, int argc, char **argv)
+{
+	struct option longopts [] = {
+		{"csv", no_argument, NULL, 'c'},
+		{"help", no_argument, NULL, 'h'},
+		{0, 0, 0, 0},
+	};
+	int opt, csv, i;
+	int rc = ERR;
+	FILE *fp;
+	struct trace_file_head fh;
+	struct trace_rec rec;
+	unsigned long long seq, first_ns;
+	__u8 *ecc;
+
+	csv = 0;
+
+	while ((opt = getopt_long(argc, argv, ":ch", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			csv = 1;
+			break;
+		case 'h':
+			shannon_trace_decode_usage();
+			return 0;
+		default:
+			shannon_trace_decode_usage();
+			return ERR;
+		}
+	}
+
+	if ((argc - optind) != 1) {
+		shannon_trace_decode_usage();
+		return ERR;
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (NULL == fp) {
+		perror("Open trace file");
+		return ERR;
+	}
+
+	if (1 != fread(&fh, sizeof(fh), 1, fp) || TRACE_MAGIC != fh.magic) {
+		printf("%s is not a trace file\n", argv[optind]);
+		goto out;
+	}
+	if (TRACE_VERSION != fh.version || sizeof(rec) != fh.rec_size) {
+		printf("Unsupported trace version %d record size %d\n", fh.version, fh.rec_size);
+		goto out;
+	}
+
+	if (csv)
+		printf("seq,ns,type,lun,opcode,ppa,head,cmdhead,status\n");
+	else
+		printf("# %u records of %llu traced\n", fh.nrec, (unsigned long long)fh.nrec_total);
+
+	seq = fh.nrec_total - fh.nrec;
+	first_ns = 0;
+	for (i = 0; i < fh.nrec; i++, seq++) {
+		if (1 != fread(&rec, sizeof(rec), 1, fp)) {
+			printf("Trace file is truncated at record %llu\n", seq);
+			goto out;
+		}
+		if (0 == i)
+			first_ns = rec.ns;
+
+		if (csv) {
+			printf("%llu,%llu,%s,%d,%s,0x%08X,%d,0x%04X,0x%016llX\n", seq, (unsigned long long)rec.ns,
+				(TRACE_SUBMIT == rec.type) ? "submit" : "complete", rec.lun, trace_opcode_name(rec.opcode),
+				rec.ppa, rec.head, rec.cmdhead, (unsigned long long)rec.status);
+		} else if (TRACE_SUBMIT == rec.type) {
+			printf("%8llu %12.3f submit   lun-%03d %-13s ppa=0x%08X head=%d cmdhead=0x%04X\n", seq,
+				(rec.ns - first_ns) / 1000.0, rec.lun, trace_opcode_name(rec.opcode), rec.ppa, rec.head, rec.cmdhead);
+		} else if (sh_cacheread_cmd == rec.opcode) {
+			ecc = (__u8 *)&rec.status;
+			printf("%8llu %12.3f complete lun-%03d %-13s ppa=0x%08X head=%d cmdhead=0x%04X ecc=%02X %02X %02X %02X %02X %02X %02X %02X\n",
+				seq, (rec.ns - first_ns) / 1000.0, rec.lun, trace_opcode_name(rec.opcode), rec.ppa, rec.head, rec.cmdhead,
+				ecc[0], ecc[1], ecc[2], ecc[3], ecc[4], ecc[5], ecc[6], ecc[7]);
+		} else {
+			printf("%8llu %12.3f complete lun-%03d %-13s ppa=0x%08X head=%d cmdhead=0x%04X status=%016llX\n", seq,
+				(rec.ns - first_ns) / 1000.0, rec.lun, trace_opcode_name(rec.opcode), rec.ppa, rec.head, rec.cmdhead,
+				(unsigned long long)rec.status);
+		}
+	}
+	rc = 0;
+out:
+	fclose(fp);
+	return rc;
+}
+/*----------------------------------------------------------------------------------------------------------------------------------*/